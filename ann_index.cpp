@@ -0,0 +1,404 @@
+#include "ann_index.h"
+
+#include <vector>
+#include <random>
+#include <queue>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+namespace {
+    thread_local ThreadGenerator gen;
+
+    const char kMagic[8] = {'H', 'N', 'S', 'W', 'I', 'D', 'X', '1'};
+
+    struct Header {
+        char magic[8];
+        int real_size, size, dim, max_degree, max_level, entry;
+        long long upper_size;
+    };
+
+    // Generation-stamped visited marks, reused by every search of the same thread
+    struct VisitedSet {
+        std::vector<unsigned> stamp;
+        unsigned current = 0;
+
+        void Reset(int size) {
+            if ((int)stamp.size() < size)
+                stamp.resize(size, 0);
+            if (++current == 0) {
+                std::fill(stamp.begin(), stamp.end(), 0);
+                current = 1;
+            }
+        }
+        bool Visit(int x) {
+            if (stamp[x] == current) return false;
+            stamp[x] = current;
+            return true;
+        }
+    };
+
+    VisitedSet& ThreadVisitedSet() {
+        thread_local VisitedSet visited;
+        return visited;
+    }
+
+    template <typename T>
+    void WriteSection(std::ofstream& fout, const T* data, long long count) {
+        fout.write((const char*)data, count * sizeof(T));
+    }
+}   // anonymous namespace
+
+struct HNSWIndex::Candidate {
+    double sim;
+    int node;
+    bool operator<(const Candidate& o) const { return sim < o.sim; }
+    bool operator>(const Candidate& o) const { return sim > o.sim; }
+};
+
+HNSWIndex::HNSWIndex()
+    : size_(0), dim_(0), max_degree_(0), max_level_(0), entry_(0), kernel_(&GetVectorKernel(0)),
+      aug_(nullptr), upper_offset_(nullptr), vector_(nullptr), level_(nullptr), link0_(nullptr), upper_(nullptr),
+      upper_size_(0) {}
+
+const int* HNSWIndex::Links(int x, int level) const {
+    if (level == 0)
+        return link0_ + (long long)x * (2 * max_degree_ + 1);
+    return upper_ + upper_offset_[x] + (long long)(level - 1) * (max_degree_ + 1);
+}
+
+int* HNSWIndex::MutableLinks(int x, int level) {
+    if (level == 0)
+        return link0_store_.data() + (long long)x * (2 * max_degree_ + 1);
+    return upper_store_.data() + upper_offset_store_[x] + (long long)(level - 1) * (max_degree_ + 1);
+}
+
+// Similarity of two indexed nodes in the augmented space, i.e. M^2 minus half their squared distance
+double HNSWIndex::Similarity(int x, int y) const {
+    return kernel_->inner_product(vector_ + (long long)x * dim_, vector_ + (long long)y * dim_, dim_) + aug_[x] * aug_[y];
+}
+
+template <typename Sim>
+int HNSWIndex::Greedy(const Sim& sim, int entry, int level, std::vector<std::mutex>* lock) const {
+    int current = entry;
+    double best = sim(current);
+    std::vector<int> neighbor;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        const int* links = Links(current, level);
+        if (lock != nullptr) {
+            std::lock_guard<std::mutex> guard((*lock)[current]);
+            neighbor.assign(links + 1, links + 1 + links[0]);
+        } else {
+            neighbor.assign(links + 1, links + 1 + links[0]);
+        }
+        for (int y : neighbor) {
+            double s = sim(y);
+            if (s > best) {
+                best = s;
+                current = y;
+                changed = true;
+            }
+        }
+    }
+    return current;
+}
+
+// Beam search on one layer; found returns up to ef candidates, best first
+template <typename Sim>
+void HNSWIndex::SearchLayer(const Sim& sim, int entry, int ef, int level, std::vector<std::mutex>* lock,
+                            std::vector<Candidate>* found) const {
+    VisitedSet& visited = ThreadVisitedSet();
+    visited.Reset(size_);
+    std::priority_queue<Candidate> frontier;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> best;
+    Candidate start = {sim(entry), entry};
+    visited.Visit(entry);
+    frontier.push(start);
+    best.push(start);
+    std::vector<int> neighbor;
+    while (!frontier.empty()) {
+        Candidate c = frontier.top();
+        if ((int)best.size() >= ef && c.sim < best.top().sim)
+            break;
+        frontier.pop();
+        const int* links = Links(c.node, level);
+        if (lock != nullptr) {
+            std::lock_guard<std::mutex> guard((*lock)[c.node]);
+            neighbor.assign(links + 1, links + 1 + links[0]);
+        } else {
+            neighbor.assign(links + 1, links + 1 + links[0]);
+        }
+        for (int y : neighbor) {
+            if (!visited.Visit(y)) continue;
+            Candidate next = {sim(y), y};
+            if ((int)best.size() < ef || next.sim > best.top().sim) {
+                frontier.push(next);
+                best.push(next);
+                if ((int)best.size() > ef)
+                    best.pop();
+            }
+        }
+    }
+    found->resize(best.size());
+    for (int i = best.size() - 1; i >= 0; --i) {
+        found->at(i) = best.top();
+        best.pop();
+    }
+}
+
+// Keeps candidates (sorted best first) that are closer to the base node than to any kept one,
+// then tops up with the pruned ones so that sparse regions still get max_degree links
+void HNSWIndex::SelectNeighbors(std::vector<Candidate>* candidate, int max_degree) const {
+    if ((int)candidate->size() <= max_degree) return;
+    std::vector<Candidate> kept, pruned;
+    for (const Candidate& c : *candidate) {
+        if ((int)kept.size() >= max_degree) break;
+        bool diverse = true;
+        for (const Candidate& k : kept)
+            if (Similarity(c.node, k.node) > c.sim) {
+                diverse = false;
+                break;
+            }
+        (diverse ? kept : pruned).push_back(c);
+    }
+    for (int i = 0; i < (int)pruned.size() && (int)kept.size() < max_degree; ++i)
+        kept.push_back(pruned[i]);
+    candidate->swap(kept);
+}
+
+void HNSWIndex::Insert(int x, int ef_construction, std::vector<std::mutex>* lock, std::mutex* entry_lock) {
+    int entry, top;
+    {
+        std::lock_guard<std::mutex> guard(*entry_lock);
+        entry = entry_;
+        top = max_level_;
+    }
+    auto sim = [this, x](int y) { return Similarity(x, y); };
+    for (int level = top; level > level_[x]; --level)
+        entry = Greedy(sim, entry, level, lock);
+
+    std::vector<Candidate> found, neighbor;
+    for (int level = std::min(top, level_[x]); level >= 0; --level) {
+        int capacity = (level == 0 ? 2 * max_degree_ : max_degree_);
+        SearchLayer(sim, entry, ef_construction, level, lock, &found);
+        entry = found[0].node;
+        SelectNeighbors(&found, max_degree_);
+        {
+            std::lock_guard<std::mutex> guard((*lock)[x]);
+            int* links = MutableLinks(x, level);
+            links[0] = found.size();
+            for (int i = 0; i < (int)found.size(); ++i)
+                links[i + 1] = found[i].node;
+        }
+        for (const Candidate& c : found) {
+            std::lock_guard<std::mutex> guard((*lock)[c.node]);
+            int* links = MutableLinks(c.node, level);
+            if (links[0] < capacity) {
+                links[++links[0]] = x;
+                continue;
+            }
+            neighbor.clear();
+            neighbor.push_back({c.sim, x});
+            for (int i = 1; i <= links[0]; ++i)
+                neighbor.push_back({Similarity(c.node, links[i]), links[i]});
+            std::sort(neighbor.begin(), neighbor.end(), std::greater<Candidate>());
+            SelectNeighbors(&neighbor, capacity);
+            links[0] = neighbor.size();
+            for (int i = 0; i < (int)neighbor.size(); ++i)
+                links[i + 1] = neighbor[i].node;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(*entry_lock);
+    if (level_[x] > max_level_) {
+        max_level_ = level_[x];
+        entry_ = x;
+    }
+}
+
+void HNSWIndex::Bind() {
+    aug_ = aug_store_.data();
+    upper_offset_ = upper_offset_store_.data();
+    vector_ = vector_store_.data();
+    level_ = level_store_.data();
+    link0_ = link0_store_.data();
+    upper_ = upper_store_.data();
+    kernel_ = &GetVectorKernel(dim_);
+}
+
+bool HNSWIndex::Build(Model* model, int size, int max_degree, int ef_construction) {
+    file_.Close();
+    bool target = size > 0 && model->GetTargetEmbedding(0).size() > 0;
+    int dim = size == 0 ? 0 : (target ? model->GetTargetEmbedding(0).size() : model->GetEmbedding(0).size());
+    if (dim == 0) return false;
+    size_ = size;
+    dim_ = dim;
+    max_degree_ = max_degree;
+
+    vector_store_.resize((long long)size * dim);
+    aug_store_.resize(size);
+    double max_sqr_norm = 0;
+    for (int y = 0; y < size; ++y) {
+        EmbeddingView row = target ? model->GetTargetEmbedding(y) : model->GetEmbedding(y);
+        std::copy(row.begin(), row.end(), vector_store_.begin() + (long long)y * dim);
+        aug_store_[y] = InnerProduct(row.data(), row.data(), dim);
+        max_sqr_norm = std::max(max_sqr_norm, aug_store_[y]);
+    }
+    for (int y = 0; y < size; ++y)
+        aug_store_[y] = sqrt(std::max(0.0, max_sqr_norm - aug_store_[y]));
+
+    // Levels follow a geometric law with ratio 1 / max_degree
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double mult = 1 / log(std::max(2, max_degree));
+    level_store_.resize(size);
+    upper_offset_store_.resize(size);
+    upper_size_ = 0;
+    for (int y = 0; y < size; ++y) {
+        level_store_[y] = (int)(-log(1 - uniform(gen)) * mult);
+        upper_offset_store_[y] = upper_size_;
+        upper_size_ += (long long)level_store_[y] * (max_degree + 1);
+    }
+    link0_store_.assign((long long)size * (2 * max_degree + 1), 0);
+    upper_store_.assign(upper_size_, 0);
+    Bind();
+
+    entry_ = 0;
+    max_level_ = level_[0];
+    std::vector<std::mutex> lock(size);
+    std::mutex entry_lock;
+    ParallelFor(size - 1, [&](int i) { Insert(i + 1, ef_construction, &lock, &entry_lock); });
+    return true;
+}
+
+bool HNSWIndex::Save(const std::string& file_name) const {
+    std::ofstream fout(file_name, std::ios::binary);
+    if (!fout) return false;
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.real_size = sizeof(real);
+    header.size = size_;
+    header.dim = dim_;
+    header.max_degree = max_degree_;
+    header.max_level = max_level_;
+    header.entry = entry_;
+    header.upper_size = upper_size_;
+    fout.write((const char*)&header, sizeof(header));
+    // Sections go from widest to narrowest element type so every one stays naturally aligned
+    WriteSection(fout, aug_, size_);
+    WriteSection(fout, upper_offset_, size_);
+    WriteSection(fout, vector_, (long long)size_ * dim_);
+    WriteSection(fout, level_, size_);
+    WriteSection(fout, link0_, (long long)size_ * (2 * max_degree_ + 1));
+    WriteSection(fout, upper_, upper_size_);
+    return (bool)fout;
+}
+
+bool HNSWIndex::Load(const std::string& file_name) {
+    // Everything is checked against a local mapping, so a bad file leaves the current index untouched
+    MappedFile file;
+    if (!file.Open(file_name) || file.size() < sizeof(Header)) return false;
+    Header header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.real_size != sizeof(real)) return false;
+    if (header.size < 0 || header.dim < 0 || header.max_degree < 0 || header.max_level < 0 || header.upper_size < 0 ||
+        header.upper_size > (long long)(file.size() / sizeof(int)))
+        return false;
+    long long n = header.size;
+    size_t expected = sizeof(Header) + n * (sizeof(double) + sizeof(long long) + sizeof(int))
+                      + n * header.dim * sizeof(real)
+                      + (n * (2 * header.max_degree + 1) + header.upper_size) * sizeof(int);
+    if (file.size() != expected) return false;
+
+    const char* p = file.data() + sizeof(Header);
+    const double* aug = (const double*)p;
+    p += n * sizeof(double);
+    const long long* upper_offset = (const long long*)p;
+    p += n * sizeof(long long);
+    const real* vector = (const real*)p;
+    p += n * header.dim * sizeof(real);
+    const int* level = (const int*)p;
+    p += n * sizeof(int);
+    const int* link0 = (const int*)p;
+    p += n * (2 * header.max_degree + 1) * sizeof(int);
+    const int* upper = (const int*)p;
+
+    // Search starts at the entry on max_level and follows links on each level down to 0, so every
+    // node it can reach must hold that many levels, and every link must name such a node
+    if (n > 0 && (header.entry < 0 || header.entry >= n || level[header.entry] != header.max_level)) return false;
+    long long width = header.max_degree + 1;
+    for (long long x = 0; x < n; ++x)
+        if (level[x] < 0 || level[x] > header.max_level || upper_offset[x] < 0 ||
+            upper_offset[x] > header.upper_size - level[x] * width)
+            return false;
+    for (long long x = 0; x < n; ++x)
+        for (int l = 0; l <= level[x]; ++l) {
+            const int* links = l == 0 ? link0 + x * (2 * header.max_degree + 1) : upper + upper_offset[x] + (l - 1) * width;
+            if (links[0] < 0 || links[0] > (l == 0 ? 2 * header.max_degree : header.max_degree)) return false;
+            for (int k = 1; k <= links[0]; ++k)
+                if (links[k] < 0 || links[k] >= n || level[links[k]] < l) return false;
+        }
+
+    file_.Swap(&file);
+    aug_store_.clear();
+    upper_offset_store_.clear();
+    vector_store_.clear();
+    level_store_.clear();
+    link0_store_.clear();
+    upper_store_.clear();
+    size_ = header.size;
+    dim_ = header.dim;
+    max_degree_ = header.max_degree;
+    max_level_ = header.max_level;
+    entry_ = header.entry;
+    upper_size_ = header.upper_size;
+    kernel_ = &GetVectorKernel(dim_);
+    aug_ = aug;
+    upper_offset_ = upper_offset;
+    vector_ = vector;
+    level_ = level;
+    link0_ = link0;
+    upper_ = upper;
+    return true;
+}
+
+void HNSWIndex::Search(const real* query, int k, int ef, std::vector<std::pair<int, double>>* result) const {
+    result->clear();
+    if (size_ == 0) return;
+    auto sim = [this, query](int y) { return kernel_->inner_product(query, vector_ + (long long)y * dim_, dim_); };
+    int entry = entry_;
+    for (int level = max_level_; level > 0; --level)
+        entry = Greedy(sim, entry, level, nullptr);
+    std::vector<Candidate> found;
+    SearchLayer(sim, entry, std::max(ef, k), 0, nullptr, &found);
+    for (int i = 0; i < (int)found.size() && i < k; ++i)
+        result->push_back(std::make_pair(found[i].node, found[i].sim));
+}
+
+double EvaluateIndexRecall(const HNSWIndex& index, Model* model, const std::vector<int>& query, int k, int ef) {
+    std::vector<std::vector<std::pair<int, double>>> exact, approx(query.size());
+    RecommendTopK(model, Graph(index.size()), query, k, &exact);
+    // The exact search never returns the query node itself, so ask the index for one more
+    ParallelFor(query.size(), [&](int q) {
+        EmbeddingView source = model->GetSourceEmbedding(query[q]);
+        if (source.size() == 0)
+            source = model->GetEmbedding(query[q]);
+        index.Search(source.data(), k + 1, ef, &approx[q]);
+        approx[q].erase(std::remove_if(approx[q].begin(), approx[q].end(),
+                                       [&](const std::pair<int, double>& r) { return r.first == query[q]; }),
+                        approx[q].end());
+        if ((int)approx[q].size() > k)
+            approx[q].resize(k);
+    });
+    long long hit = 0, total = 0;
+    for (int q = 0; q < (int)query.size(); ++q) {
+        std::vector<int> truth;
+        for (const auto& r : exact[q])
+            truth.push_back(r.first);
+        std::sort(truth.begin(), truth.end());
+        for (const auto& r : approx[q])
+            hit += std::binary_search(truth.begin(), truth.end(), r.first);
+        total += truth.size();
+    }
+    return total > 0 ? (double)hit / total : 1;
+}
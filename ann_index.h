@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include "base.h"
+#include "utility.h"
+
+// Hierarchical navigable small world graph over the target embeddings of a model, answering
+// maximum inner-product queries. Targets get one extra coordinate sqrt(M^2 - |y|^2), M being the
+// largest target norm, so that inner-product order equals Euclidean order in the augmented space.
+class HNSWIndex {
+  public:
+    HNSWIndex();
+
+    // Indexes GetTargetEmbedding(y) of every node, or GetEmbedding(y) for models without a target side.
+    // Returns false when the model exposes no dense embedding.
+    bool Build(Model* model, int size, int max_degree, int ef_construction);
+    bool Save(const std::string& file_name) const;
+    // Maps the file read-only; the index keeps pointing into the mapping until the next Build / Load
+    bool Load(const std::string& file_name);
+
+    // Up to k (node, inner product) pairs in decreasing order of inner product; thread-safe
+    void Search(const real* query, int k, int ef, std::vector<std::pair<int, double>>* result) const;
+
+    int size() const { return size_; }
+    int dim() const { return dim_; }
+
+  private:
+    struct Candidate;
+    const int* Links(int x, int level) const;
+    int* MutableLinks(int x, int level);
+    double Similarity(int x, int y) const;
+    template <typename Sim>
+    int Greedy(const Sim& sim, int entry, int level, std::vector<std::mutex>* lock) const;
+    template <typename Sim>
+    void SearchLayer(const Sim& sim, int entry, int ef, int level, std::vector<std::mutex>* lock,
+                     std::vector<Candidate>* found) const;
+    void SelectNeighbors(std::vector<Candidate>* candidate, int max_degree) const;
+    void Insert(int x, int ef_construction, std::vector<std::mutex>* lock, std::mutex* entry_lock);
+    void Bind();
+
+    int size_, dim_, max_degree_, max_level_, entry_;
+    const VectorKernel* kernel_;
+
+    // Flat sections, in file order; pointers refer either to the owned vectors or to the mapped file
+    const double* aug_;
+    const long long* upper_offset_;
+    const real* vector_;
+    const int* level_;
+    const int* link0_;
+    const int* upper_;
+    long long upper_size_;
+
+    std::vector<double> aug_store_;
+    std::vector<long long> upper_offset_store_;
+    std::vector<real> vector_store_;
+    std::vector<int> level_store_, link0_store_, upper_store_;
+    MappedFile file_;
+};
+
+// Fraction of the exact top k (as found by RecommendTopK) that the index returns for each query node
+double EvaluateIndexRecall(const HNSWIndex& index, Model* model, const std::vector<int>& query, int k, int ef);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <ostream>
+#include "utility.h"
 
 struct Matrix {
     int m, n;
@@ -20,6 +23,7 @@ struct Graph {
         edge[x].push_back(y);
         edge[y].push_back(x);
     }
+    const std::vector<int>& Neighbors(int x) const { return edge[x]; }
 };
 
 struct DGraph {
@@ -41,6 +45,133 @@ struct Edge {
     Edge(int x_, int y_) : x(x_), y(y_) {}
 };
 
+struct NeighborRange {
+    const int* first;
+    const int* last;
+    NeighborRange(const int* first_, const int* last_) : first(first_), last(last_) {}
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    size_t size() const { return last - first; }
+    int operator[](size_t i) const { return first[i]; }
+};
+
+// Immutable compressed sparse row graph. The neighbors of x are neighbor[offset[x], offset[x + 1]),
+// sorted by id; an undirected edge is stored as one half-edge in each endpoint's range.
+struct CSRGraph {
+    int size;
+    std::vector<long long> offset;
+    std::vector<int> neighbor;
+    CSRGraph() : size(0), offset(1, 0) {}
+    NeighborRange Neighbors(int x) const {
+        return NeighborRange(neighbor.data() + offset[x], neighbor.data() + offset[x + 1]);
+    }
+};
+
+// Calls visit(z) for every z in both sorted ranges. A much longer range is galloped through;
+// otherwise the two are merged, skipping four entries at a time while one side lags behind.
+template <typename Visitor>
+void IntersectSorted(NeighborRange a, NeighborRange b, Visitor visit) {
+    if (a.size() > b.size())
+        std::swap(a, b);
+    size_t na = a.size(), nb = b.size();
+    if (na == 0) return;
+    if (nb / na >= 32) {
+        size_t lo = 0;
+        for (int z : a) {
+            size_t hi = lo, step = 1;
+            while (hi < nb && b[hi] < z) {
+                lo = hi + 1;
+                hi += step;
+                step <<= 1;
+            }
+            lo = std::lower_bound(b.first + lo, b.first + std::min(hi + 1, nb), z) - b.first;
+            if (lo == nb) return;
+            if (b[lo] == z) {
+                visit(z);
+                ++lo;
+            }
+        }
+        return;
+    }
+    size_t i = 0, j = 0;
+    while (i < na && j < nb) {
+        if (i + 4 <= na && a[i + 3] < b[j]) {
+            i += 4;
+        } else if (j + 4 <= nb && b[j + 3] < a[i]) {
+            j += 4;
+        } else if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            visit(a[i]);
+            ++i;
+            ++j;
+        }
+    }
+}
+
+struct CSRDGraph {
+    int size;
+    CSRGraph out_edge, in_edge;
+    CSRDGraph() : size(0) {}
+};
+
+// Collects edges and emits a CSRGraph with one parallel sort instead of growing per-node vectors
+class CSRGraphBuilder {
+    int size_;
+    std::vector<unsigned long long> arc_;
+  public:
+    CSRGraphBuilder(int size) : size_(size) {}
+    void Reserve(long long arcs) { arc_.reserve(arcs); }
+    // Directed arc x -> y
+    void AddArc(int x, int y) { arc_.push_back((unsigned long long)x << 32 | (unsigned)y); }
+    // Undirected edge, stored as both half-edges
+    void AddEdge(int x, int y) { AddArc(x, y); AddArc(y, x); }
+    // Preallocates arcs slots for SetArc, which may then be called from several threads
+    void Resize(long long arcs) { arc_.resize(arcs); }
+    void SetArc(long long i, int x, int y) { arc_[i] = (unsigned long long)x << 32 | (unsigned)y; }
+    // Releases the collected edges; set unique to drop duplicate arcs
+    void Build(CSRGraph* graph, bool unique);
+};
+
+// Read-mostly CSR variant whose sorted neighbor lists are delta + varint encoded
+struct CompressedCSRGraph {
+    int size;
+    std::vector<long long> offset;
+    std::vector<unsigned char> data;
+    CompressedCSRGraph() : size(0), offset(1, 0) {}
+    void Decode(int x, std::vector<int>* neighbor) const;
+    template <typename Visitor>
+    void ForEachNeighbor(int x, Visitor visit) const {
+        int prev = 0;
+        for (long long i = offset[x]; i < offset[x + 1];) {
+            unsigned value = 0;
+            for (int shift = 0;; shift += 7) {
+                unsigned char byte = data[i++];
+                value |= (unsigned)(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) break;
+            }
+            prev += value;
+            visit(prev);
+        }
+    }
+};
+
+// Non-owning view of one embedding row; rows stay owned by the model (or a mapped file).
+struct EmbeddingView {
+    const real* ptr;
+    int dim;
+    EmbeddingView() : ptr(nullptr), dim(0) {}
+    EmbeddingView(const real* ptr_, int dim_) : ptr(ptr_), dim(dim_) {}
+    EmbeddingView(const std::vector<real>& vec) : ptr(vec.data()), dim((int)vec.size()) {}
+    const real* data() const { return ptr; }
+    int size() const { return dim; }
+    real operator[](int i) const { return ptr[i]; }
+    const real* begin() const { return ptr; }
+    const real* end() const { return ptr + dim; }
+};
+
 struct SingleLabel {
     int size;
     std::vector<int> label;
@@ -54,8 +185,8 @@ struct Label {
     int size, card;
     std::vector<std::vector<int>> label_instance;
     std::vector<bool> labeled;
-    Label() {}
-    Label(int size_) : size(size_), labeled(size_, false) {}
+    Label() : size(0), card(0) {}
+    Label(int size_) : size(size_), card(0), labeled(size_, false) {}
     void SetLabel(int x, int l) {
         if (l >= (int)label_instance.size()) {
             label_instance.resize(l + 1);
@@ -66,29 +197,168 @@ struct Label {
     }
 };
 
+// State of a dual coordinate descent model: its embedding rows, the dual coefficients of every node's
+// subproblem, and the seed of any pairs it sampled. A model of the same type and dimension on the same
+// graphs can start from it instead of a random embedding.
+struct ModelState {
+    std::vector<std::vector<real>> embedding;
+    std::vector<std::vector<double>> coeff;
+    unsigned seed;
+    ModelState() : seed(0) {}
+};
+
 class Model {
-    std::vector<double> null_;
   public:
     Model() {}
     virtual ~Model() {}
     virtual double Evaluate(int x, int y) { return 0; }
-    virtual const std::vector<double>& GetEmbedding(int x) { return null_; }
+    virtual EmbeddingView GetEmbedding(int x) { return EmbeddingView(); }
+    // Whether Evaluate may be called from several threads at once
+    virtual bool IsThreadSafe() { return true; }
+    // For inner-product models Evaluate(x, y) == <GetSourceEmbedding(x), GetTargetEmbedding(y)>;
+    // other models leave these empty
+    virtual EmbeddingView GetSourceEmbedding(int x) { return EmbeddingView(); }
+    virtual EmbeddingView GetTargetEmbedding(int x) { return EmbeddingView(); }
+    // Copies the state of models that can be warm-started; false for the others
+    virtual bool GetState(ModelState* state) { return false; }
+};
+
+// Objective of one node's subproblem at the current embedding; models without a dual leave it NaN
+struct NodeObjective {
+    double primal, dual;
+    long long active;
+    NodeObjective() : primal(0), dual(0), active(0) {}
+};
+
+// Statistics of one training epoch. The objectives sum the per-node subproblems with the neighbors'
+// embeddings held fixed, so gap = primal - dual >= 0 measures how far the blocks are from optimal.
+struct EpochStats {
+    int epoch;
+    double seconds, updates_per_second;
+    double primal, dual, gap;
+    long long active;           // nonzero dual coefficients
+    double validation_ap;       // -1 without a validation set
+};
+
+// Limits on training, each disabled by 0. Without a validation set patience has no effect.
+struct StoppingRule {
+    int max_epochs;             // replaces the trainer's own epoch count
+    double min_change;          // stop once the primal objective moves by less than this fraction in an epoch
+    int patience;               // stop after this many epochs without a better validation AP
+    double seconds;             // wall-clock budget from the first epoch, statistics passes included
+    StoppingRule() : max_epochs(0), min_change(0), patience(0), seconds(0) {}
+};
+
+// Receives EpochStats from the trainers after every epoch and decides when they stop. The statistics
+// pass is not counted in the epoch time.
+//
+// When a validation set is kept and the rule has a patience or a time budget, the trainers copy their
+// parameters at the epoch with the best validation AP and hand those back if training went past it.
+class TrainingMonitor {
+    std::vector<Edge> validation_pos_, validation_neg_;
+    StoppingRule rule_;
+    double begin_, start_;
+    double last_primal_, best_ap_;
+    int last_epoch_, best_epoch_;
+    std::string stop_reason_;
+
+    void Reset();
+  public:
+    TrainingMonitor() : begin_(0), start_(0) { Reset(); }
+    virtual ~TrainingMonitor() {}
+    // Keeps up to sample edges of each graph to score after every epoch
+    void SetValidation(const Graph& pos, const Graph& neg, int sample);
+    void SetValidation(const DGraph& pos, const DGraph& neg, int sample);
+    void SetStoppingRule(const StoppingRule& rule) { rule_ = rule; }
+    // Whether the trainer runs epoch, given its own epoch count; epoch 0 starts a new run
+    bool Continue(int epoch, int epochs);
+    // Called by the trainers around each epoch; objective(x, &out) evaluates the subproblem of node x
+    void BeginEpoch();
+    void EndEpoch(Model* model, int epoch, int size, long long updates,
+                  const std::function<void(int, NodeObjective*)>& objective);
+    // Called instead of EndEpoch by a trainer that found no node left to update
+    void Converged() { stop_reason_ = "converged"; }
+    // Whether the trainers should copy their parameters after the last epoch, and whether they should put
+    // that copy back once Continue has returned false
+    bool IsBest() const { return best_epoch_ >= 0 && best_epoch_ == last_epoch_ && KeepsBest(); }
+    bool RestoreBest() const { return best_epoch_ >= 0 && best_epoch_ != last_epoch_ && KeepsBest(); }
+    bool KeepsBest() const { return !validation_pos_.empty() && (rule_.patience > 0 || rule_.seconds > 0); }
+    int best_epoch() const { return best_epoch_; }
+    // "epochs", "converged", "patience" or "time", empty while training goes on
+    const std::string& stop_reason() const { return stop_reason_; }
+    virtual void OnEpoch(Model* model, const EpochStats& stats) {}
+};
+
+// Writes one JSON object per epoch and line
+class TrainingLog : public TrainingMonitor {
+    std::ostream& out_;
+    std::string name_;
+  public:
+    TrainingLog(std::ostream& out, const std::string& name) : out_(out), name_(name) {}
+    void OnEpoch(Model* model, const EpochStats& stats);
 };
 
 Model* GetFiniteEmbedding(const Graph& postive, const Graph& negative, int dimension, double neg_penalty, double regularizer);
 Model* GetFiniteSGD(const Graph& postive, const Graph& negative, int dimension, double neg_penalty, double regularizer);
+Model* GetFiniteEmbedding(const CSRGraph& postive, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer);
+Model* GetFiniteSGD(const CSRGraph& postive, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer);
 Model* GetSequentialFiniteEmbedding(const Graph& positive, const Graph& negative, int dimension, double neg_penalty, double regularizer);
 Model* GetFiniteContrastEmbedding(const Graph& positive, const Graph& negative, int sample_ratio, int dimension, double regularizer);
 Model* GetKernelEmbedding(const Graph& postive, const Graph& negative, double neg_penalty, double regularizer);
 Model* GetSparseEmbedding(const Graph& postive, const Graph& negative, double neg_penalty, double regularizer);
 Model* GetDirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer);
 Model* GetDirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer);
+// The trainers below also take a TrainingMonitor, which may be nullptr
+Model* GetFiniteEmbedding(const Graph& postive, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor);
+Model* GetFiniteEmbedding(const CSRGraph& postive, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor);
+Model* GetFiniteSGD(const Graph& postive, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                    TrainingMonitor* monitor);
+Model* GetFiniteSGD(const CSRGraph& postive, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer,
+                    TrainingMonitor* monitor);
+Model* GetFiniteContrastEmbedding(const Graph& positive, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+                                  TrainingMonitor* monitor);
+Model* GetKernelEmbedding(const Graph& postive, const Graph& negative, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor);
+Model* GetSparseEmbedding(const Graph& postive, const Graph& negative, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor);
+Model* GetDirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer,
+                                  TrainingMonitor* monitor);
+Model* GetDirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension,
+                                          double regularizer, TrainingMonitor* monitor);
+// Warm starts from the state of a model trained on the same graphs with other penalties; warm_start may be
+// nullptr. Coefficients outside the new penalty bounds are clipped.
+Model* GetFiniteEmbedding(const Graph& postive, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor, const ModelState* warm_start);
+Model* GetFiniteContrastEmbedding(const Graph& positive, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+                                  TrainingMonitor* monitor, const ModelState* warm_start);
 Model* GetCommonNeighbor(const Graph& base, double normalizer);
 Model* GetAdamicAdar(const Graph& base);
+// Non-owning variants: base must have sorted neighbor lists and outlive the model
+Model* GetCommonNeighbor(const CSRGraph& base, double normalizer);
+Model* GetAdamicAdar(const CSRGraph& base);
+// Text embedding file with rows keyed by the names in node_file; nullptr if it cannot be read
 Model* GetPredefined(const std::string& node_file, const std::string& embedding_file);
 Model* GetRandom();
 Model* GetLabelPropagation(const Graph& base, const SingleLabel& label);
+// Propagates every label of label at once; GetEmbedding(x)[l] is the score of label l at node x.
+// Runs a small fixed number of sweeps, stopping earlier when no score moves by more than tolerance.
+Model* GetLabelPropagation(const CSRGraph& base, const Label& label, double tolerance);
 Model* GetSVD(const std::string& node_file, const std::string& u_file, const std::string& sv_file, const std::string& v_file);
+// Rank-k randomized SVD of the adjacency matrix, computed in process
+Model* GetRandomizedSVD(const Graph& graph, int rank);
+Model* GetRandomizedSVD(const CSRGraph& graph, int rank);
+// Binary snapshot of an inner-product model's source / target rows, with an optional node id table.
+// GetSnapshot maps the file read-only and serves the rows in place; it returns nullptr if the file is
+// missing or malformed. ConvertEmbedding turns a Predefined text file or line-package binary output
+// into a snapshot.
+bool SaveSnapshot(Model* model, int size, const std::string& file_name);
+bool SaveSnapshot(Model* model, int size, const std::vector<std::string>& node_name, const std::string& file_name);
+bool ConvertEmbedding(const std::string& node_file, const std::string& embedding_file, bool line_binary,
+                      const std::string& output_file);
+Model* GetSnapshot(const std::string& file_name, int* size);
+Model* GetSnapshot(const std::string& file_name, int* size, std::vector<std::string>* node_name);
 
 void SampleNegativeGraphUniform(const Graph& positive, Graph* negative);
 void SampleNegativeDGraphUniform(const DGraph& positive, DGraph* negative);
@@ -96,16 +366,79 @@ void SampleNegativeGraphPreferential(const Graph& positive, Graph* negative, dou
 void SampleNegativeGraphLocal(const Graph& positive, Graph* negative);
 void RemoveRedundant(const Graph& positive, Graph* negative);
 void RemoveRedundant(const DGraph& positive, DGraph* negative);
+// Moves each edge of graph to validation with probability fraction, so that model selection can score
+// edges that are neither trained on nor reported
+void SplitValidation(Graph* graph, double fraction, Graph* validation);
+void SplitValidation(DGraph* graph, double fraction, DGraph* validation);
 
 double EvaluatePredictedAP(Model* model, const Graph& train, const Graph& pos, const Graph& neg, double regularizer, int sample_ratio);
 double EvaluateAveragePrecision(Model* model, const Graph& pos, const Graph& neg);
 double EvaluateAveragePrecision(Model* model, const DGraph& pos, const DGraph& neg);
+void ScoreEdges(Model* model, const Graph& graph, std::vector<double>* score);
+void ScoreEdges(Model* model, const DGraph& graph, std::vector<double>* score);
+// score[i] = Evaluate(pair[i].x, pair[i].y), in parallel when the model allows it
+void ScorePairs(Model* model, const std::vector<Edge>& pair, std::vector<double>* score);
 double EvaluateF1(Model* model, const Label& train, const Label& test, double regularizer, int sample_ratio, bool normalize);
 double EvaluateF1LabelPropagation(const Graph& base, const Label& train, const Label& test);
+// Top-k new neighbors per query node, best first, skipping the query and its neighbors in exclude
+void RecommendTopK(Model* model, const Graph& exclude, const std::vector<int>& query, int k,
+                   std::vector<std::vector<std::pair<int, double>>>* result);
+// Hits@k: fraction of test edges (x, y) with y in the top k of x. MRR: mean over nodes with test
+// edges of the reciprocal rank of the first test neighbor within the top k (0 if none).
+void EvaluateRanking(Model* model, const Graph& train, const Graph& test, int k, double* hits, double* mrr);
 void EvaluateAll(Model* model, const Graph& train_pos, const Graph& train_neg, const Graph& test_pos, const Graph& test_neg);
 void EvaluateAll(Model* model, const DGraph& train_pos, const DGraph& train_neg, const DGraph& test_pos, const DGraph& test_neg);
 
+// Relabels nodes for memory locality; perm[old_id] = new_id. Apply the same perm to every graph and
+// label set of a dataset. GetPermutedModel(model, perm) then queries a model trained on the relabeled
+// data by original id, e.g. to save it; with the inverse permutation it goes the other way, for an
+// embedding read in file order. The wrapper does not own model, which must outlive it.
+enum NodeOrder { ORDER_DEGREE, ORDER_RCM };
+void ComputeNodeOrder(const Graph& graph, NodeOrder type, std::vector<int>* perm);
+void ComputeNodeOrder(const DGraph& graph, NodeOrder type, std::vector<int>* perm);
+void PermuteGraph(const std::vector<int>& perm, Graph* graph);
+void PermuteGraph(const std::vector<int>& perm, DGraph* graph);
+void PermuteLabel(const std::vector<int>& perm, Label* label);
+void InvertPermutation(const std::vector<int>& perm, std::vector<int>* inverse);
+Model* GetPermutedModel(Model* model, const std::vector<int>& perm);
+
+void ToCSRGraph(const Graph& graph, CSRGraph* csr);
+void ToCSRGraph(const DGraph& graph, CSRDGraph* csr);
+void CompressGraph(const CSRGraph& graph, CompressedCSRGraph* compressed);
+
+// Synthetic graphs for scalability tests. The output depends only on the config, not on the thread
+// count; node ids are randomly permuted and duplicate edges and self loops are dropped.
+enum SyntheticModel {
+    SYNTHETIC_RMAT,     // recursive matrix (Kronecker) graph; communities follow its top recursion levels
+    SYNTHETIC_SBM,      // stochastic block model with equal-sized communities
+    SYNTHETIC_BA        // Barabasi-Albert preferential attachment, edges / size links per new node
+};
+struct SyntheticGraphConfig {
+    SyntheticModel model;
+    int size;
+    long long edges;            // edges generated, before duplicates are dropped
+    int communities;            // planted labels, one per node
+    // SBM: fraction of edges inside a community. BA: chance that a new node takes the label of the
+    // first node it links to.
+    double intra_fraction;
+    double a, b, c;             // R-MAT quadrant probabilities; the fourth is 1 - a - b - c
+    unsigned long long seed;
+    SyntheticGraphConfig() : model(SYNTHETIC_RMAT), size(1 << 14), edges(1 << 17), communities(8),
+        intra_fraction(0.8), a(0.57), b(0.19), c(0.19), seed(1) {}
+};
+// label may be nullptr
+void GenerateGraph(const SyntheticGraphConfig& config, CSRGraph* graph, Label* label);
+void GenerateGraph(const SyntheticGraphConfig& config, CSRDGraph* graph, Label* label);
+void GenerateGraph(const SyntheticGraphConfig& config, Graph* graph, Label* label);
+void GenerateGraph(const SyntheticGraphConfig& config, DGraph* graph, Label* label);
+
 void ReadDataset(const std::string& nodefile, const std::string& edgefile, Graph* graph);
+void ReadDataset(const std::string& nodefile, const std::string& edgefile, CSRGraph* graph);
 void ReadDirectedDataset(const std::string& nodefile, const std::string& edgefile, DGraph* graph);
 void ReadLabel(const std::string& nodefile, const std::string& labelfile, Label* label);
+void ReadNodeNames(const std::string& nodefile, std::vector<std::string>* node_name);
+// Rows of a word2vec-style text file, or of line-package output written with -binary 1, laid out
+// row-major in node file order; nodes without a row stay zero
+bool ReadEmbedding(const std::string& nodefile, const std::string& embedding_file, bool line_binary,
+                   std::vector<std::string>* node_name, int* dim, std::vector<real>* matrix);
 
@@ -0,0 +1,287 @@
+#include "benchmark.h"
+#include "base.h"
+#include "utility.h"
+#include "svm.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+
+namespace {
+    std::mt19937 gen(2024);
+
+    typedef std::chrono::steady_clock Clock;
+
+    void RandomGraph(int size, int degree, Graph* graph) {
+        *graph = Graph(size);
+        std::uniform_int_distribution<int> node(0, size - 1);
+        for (long long i = 0; i < (long long)size * degree / 2; ++i) {
+            int x = node(gen), y = node(gen);
+            if (x != y)
+                graph->AddEdge(x, y);
+        }
+    }
+
+    void RandomDGraph(int size, int degree, DGraph* graph) {
+        *graph = DGraph(size);
+        std::uniform_int_distribution<int> node(0, size - 1);
+        for (long long i = 0; i < (long long)size * degree; ++i) {
+            int x = node(gen), y = node(gen);
+            if (x != y)
+                graph->AddEdge(x, y);
+        }
+    }
+
+    void RandomVector(int size, std::vector<real>* vec) {
+        std::normal_distribution<double> normal(0, 1);
+        vec->resize(size);
+        for (real& v : *vec)
+            v = normal(gen);
+    }
+
+    // Dense random embedding, standing in for a trained model in the evaluation benchmarks
+    class RandomEmbedding : public Model {
+        int dim_;
+        std::vector<real> embedding_;
+      public:
+        RandomEmbedding(int size, int dim) : dim_(dim) { RandomVector(size * dim, &embedding_); }
+        const real* Row(int x) { return embedding_.data() + (size_t)x * dim_; }
+        double Evaluate(int x, int y) { return InnerProduct(Row(x), Row(y), dim_); }
+        EmbeddingView GetEmbedding(int x) { return EmbeddingView(Row(x), dim_); }
+        EmbeddingView GetSourceEmbedding(int x) { return GetEmbedding(x); }
+        EmbeddingView GetTargetEmbedding(int x) { return GetEmbedding(x); }
+    };
+
+    long long EdgeCount(const Graph& graph) {
+        long long count = 0;
+        for (int x = 0; x < graph.size; ++x)
+            count += graph.edge[x].size();
+        return count;
+    }
+
+    void KernelBenchmarks(BenchmarkRunner* runner) {
+        for (int dim : {16, 64, 100, 128, 256}) {
+            std::vector<real> a, b;
+            RandomVector(dim, &a);
+            RandomVector(dim, &b);
+            volatile double sink = 0;
+            runner->Run("InnerProduct/dim:" + std::to_string(dim), 1000, [&] {
+                double sum = 0;
+                for (int i = 0; i < 1000; ++i)
+                    sum += InnerProduct(a.data(), b.data(), dim);
+                sink = sink + sum;
+            });
+            const VectorKernel& kernel = GetVectorKernel(dim);
+            runner->Run("VectorKernel/dim:" + std::to_string(dim), 1000, [&] {
+                double sum = 0;
+                for (int i = 0; i < 1000; ++i)
+                    sum += kernel.inner_product(a.data(), b.data(), dim);
+                sink = sink + sum;
+            });
+        }
+    }
+
+    // One LinearSVM solve is the per-node subproblem of every UpdateEmbedding: degree neighbor
+    // features (positive and negative) of the given dimension
+    void SolverBenchmarks(BenchmarkRunner* runner) {
+        for (int degree : {10, 100, 1000})
+            for (int dim : {16, 64, 128}) {
+                std::vector<std::vector<real>> feature(degree);
+                std::vector<const real*> feature_ptr(degree);
+                std::vector<double> sqr_norm(degree), penalty(degree, 1), margin(degree, 1), coeff;
+                std::vector<int> label(degree);
+                for (int i = 0; i < degree; ++i) {
+                    RandomVector(dim, &feature[i]);
+                    feature_ptr[i] = feature[i].data();
+                    sqr_norm[i] = InnerProduct(feature_ptr[i], feature_ptr[i], dim);
+                    label[i] = i % 2 == 0 ? 1 : -1;
+                }
+                std::vector<real> w(dim);
+                runner->Run("LinearSVM/degree:" + std::to_string(degree) + "/dim:" + std::to_string(dim), degree,
+                            [&] {
+                                coeff.assign(degree, 0);
+                                std::fill(w.begin(), w.end(), 0);
+                            },
+                            [&] { LinearSVM(feature_ptr, sqr_norm, label, penalty, margin, &coeff, w.data(), dim, false); });
+            }
+        for (int size : {10, 100, 400}) {
+            std::vector<std::vector<real>> feature(size);
+            std::vector<std::vector<double>> kernel(size, std::vector<double>(size));
+            for (int i = 0; i < size; ++i)
+                RandomVector(16, &feature[i]);
+            for (int i = 0; i < size; ++i)
+                for (int j = 0; j < size; ++j)
+                    kernel[i][j] = InnerProduct(feature[i].data(), feature[j].data(), 16);
+            std::vector<int> label(size);
+            for (int i = 0; i < size; ++i)
+                label[i] = i % 2 == 0 ? 1 : -1;
+            std::vector<double> penalty(size, 1), margin(size, 1), coeff;
+            runner->Run("KernelSVM/size:" + std::to_string(size), size, [&] { coeff.assign(size, 0); },
+                        [&] { KernelSVM(kernel, label, penalty, margin, &coeff, false); });
+        }
+    }
+
+    // Whole training runs on a small graph; items are nodes, so items_per_second is node updates
+    // per second divided by the model's epoch count
+    void ModelBenchmarks(BenchmarkRunner* runner) {
+        Graph graph, negative;
+        RandomGraph(500, 10, &graph);
+        negative = Graph(500);
+        SampleNegativeGraphUniform(graph, &negative);
+        RemoveRedundant(graph, &negative);
+        DGraph d_graph, d_negative;
+        RandomDGraph(500, 10, &d_graph);
+        d_negative = DGraph(500);
+        SampleNegativeDGraphUniform(d_graph, &d_negative);
+        RemoveRedundant(d_graph, &d_negative);
+        std::unique_ptr<Model> model;
+        runner->Run("Train/FiniteEmbedding", graph.size, [&] { model.reset(GetFiniteEmbedding(graph, negative, 16, 0.2, 1)); });
+        runner->Run("Train/FiniteSGD", graph.size, [&] { model.reset(GetFiniteSGD(graph, negative, 16, 0.2, 1)); });
+        runner->Run("Train/SequentialFiniteEmbedding", graph.size,
+                    [&] { model.reset(GetSequentialFiniteEmbedding(graph, negative, 16, 0.2, 1)); });
+        runner->Run("Train/FiniteContrastEmbedding", graph.size,
+                    [&] { model.reset(GetFiniteContrastEmbedding(graph, negative, 1, 16, 1)); });
+        runner->Run("Train/DirectedFiniteEmbedding", d_graph.size,
+                    [&] { model.reset(GetDirectedFiniteEmbedding(d_graph, d_negative, 16, 0.2, 1)); });
+        runner->Run("Train/DirectedFiniteContrastEmbedding", d_graph.size,
+                    [&] { model.reset(GetDirectedFiniteContrastEmbedding(d_graph, d_negative, 1, 16, 1)); });
+    }
+
+    void EvaluationBenchmarks(BenchmarkRunner* runner) {
+        for (int size : {10000, 1000000}) {
+            std::vector<double> p(size), n(size * 10);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            for (double& v : p)
+                v = uniform(gen) + 0.2;
+            for (double& v : n)
+                v = uniform(gen);
+            runner->Run("EvaluateAveragePrecision/pairs:" + std::to_string(size * 11), size * 11,
+                        [&] { EvaluateAveragePrecision(p, n); });
+        }
+
+        Graph graph, negative;
+        RandomGraph(20000, 20, &graph);
+        negative = Graph(graph.size);
+        SampleNegativeGraphUniform(graph, &negative);
+        RandomEmbedding model(graph.size, 64);
+        runner->Run("EvaluateAveragePrecision/model", EdgeCount(graph) + EdgeCount(negative),
+                    [&] { EvaluateAveragePrecision(&model, graph, negative); });
+
+        Label train(graph.size), test(graph.size);
+        std::uniform_int_distribution<int> label(0, 4);
+        for (int x = 0; x < 2000; ++x)
+            (x % 2 == 0 ? train : test).SetLabel(x, label(gen));
+        runner->Run("EvaluateF1/labels:5", 2000, [&] { EvaluateF1(&model, train, test, 1, 2, true); });
+    }
+
+    void SamplingBenchmarks(BenchmarkRunner* runner) {
+        Graph graph, negative;
+        RandomGraph(100000, 20, &graph);
+        long long edges = EdgeCount(graph);
+        runner->Run("SampleNegativeGraphUniform", edges, [&] { negative = Graph(graph.size); },
+                    [&] { SampleNegativeGraphUniform(graph, &negative); });
+        runner->Run("SampleNegativeGraphPreferential", edges, [&] { negative = Graph(graph.size); },
+                    [&] { SampleNegativeGraphPreferential(graph, &negative, 0.75); });
+        runner->Run("SampleNegativeGraphLocal", edges, [&] { negative = Graph(graph.size); },
+                    [&] { SampleNegativeGraphLocal(graph, &negative); });
+        Graph sampled(graph.size);
+        SampleNegativeGraphUniform(graph, &sampled);
+        runner->Run("RemoveRedundant", edges, [&] { negative = sampled; }, [&] { RemoveRedundant(graph, &negative); });
+
+        DGraph d_graph, d_negative;
+        RandomDGraph(100000, 10, &d_graph);
+        runner->Run("SampleNegativeDGraphUniform", (long long)d_graph.size * 10, [&] { d_negative = DGraph(d_graph.size); },
+                    [&] { SampleNegativeDGraphUniform(d_graph, &d_negative); });
+    }
+
+    void ReadBenchmarks(BenchmarkRunner* runner) {
+        const std::string node_file = "benchmark-node.txt", edge_file = "benchmark-edge.txt";
+        const int size = 100000;
+        std::ofstream node_out(node_file), edge_out(edge_file);
+        for (int x = 0; x < size; ++x)
+            node_out << "node" << x << "\n";
+        std::uniform_int_distribution<int> node(0, size - 1);
+        long long edges = (long long)size * 10;
+        for (long long i = 0; i < edges; ++i)
+            edge_out << "node" << node(gen) << "\tnode" << node(gen) << "\t1\n";
+        node_out.close();
+        edge_out.close();
+        Graph graph;
+        CSRGraph csr;
+        runner->Run("ReadDataset/Graph", edges, [&] { ReadDataset(node_file, edge_file, &graph); });
+        runner->Run("ReadDataset/CSRGraph", edges, [&] { ReadDataset(node_file, edge_file, &csr); });
+        remove(node_file.c_str());
+        remove(edge_file.c_str());
+    }
+
+    void GeneratorBenchmarks(BenchmarkRunner* runner) {
+        const char* name[] = {"RMAT", "SBM", "BA"};
+        for (SyntheticModel model : {SYNTHETIC_RMAT, SYNTHETIC_SBM, SYNTHETIC_BA}) {
+            SyntheticGraphConfig config;
+            config.model = model;
+            config.size = 1 << 20;
+            config.edges = 10LL << 20;
+            CSRGraph graph;
+            Label label;
+            runner->Run(std::string("GenerateGraph/") + name[model], config.edges,
+                        [&] { GenerateGraph(config, &graph, &label); });
+        }
+    }
+}   // anonymous namespace
+
+BenchmarkRunner::BenchmarkRunner(double min_seconds, const std::string& filter)
+    : min_seconds_(min_seconds), filter_(filter) {}
+
+void BenchmarkRunner::Run(const std::string& name, long long items, const std::function<void()>& body) {
+    Run(name, items, [] {}, body);
+}
+
+void BenchmarkRunner::Run(const std::string& name, long long items, const std::function<void()>& setup,
+                          const std::function<void()>& body) {
+    if (name.find(filter_) == std::string::npos) return;
+    // One untimed warm-up iteration fills caches and lazily built tables
+    setup();
+    body();
+    double elapsed = 0;
+    long long iterations = 0;
+    while (elapsed < min_seconds_ || iterations == 0) {
+        setup();
+        auto begin = Clock::now();
+        body();
+        elapsed += std::chrono::duration<double>(Clock::now() - begin).count();
+        ++iterations;
+    }
+    BenchmarkResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.ns_per_iteration = elapsed * 1e9 / iterations;
+    result.items_per_second = items > 0 ? items * iterations / elapsed : 0;
+    results_.push_back(result);
+    std::cerr << name << ": " << result.ns_per_iteration << " ns/iter\n";
+}
+
+void BenchmarkRunner::WriteJson(std::ostream& out) const {
+    out << "{\n  \"threads\": " << GetThreadCount() << ",\n  \"real_size\": " << sizeof(real)
+        << ",\n  \"benchmarks\": [\n";
+    for (int i = 0; i < (int)results_.size(); ++i) {
+        const BenchmarkResult& r = results_[i];
+        out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+            << ", \"ns_per_iteration\": " << r.ns_per_iteration << ", \"items_per_second\": " << r.items_per_second
+            << "}" << (i + 1 < (int)results_.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+void RunBenchmarks(BenchmarkRunner* runner) {
+    KernelBenchmarks(runner);
+    SolverBenchmarks(runner);
+    ModelBenchmarks(runner);
+    EvaluationBenchmarks(runner);
+    SamplingBenchmarks(runner);
+    ReadBenchmarks(runner);
+    GeneratorBenchmarks(runner);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <ostream>
+
+struct BenchmarkResult {
+    std::string name;
+    long long iterations;
+    double ns_per_iteration;
+    // items counts the work of one iteration (pairs scored, edges read, ...); 0 when meaningless
+    double items_per_second;
+};
+
+// Repeats each benchmark until min_seconds of timed work has accumulated
+class BenchmarkRunner {
+  public:
+    BenchmarkRunner(double min_seconds, const std::string& filter);
+    // setup runs before every iteration and is not timed
+    void Run(const std::string& name, long long items, const std::function<void()>& body);
+    void Run(const std::string& name, long long items, const std::function<void()>& setup,
+             const std::function<void()>& body);
+    void WriteJson(std::ostream& out) const;
+    const std::vector<BenchmarkResult>& results() const { return results_; }
+
+  private:
+    double min_seconds_;
+    std::string filter_;
+    std::vector<BenchmarkResult> results_;
+};
+
+// Registers every solver, model, evaluation, sampling, I/O and generator benchmark with the runner
+void RunBenchmarks(BenchmarkRunner* runner);
+
+// One point of a scaling sweep. Stage times are wall-clock seconds. peak_rss_bytes is the memory
+// high-water mark of the process that ran the point, which is a fresh child where fork is available.
+struct ScalingResult {
+    std::string mode, model;    // mode is "strong" (fixed size) or "weak" (size grows with threads)
+    int size, dim, threads;
+    long long edges;            // training edges (arcs for the directed models)
+    double load_seconds, sample_seconds, remove_seconds, train_seconds, evaluate_seconds;
+    double average_precision;
+    long long peak_rss_bytes;
+    double train_edges_per_second;
+    // Train time at the first thread count of the same series over this one: the speedup for strong
+    // scaling, the efficiency for weak scaling
+    double train_scaling;
+    bool ok;                    // false if the point crashed or ran out of memory
+};
+
+struct ScalingConfig {
+    std::vector<std::string> models;
+    std::vector<int> sizes;     // strong scaling runs every size at every thread count
+    std::vector<int> dims;      // models without a dimension run once, at dims[0]
+    std::vector<int> threads;
+    int degree;                 // average degree (in + out for directed models) of the generated block model graphs
+    int weak_size;              // nodes per thread for weak scaling; 0 to skip it
+};
+
+// Names accepted in ScalingConfig::models
+std::vector<std::string> ScalingModels();
+void RunScaling(const ScalingConfig& config, std::vector<ScalingResult>* results);
+void WriteScalingCsv(const std::vector<ScalingResult>& results, std::ostream& out);
+void WriteScalingJson(const std::vector<ScalingResult>& results, std::ostream& out);
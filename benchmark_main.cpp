@@ -0,0 +1,25 @@
+#include "benchmark.h"
+
+#include <fstream>
+#include <iostream>
+
+// Usage: benchmark output.json [name filter] [min seconds per benchmark]
+// Progress goes to stderr and the JSON report to the output file; the dataset readers and evaluators
+// log to stdout, so the report never shares a stream with them
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: benchmark output.json [name filter] [min seconds per benchmark]\n";
+        return 1;
+    }
+    std::string filter = argc > 2 ? argv[2] : "";
+    double min_seconds = argc > 3 ? std::stod(argv[3]) : 0.5;
+    std::ofstream fout(argv[1]);
+    if (!fout) {
+        std::cerr << "Cannot open " << argv[1] << "\n";
+        return 1;
+    }
+    BenchmarkRunner runner(min_seconds, filter);
+    RunBenchmarks(&runner);
+    runner.WriteJson(fout);
+    return fout ? 0 : 1;
+}
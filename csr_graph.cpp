@@ -0,0 +1,87 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <algorithm>
+
+#define NODE_BLOCK 1024
+
+namespace {
+    void FillFromAdjacency(const std::vector<std::vector<int>>& edge, CSRGraph* csr) {
+        int size = edge.size();
+        csr->size = size;
+        csr->offset.assign(size + 1, 0);
+        for (int x = 0; x < size; ++x)
+            csr->offset[x + 1] = csr->offset[x] + edge[x].size();
+        csr->neighbor.resize(csr->offset[size]);
+        ParallelFor((size + NODE_BLOCK - 1) / NODE_BLOCK, [&](int block) {
+            int end = std::min(size, (block + 1) * NODE_BLOCK);
+            for (int x = block * NODE_BLOCK; x < end; ++x) {
+                int* first = csr->neighbor.data() + csr->offset[x];
+                std::copy(edge[x].begin(), edge[x].end(), first);
+                std::sort(first, first + edge[x].size());
+            }
+        });
+    }
+
+    void PutVarint(unsigned value, std::vector<unsigned char>* data) {
+        while (value >= 0x80) {
+            data->push_back((unsigned char)(value | 0x80));
+            value >>= 7;
+        }
+        data->push_back((unsigned char)value);
+    }
+}   // anonymous namespace
+
+void CSRGraphBuilder::Build(CSRGraph* graph, bool unique) {
+    ParallelSort(&arc_, std::less<unsigned long long>());
+    if (unique)
+        arc_.erase(std::unique(arc_.begin(), arc_.end()), arc_.end());
+
+    graph->size = size_;
+    graph->offset.assign(size_ + 1, 0);
+    for (unsigned long long arc : arc_)
+        graph->offset[(arc >> 32) + 1]++;
+    for (int x = 0; x < size_; ++x)
+        graph->offset[x + 1] += graph->offset[x];
+
+    long long total = arc_.size();
+    graph->neighbor.resize(total);
+    int blocks = (int)((total + (1 << 20) - 1) >> 20);
+    ParallelFor(blocks, [&](int block) {
+        long long end = std::min(total, (long long)(block + 1) << 20);
+        for (long long i = (long long)block << 20; i < end; ++i)
+            graph->neighbor[i] = (int)(arc_[i] & 0xffffffffu);
+    });
+    std::vector<unsigned long long>().swap(arc_);
+}
+
+void ToCSRGraph(const Graph& graph, CSRGraph* csr) {
+    FillFromAdjacency(graph.edge, csr);
+}
+
+void ToCSRGraph(const DGraph& graph, CSRDGraph* csr) {
+    csr->size = graph.size;
+    FillFromAdjacency(graph.out_edge, &csr->out_edge);
+    FillFromAdjacency(graph.in_edge, &csr->in_edge);
+}
+
+void CompressGraph(const CSRGraph& graph, CompressedCSRGraph* compressed) {
+    compressed->size = graph.size;
+    compressed->offset.assign(graph.size + 1, 0);
+    compressed->data.clear();
+    for (int x = 0; x < graph.size; ++x) {
+        int prev = 0;
+        for (int y : graph.Neighbors(x)) {
+            PutVarint((unsigned)(y - prev), &compressed->data);
+            prev = y;
+        }
+        compressed->offset[x + 1] = compressed->data.size();
+    }
+    compressed->data.shrink_to_fit();
+}
+
+void CompressedCSRGraph::Decode(int x, std::vector<int>* neighbor) const {
+    neighbor->clear();
+    ForEachNeighbor(x, [neighbor](int y) { neighbor->push_back(y); });
+}
@@ -7,96 +7,127 @@
 #include <cmath>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 10
+// Greedy scheduling stops once no node's projected gradient exceeds this
+#define GREEDY_TOLERANCE 1e-3
 
 class DirectedFiniteEmbedding : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double neg_penalty_, regularizer_;
     
-    std::vector<std::vector<double>> in_embedding, out_embedding, combined_embedding;
+    // Each row holds the in embedding followed by the out embedding
+    std::vector<std::vector<real>> embedding;
     std::vector<double> in_sqr_norm, out_sqr_norm;
     std::vector<std::vector<double>> in_coeff, out_coeff;
 
-    void UpdateInEmbedding(const DGraph& positive, const DGraph& negative, int x);
-    void UpdateOutEmbedding(const DGraph& positive, const DGraph& negative, int x);
+    real* In(int x) { return embedding[x].data(); }
+    real* Out(int x) { return embedding[x].data() + dim_; }
+    void MakeInProblem(const DGraph& positive, const DGraph& negative, int x, LinearSVMProblem* problem);
+    void MakeOutProblem(const DGraph& positive, const DGraph& negative, int x, LinearSVMProblem* problem);
+    double UpdateInEmbedding(const DGraph& positive, const DGraph& negative, int x);
+    double UpdateOutEmbedding(const DGraph& positive, const DGraph& negative, int x);
+    void UpdateGreedy(const DGraph& positive, const DGraph& negative, int node, NodeWorklist* worklist);
+    void Objective(const DGraph& positive, const DGraph& negative, int x, NodeObjective* objective);
 public:
-    DirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer);
+    DirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer,
+                            TrainingMonitor* monitor);
     double Evaluate(int x, int y);
-    const std::vector<double>& GetEmbedding(int x) { return combined_embedding[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return EmbeddingView(Out(x), dim_); }
+    EmbeddingView GetTargetEmbedding(int x) { return EmbeddingView(In(x), dim_); }
 };
 
-void DirectedFiniteEmbedding::UpdateInEmbedding(const DGraph& positive, const DGraph& negative, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> penalty_coeff, margin, f_sqr_norm;
-    for (int i : positive.in_edge[x]) {
-        feature.push_back(out_embedding[i].data());
-        label.push_back(1);
-        penalty_coeff.push_back(1 / regularizer_);
-        margin.push_back(1);
-        f_sqr_norm.push_back(out_sqr_norm[i]);
-    }
-    for (int i : negative.in_edge[x]) {
-        feature.push_back(out_embedding[i].data());
-        label.push_back(-1);
-        penalty_coeff.push_back(neg_penalty_ / regularizer_);
-        margin.push_back(0);
-        f_sqr_norm.push_back(out_sqr_norm[i]);
-    }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &in_coeff[x], &in_embedding[x], dim_, false);
-    in_sqr_norm[x] = InnerProduct(in_embedding[x].data(), in_embedding[x].data(), dim_);
+void DirectedFiniteEmbedding::MakeInProblem(const DGraph& positive, const DGraph& negative, int x, LinearSVMProblem* problem) {
+    for (int i : positive.in_edge[x])
+        problem->Add(Out(i), out_sqr_norm[i], 1, 1 / regularizer_, 1);
+    for (int i : negative.in_edge[x])
+        problem->Add(Out(i), out_sqr_norm[i], -1, neg_penalty_ / regularizer_, 0);
 }
 
-void DirectedFiniteEmbedding::UpdateOutEmbedding(const DGraph& positive, const DGraph& negative, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> penalty_coeff, margin, f_sqr_norm;
-    for (int i : positive.out_edge[x]) {
-        feature.push_back(in_embedding[i].data());
-        label.push_back(1);
-        penalty_coeff.push_back(1 / regularizer_);
-        margin.push_back(1);
-        f_sqr_norm.push_back(in_sqr_norm[i]);
-    }
-    for (int i : negative.out_edge[x]) {
-        feature.push_back(in_embedding[i].data());
-        label.push_back(-1);
-        penalty_coeff.push_back(neg_penalty_ / regularizer_);
-        margin.push_back(0);
-        f_sqr_norm.push_back(in_sqr_norm[i]);
-    }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &out_coeff[x], &out_embedding[x], dim_, false);
-    out_sqr_norm[x] = InnerProduct(out_embedding[x].data(), out_embedding[x].data(), dim_);
+void DirectedFiniteEmbedding::MakeOutProblem(const DGraph& positive, const DGraph& negative, int x, LinearSVMProblem* problem) {
+    for (int i : positive.out_edge[x])
+        problem->Add(In(i), in_sqr_norm[i], 1, 1 / regularizer_, 1);
+    for (int i : negative.out_edge[x])
+        problem->Add(In(i), in_sqr_norm[i], -1, neg_penalty_ / regularizer_, 0);
+}
+
+double DirectedFiniteEmbedding::UpdateInEmbedding(const DGraph& positive, const DGraph& negative, int x) {
+    LinearSVMProblem problem;
+    MakeInProblem(positive, negative, x, &problem);
+    double violation = LinearSVM(problem, &in_coeff[x], In(x), *kernel_, dim_, false);
+    in_sqr_norm[x] = kernel_->inner_product(In(x), In(x), dim_);
+    return violation;
+}
+
+double DirectedFiniteEmbedding::UpdateOutEmbedding(const DGraph& positive, const DGraph& negative, int x) {
+    LinearSVMProblem problem;
+    MakeOutProblem(positive, negative, x, &problem);
+    double violation = LinearSVM(problem, &out_coeff[x], Out(x), *kernel_, dim_, false);
+    out_sqr_norm[x] = kernel_->inner_product(Out(x), Out(x), dim_);
+    return violation;
+}
+
+// Worklist node x is the in embedding of x and size_ + x its out embedding. A change of In(x) moves the
+// out subproblems of its in-neighbors y by at most |change| * |Out(y)|, and symmetrically for Out(x).
+void DirectedFiniteEmbedding::UpdateGreedy(const DGraph& positive, const DGraph& negative, int node, NodeWorklist* worklist) {
+    bool in = node < size_;
+    int x = in ? node : node - size_;
+    real* vec = in ? In(x) : Out(x);
+    std::vector<real> old(vec, vec + dim_);
+    worklist->Set(node, in ? UpdateInEmbedding(positive, negative, x) : UpdateOutEmbedding(positive, negative, x));
+    double change = sqrt(SquaredDistance(old.data(), vec, dim_));
+    if (change == 0) return;
+    for (const DGraph* graph : {&positive, &negative})
+        if (in) {
+            for (int y : graph->in_edge[x])
+                worklist->Add(size_ + y, change * sqrt(out_sqr_norm[y]));
+        } else {
+            for (int y : graph->out_edge[x])
+                worklist->Add(y, change * sqrt(in_sqr_norm[y]));
+        }
+}
+
+// Sum of the in and out subproblems of x
+void DirectedFiniteEmbedding::Objective(const DGraph& positive, const DGraph& negative, int x, NodeObjective* objective) {
+    LinearSVMProblem in, out;
+    MakeInProblem(positive, negative, x, &in);
+    MakeOutProblem(positive, negative, x, &out);
+    double in_primal, in_dual, out_primal, out_dual;
+    int in_active, out_active;
+    LinearSVMObjective(in, in_coeff[x], In(x), *kernel_, dim_, &in_primal, &in_dual, &in_active);
+    LinearSVMObjective(out, out_coeff[x], Out(x), *kernel_, dim_, &out_primal, &out_dual, &out_active);
+    objective->primal = in_primal + out_primal;
+    objective->dual = in_dual + out_dual;
+    objective->active = in_active + out_active;
 }
 
 DirectedFiniteEmbedding::DirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, 
-    int dimension, double neg_penalty, double regularizer) :
+    int dimension, double neg_penalty, double regularizer, TrainingMonitor* monitor) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     neg_penalty_(neg_penalty),
     regularizer_(regularizer) {
 
     std::uniform_real_distribution<double> dist(-1, 1);
-    in_embedding.resize(size_);
-    out_embedding.resize(size_);
-    for (int i = 0; i < size_; ++i) {
-        in_embedding[i].resize(dim_);
-        out_embedding[i].resize(dim_);
-    }
+    embedding.resize(size_);
+    for (int i = 0; i < size_; ++i)
+        embedding[i].resize(2 * dim_);
     for (int i = 0; i < size_; ++i)
         for (int j = 0; j < dim_; ++j) {
-            in_embedding[i][j] = dist(gen);
-            out_embedding[i][j] = dist(gen);
+            In(i)[j] = dist(gen);
+            Out(i)[j] = dist(gen);
         }
 
     in_sqr_norm.resize(size_);
     out_sqr_norm.resize(size_);
     for (int i = 0; i < size_; ++i) {
-        in_sqr_norm[i] = InnerProduct(in_embedding[i].data(), in_embedding[i].data(), dim_);
-        out_sqr_norm[i] = InnerProduct(out_embedding[i].data(), out_embedding[i].data(), dim_);
+        in_sqr_norm[i] = kernel_->inner_product(In(i), In(i), dim_);
+        out_sqr_norm[i] = kernel_->inner_product(Out(i), Out(i), dim_);
     }
 
     in_coeff.resize(size_);
@@ -109,27 +140,70 @@ DirectedFiniteEmbedding::DirectedFiniteEmbedding(const DGraph& graph, const DGra
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
-        RandomPermutation(&order);
-        for (int j : order) {
-            UpdateInEmbedding(graph, negative, j);
-            UpdateOutEmbedding(graph, negative, j);
+    std::vector<std::vector<real>> best;
+    std::vector<std::vector<double>> best_in_coeff, best_out_coeff;
+    std::vector<double> best_in_sqr_norm, best_out_sqr_norm;
+    bool greedy = GetNodeSchedule() == SCHEDULE_GREEDY;
+    NodeWorklist worklist(greedy ? 2 * size_ : 0);
+    if (greedy) {
+        std::vector<int> nodes(2 * size_);
+        for (int j = 0; j < 2 * size_; ++j)
+            nodes[j] = j;
+        RandomPermutation(&nodes);
+        for (int j : nodes)
+            worklist.Set(j, INFINITY);
+    }
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
+        int updates = 0;
+        if (greedy) {
+            // An epoch is 2 * size_ updates of the most violated in and out embeddings
+            for (int j; updates < 2 * size_ && (j = worklist.Pop(GREEDY_TOLERANCE)) >= 0; ++updates)
+                UpdateGreedy(graph, negative, j, &worklist);
+            if (updates == 0) {
+                if (monitor != nullptr)
+                    monitor->Converged();
+                break;
+            }
+        } else {
+            RandomPermutation(&order);
+            for (int j : order) {
+                UpdateInEmbedding(graph, negative, j);
+                UpdateOutEmbedding(graph, negative, j);
+            }
+            updates = 2 * size_;
+        }
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, updates, [&](int x, NodeObjective* objective) {
+                Objective(graph, negative, x, objective);
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_in_coeff = in_coeff;
+            best_out_coeff = out_coeff;
+            best_in_sqr_norm = in_sqr_norm;
+            best_out_sqr_norm = out_sqr_norm;
         }
     }
-
-    combined_embedding.resize(size_);
-    for (int i = 0; i < size_; ++i) {
-        for (double v : in_embedding[i])
-            combined_embedding[i].push_back(v);
-        for (double v : out_embedding[i])
-            combined_embedding[i].push_back(v);
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        in_coeff.swap(best_in_coeff);
+        out_coeff.swap(best_out_coeff);
+        in_sqr_norm.swap(best_in_sqr_norm);
+        out_sqr_norm.swap(best_out_sqr_norm);
     }
 }
 
 double DirectedFiniteEmbedding::Evaluate(int x, int y) {
-    return InnerProduct(out_embedding[x].data(), in_embedding[y].data(), dim_);
+    return kernel_->inner_product(Out(x), In(y), dim_);
+}
+
+Model* GetDirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer,
+                                  TrainingMonitor* monitor) {
+    return new DirectedFiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer, monitor);
 }
 
 Model* GetDirectedFiniteEmbedding(const DGraph& graph, const DGraph& negative, int dimension, double neg_penalty, double regularizer) {
-    return new DirectedFiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer);
+    return GetDirectedFiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer, nullptr);
 }
\ No newline at end of file
@@ -7,10 +7,14 @@
 #include <cmath>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 10
+// Draws per contrast pair before an edge whose negatives all touch it gets fewer pairs
+#define PAIR_TRIES 100
+// Greedy scheduling stops once no node's projected gradient exceeds this
+#define GREEDY_TOLERANCE 1e-3
 
 struct ContrastEdgePair {
     int b, c, d, label;
@@ -22,65 +26,110 @@ typedef std::vector<std::vector<ContrastEdgePair>> ContrastEdgeAdjacencyList;
 
 class DirectedFiniteContrastEmbedding : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double regularizer_;
-    std::vector<std::vector<double>> in_embedding, out_embedding, combined_embedding;
+    // Each row holds the in embedding followed by the out embedding
+    std::vector<std::vector<real>> embedding;
     std::vector<std::vector<double>> in_coeff, out_coeff;
     std::vector<double> in_sqr_norm, out_sqr_norm;
 
-    void UpdateInEmbedding(const ContrastEdgeAdjacencyList& table, int x);
-    void UpdateOutEmbedding(const ContrastEdgeAdjacencyList& table, int x);
+    real* In(int x) { return embedding[x].data(); }
+    real* Out(int x) { return embedding[x].data() + dim_; }
+    void MakeInProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem);
+    void MakeOutProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem);
+    double UpdateInEmbedding(const ContrastEdgeAdjacencyList& table, int x);
+    double UpdateOutEmbedding(const ContrastEdgeAdjacencyList& table, int x);
+    void UpdateGreedy(const ContrastEdgeAdjacencyList& in_table, const ContrastEdgeAdjacencyList& out_table, int node,
+                      NodeWorklist* worklist);
+    void Objective(const ContrastEdgeAdjacencyList& in_table, const ContrastEdgeAdjacencyList& out_table, int x,
+                   NodeObjective* objective);
 public:
-    DirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer);
+    DirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer,
+                                    TrainingMonitor* monitor);
     double Evaluate(int x, int y);
-    const std::vector<double>& GetEmbedding(int x) { return combined_embedding[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return EmbeddingView(Out(x), dim_); }
+    EmbeddingView GetTargetEmbedding(int x) { return EmbeddingView(In(x), dim_); }
 };
 
-void DirectedFiniteContrastEmbedding::UpdateInEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> margin, penalty_coeff, f_sqr_norm;
-    for (const ContrastEdgePair& pair : table[x]) {
-        feature.push_back(out_embedding[pair.b].data());
-        label.push_back(pair.label);
-        margin.push_back(1 + pair.label * InnerProduct(out_embedding[pair.c].data(), in_embedding[pair.d].data(), dim_));
-        penalty_coeff.push_back(1 / regularizer_);
-        f_sqr_norm.push_back(out_sqr_norm[pair.b]);
-    }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &in_coeff[x], &in_embedding[x], dim_, false);
-    in_sqr_norm[x] = InnerProduct(in_embedding[x].data(), in_embedding[x].data(), dim_);
+void DirectedFiniteContrastEmbedding::MakeInProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem) {
+    for (const ContrastEdgePair& pair : table[x])
+        problem->Add(Out(pair.b), out_sqr_norm[pair.b], pair.label, 1 / regularizer_,
+                     1 + pair.label * kernel_->inner_product(Out(pair.c), In(pair.d), dim_));
+}
+
+void DirectedFiniteContrastEmbedding::MakeOutProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem) {
+    for (const ContrastEdgePair& pair : table[x])
+        problem->Add(In(pair.b), in_sqr_norm[pair.b], pair.label, 1 / regularizer_,
+                     1 + pair.label * kernel_->inner_product(Out(pair.c), In(pair.d), dim_));
+}
+
+double DirectedFiniteContrastEmbedding::UpdateInEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
+    LinearSVMProblem problem;
+    MakeInProblem(table, x, &problem);
+    double violation = LinearSVM(problem, &in_coeff[x], In(x), *kernel_, dim_, false);
+    in_sqr_norm[x] = kernel_->inner_product(In(x), In(x), dim_);
+    return violation;
 }
 
-void DirectedFiniteContrastEmbedding::UpdateOutEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> margin, penalty_coeff, f_sqr_norm;
-    for (const ContrastEdgePair& pair : table[x]) {
-        feature.push_back(in_embedding[pair.b].data());
-        label.push_back(pair.label);
-        margin.push_back(1 + pair.label * InnerProduct(out_embedding[pair.c].data(), in_embedding[pair.d].data(), dim_));
-        penalty_coeff.push_back(1 / regularizer_);
-        f_sqr_norm.push_back(in_sqr_norm[pair.b]);
+double DirectedFiniteContrastEmbedding::UpdateOutEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
+    LinearSVMProblem problem;
+    MakeOutProblem(table, x, &problem);
+    double violation = LinearSVM(problem, &out_coeff[x], Out(x), *kernel_, dim_, false);
+    out_sqr_norm[x] = kernel_->inner_product(Out(x), Out(x), dim_);
+    return violation;
+}
+
+// Worklist node x is the in embedding of x and size_ + x its out embedding. A pair (b, c, d) in the out
+// table of x is a pair of in(b) with Out(x) as the partner, and of out(c) and in(d) with <Out(x), In(b)>
+// in the margin, so all three move by at most |change| * |In(b)|; the in table is the mirror image.
+void DirectedFiniteContrastEmbedding::UpdateGreedy(const ContrastEdgeAdjacencyList& in_table, const ContrastEdgeAdjacencyList& out_table,
+    int node, NodeWorklist* worklist) {
+    bool in = node < size_;
+    int x = in ? node : node - size_;
+    real* vec = in ? In(x) : Out(x);
+    std::vector<real> old(vec, vec + dim_);
+    worklist->Set(node, in ? UpdateInEmbedding(in_table, x) : UpdateOutEmbedding(out_table, x));
+    double change = sqrt(SquaredDistance(old.data(), vec, dim_));
+    if (change == 0) return;
+    for (const ContrastEdgePair& pair : (in ? in_table : out_table)[x]) {
+        double delta = change * sqrt(in ? out_sqr_norm[pair.b] : in_sqr_norm[pair.b]);
+        worklist->Add(in ? size_ + pair.b : pair.b, delta);
+        worklist->Add(size_ + pair.c, delta);
+        worklist->Add(pair.d, delta);
     }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &out_coeff[x], &out_embedding[x], dim_, false);
-    out_sqr_norm[x] = InnerProduct(out_embedding[x].data(), out_embedding[x].data(), dim_);
 }
 
-DirectedFiniteContrastEmbedding::DirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer) :
+// Sum of the in and out subproblems of x
+void DirectedFiniteContrastEmbedding::Objective(const ContrastEdgeAdjacencyList& in_table, const ContrastEdgeAdjacencyList& out_table,
+    int x, NodeObjective* objective) {
+    LinearSVMProblem in, out;
+    MakeInProblem(in_table, x, &in);
+    MakeOutProblem(out_table, x, &out);
+    double in_primal, in_dual, out_primal, out_dual;
+    int in_active, out_active;
+    LinearSVMObjective(in, in_coeff[x], In(x), *kernel_, dim_, &in_primal, &in_dual, &in_active);
+    LinearSVMObjective(out, out_coeff[x], Out(x), *kernel_, dim_, &out_primal, &out_dual, &out_active);
+    objective->primal = in_primal + out_primal;
+    objective->dual = in_dual + out_dual;
+    objective->active = in_active + out_active;
+}
+
+DirectedFiniteContrastEmbedding::DirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer,
+    TrainingMonitor* monitor) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     regularizer_(regularizer) {
 
     std::uniform_real_distribution<double> dist_d(-1, 1);
-    in_embedding.resize(size_);
-    out_embedding.resize(size_);
-    for (int i = 0; i < size_; ++i) {
-        in_embedding[i].resize(dim_);
-        out_embedding[i].resize(dim_);
-    }
+    embedding.resize(size_);
+    for (int i = 0; i < size_; ++i)
+        embedding[i].resize(2 * dim_);
     for (int i = 0; i < size_; ++i)
         for (int j = 0; j < dim_; ++j) {
-            in_embedding[i][j] = dist_d(gen);
-            out_embedding[i][j] = dist_d(gen);
+            In(i)[j] = dist_d(gen);
+            Out(i)[j] = dist_d(gen);
         }
 
     // Construct Contrast Pair Adjacency List
@@ -92,8 +141,8 @@ DirectedFiniteContrastEmbedding::DirectedFiniteContrastEmbedding(const DGraph& g
     std::uniform_int_distribution<int> dist_i(0, edge_list.size() - 1);
     for (int a = 0; a < size_; ++a)
         for (int b : graph.out_edge[a]) {
-            int cnt = 0;
-            while (1) {
+            int cnt = 0, tries = 0;
+            while (tries++ < PAIR_TRIES * sample_ratio) {
                 int i = dist_i(gen);
                 int c = edge_list[i].first, d = edge_list[i].second;
                 if (a == c || a == d || b == c || b == d) continue;
@@ -109,8 +158,8 @@ DirectedFiniteContrastEmbedding::DirectedFiniteContrastEmbedding(const DGraph& g
     in_sqr_norm.resize(size_);
     out_sqr_norm.resize(size_);
     for (int i = 0; i < size_; ++i) {
-        in_sqr_norm[i] = InnerProduct(in_embedding[i].data(), in_embedding[i].data(), dim_);
-        out_sqr_norm[i] = InnerProduct(out_embedding[i].data(), out_embedding[i].data(), dim_);
+        in_sqr_norm[i] = kernel_->inner_product(In(i), In(i), dim_);
+        out_sqr_norm[i] = kernel_->inner_product(Out(i), Out(i), dim_);
     }
 
     in_coeff.resize(size_);
@@ -123,21 +172,70 @@ DirectedFiniteContrastEmbedding::DirectedFiniteContrastEmbedding(const DGraph& g
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
-        RandomPermutation(&order);
-        for (int j : order) {
-            UpdateInEmbedding(in_table, j);
-            UpdateOutEmbedding(out_table, j);
+    std::vector<std::vector<real>> best;
+    std::vector<std::vector<double>> best_in_coeff, best_out_coeff;
+    std::vector<double> best_in_sqr_norm, best_out_sqr_norm;
+    bool greedy = GetNodeSchedule() == SCHEDULE_GREEDY;
+    NodeWorklist worklist(greedy ? 2 * size_ : 0);
+    if (greedy) {
+        std::vector<int> nodes(2 * size_);
+        for (int j = 0; j < 2 * size_; ++j)
+            nodes[j] = j;
+        RandomPermutation(&nodes);
+        for (int j : nodes)
+            worklist.Set(j, INFINITY);
+    }
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
+        int updates = 0;
+        if (greedy) {
+            // An epoch is 2 * size_ updates of the most violated in and out embeddings
+            for (int j; updates < 2 * size_ && (j = worklist.Pop(GREEDY_TOLERANCE)) >= 0; ++updates)
+                UpdateGreedy(in_table, out_table, j, &worklist);
+            if (updates == 0) {
+                if (monitor != nullptr)
+                    monitor->Converged();
+                break;
+            }
+        } else {
+            RandomPermutation(&order);
+            for (int j : order) {
+                UpdateInEmbedding(in_table, j);
+                UpdateOutEmbedding(out_table, j);
+            }
+            updates = 2 * size_;
+        }
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, updates, [&](int x, NodeObjective* objective) {
+                Objective(in_table, out_table, x, objective);
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_in_coeff = in_coeff;
+            best_out_coeff = out_coeff;
+            best_in_sqr_norm = in_sqr_norm;
+            best_out_sqr_norm = out_sqr_norm;
         }
     }
-
-    combined_embedding.resize(size_);    for (int i = 0; i < size_; ++i) {        for (double v : in_embedding[i])            combined_embedding[i].push_back(v);        for (double v : out_embedding[i])            combined_embedding[i].push_back(v);    }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        in_coeff.swap(best_in_coeff);
+        out_coeff.swap(best_out_coeff);
+        in_sqr_norm.swap(best_in_sqr_norm);
+        out_sqr_norm.swap(best_out_sqr_norm);
+    }
 }
 
 double DirectedFiniteContrastEmbedding::Evaluate(int x, int y) {
-    return InnerProduct(out_embedding[x].data(), in_embedding[y].data(), dim_);
+    return kernel_->inner_product(Out(x), In(y), dim_);
+}
+
+Model* GetDirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension,
+                                          double regularizer, TrainingMonitor* monitor) {
+    return new DirectedFiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer, monitor);
 }
 
 Model* GetDirectedFiniteContrastEmbedding(const DGraph& graph, const DGraph& negative, int sample_ratio, int dimension, double regularizer) {
-    return new DirectedFiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer);
+    return GetDirectedFiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer, nullptr);
 }
\ No newline at end of file
@@ -1,9 +1,18 @@
 #include "unit_test.h"
 #include "base.h"
+#include "ann_index.h"
+#include "quantize.h"
 
 #include <cassert>
+#include <algorithm>
 #include <memory>
 #include <iostream>
+#include <random>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
 
 void MakeGraph(Graph* graph) {
     *graph = Graph(7);
@@ -45,6 +54,39 @@ void FiniteEmbeddingTest() {
     assert(model->Evaluate(1, 2) > model->Evaluate(1, 5));
 }   
 
+void CSRGraphTest() {
+    Graph graph(7);
+    MakeGraph(&graph);
+    CSRGraph csr, built;
+    ToCSRGraph(graph, &csr);
+    CSRGraphBuilder builder(7);
+    for (int x = 0; x < 7; ++x)
+        for (int y : graph.edge[x])
+            if (x < y)
+                builder.AddEdge(x, y);
+    builder.Build(&built, true);
+    CompressedCSRGraph compressed;
+    CompressGraph(csr, &compressed);
+    std::vector<int> decoded;
+    for (int x = 0; x < 7; ++x) {
+        compressed.Decode(x, &decoded);
+        std::vector<int> expect(graph.edge[x]);
+        std::sort(expect.begin(), expect.end());
+        assert(std::vector<int>(csr.Neighbors(x).begin(), csr.Neighbors(x).end()) == expect);
+        assert(std::vector<int>(built.Neighbors(x).begin(), built.Neighbors(x).end()) == expect);
+        assert(decoded == expect);
+    }
+
+    Graph negative(7);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    CSRGraph csr_negative;
+    ToCSRGraph(negative, &csr_negative);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(csr, csr_negative, 5, 0.2, 1));
+    assert(model->Evaluate(1, 2) > model->Evaluate(2, 6));
+    assert(model->Evaluate(1, 2) > model->Evaluate(1, 5));
+}
+
 void FiniteContrastEmbeddingTest() {
     Graph graph(7);
     MakeGraph(&graph);
@@ -117,6 +159,403 @@ void CommonNeighborTest() {
     assert(model->Evaluate(1, 2) > model->Evaluate(1, 5));
 }
 
+void RecommendTest() {
+    Graph graph(7);
+    MakeGraph(&graph);
+    Graph negative(7);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1));
+    std::vector<std::vector<std::pair<int, double>>> result;
+    RecommendTopK(model.get(), graph, {1, 5}, 3, &result);
+    for (int q = 0; q < 2; ++q) {
+        int x = (q == 0 ? 1 : 5);
+        assert(result[q].size() == 3);
+        for (int r = 0; r < 3; ++r) {
+            int y = result[q][r].first;
+            assert(y != x && std::find(graph.edge[x].begin(), graph.edge[x].end(), y) == graph.edge[x].end());
+            assert(fabs(result[q][r].second - model->Evaluate(x, y)) < 1e-9);
+            if (r > 0)
+                assert(result[q][r - 1].second >= result[q][r].second);
+        }
+    }
+    // Node 1 only misses node 2 from its square 0-1-3-2
+    assert(result[0][0].first == 2);
+}
+
+class RandomVectorModel : public Model {
+    std::vector<std::vector<real>> embedding;
+  public:
+    RandomVectorModel(int size, int dim, unsigned seed) : embedding(size, std::vector<real>(dim)) {
+        std::mt19937 rng(seed);
+        std::normal_distribution<double> normal(0, 1);
+        for (auto& row : embedding)
+            for (auto& v : row)
+                v = normal(rng);
+    }
+    double Evaluate(int x, int y) { return InnerProduct(embedding[x].data(), embedding[y].data(), embedding[x].size()); }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return embedding[x]; }
+};
+
+void HNSWIndexTest() {
+    RandomVectorModel model(2000, 16, 7);
+    HNSWIndex index;
+    assert(index.Build(&model, 2000, 16, 100));
+    std::vector<int> query;
+    for (int x = 0; x < 2000; x += 20)
+        query.push_back(x);
+    double recall = EvaluateIndexRecall(index, &model, query, 10, 100);
+    assert(recall > 0.9);
+
+    // A reloaded (memory-mapped) index answers exactly like the built one
+    std::string file_name = "hnsw_index_test.bin";
+    assert(index.Save(file_name));
+    HNSWIndex loaded;
+    assert(loaded.Load(file_name));
+    std::vector<std::pair<int, double>> a, b;
+    for (int x : query) {
+        index.Search(model.GetSourceEmbedding(x).data(), 10, 50, &a);
+        loaded.Search(model.GetSourceEmbedding(x).data(), 10, 50, &b);
+        assert(a == b);
+    }
+    assert(EvaluateIndexRecall(loaded, &model, query, 10, 100) == recall);
+
+    // Truncated files, a bad entry point and a link past the last node are rejected, and the index keeps
+    // serving from its previous mapping (written elsewhere, as rewriting a mapped file is undefined). The 40-byte header holds the entry point at byte 28; node 0's
+    // first level-0 link follows its count after the aug, offset, vector and level sections.
+    std::ifstream fin(file_name, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    fin.close();
+    size_t link = 40 + 2000 * (sizeof(double) + sizeof(long long) + sizeof(int)) + 2000 * 16 * sizeof(real) + sizeof(int);
+    for (int corruption = 0; corruption < 3; ++corruption) {
+        std::string bad = corruption == 0 ? bytes.substr(0, bytes.size() / 2) : bytes;
+        int value = 2000;
+        if (corruption > 0)
+            memcpy(&bad[corruption == 1 ? 28 : link], &value, sizeof(value));
+        std::ofstream fout(file_name + ".bad", std::ios::binary);
+        fout.write(bad.data(), bad.size());
+        fout.close();
+        assert(!loaded.Load(file_name + ".bad"));
+        loaded.Search(model.GetSourceEmbedding(query[0]).data(), 10, 50, &b);
+        index.Search(model.GetSourceEmbedding(query[0]).data(), 10, 50, &a);
+        assert(a == b);
+    }
+    remove((file_name + ".bad").c_str());
+    remove(file_name.c_str());
+}
+
+void QuantizationTest() {
+    RandomVectorModel model(1000, 16, 11);
+    std::unique_ptr<QuantizedModel> pq(GetProductQuantizedModel(&model, 1000, 4));
+    std::unique_ptr<QuantizedModel> int8(GetScalarQuantizedModel(&model, 1000));
+    assert(CompressionRatio(&model, pq.get(), 1000) > 1);
+    assert(CompressionRatio(&model, int8.get(), 1000) > 1);
+
+    // Product codes must capture most of the energy of the vectors
+    std::vector<real> decoded(16);
+    double error = 0, energy = 0;
+    for (int x = 0; x < 1000; ++x) {
+        pq->DecodeSource(x, decoded.data());
+        for (int i = 0; i < 16; ++i) {
+            error += (decoded[i] - model.GetEmbedding(x)[i]) * (decoded[i] - model.GetEmbedding(x)[i]);
+            energy += model.GetEmbedding(x)[i] * model.GetEmbedding(x)[i];
+        }
+    }
+    assert(error < 0.5 * energy);
+    for (int x = 0; x < 1000; x += 97)
+        for (int y = 0; y < 1000; y += 89)
+            assert(fabs(int8->Evaluate(x, y) - model.Evaluate(x, y)) < 0.1);
+
+    // Top-k on codes agrees with pairwise scoring on codes
+    Graph empty(1000);
+    std::vector<std::vector<std::pair<int, double>>> result;
+    QuantizedTopK(pq.get(), empty, {3, 500}, 5, &result);
+    for (int q = 0; q < 2; ++q) {
+        assert(result[q].size() == 5);
+        for (const auto& r : result[q])
+            assert(fabs(r.second - pq->Evaluate(q == 0 ? 3 : 500, r.first)) < 1e-4);
+    }
+}
+
+void NeighborHeuristicTest() {
+    // A hub adjacent to everything makes the galloping path kick in against low-degree nodes
+    std::mt19937 rng(5);
+    Graph graph(400);
+    for (int y = 1; y < 400; ++y)
+        graph.AddEdge(0, y);
+    for (int i = 0; i < 1500; ++i) {
+        int x = rng() % 399 + 1, y = rng() % 399 + 1;
+        if (x != y && std::find(graph.edge[x].begin(), graph.edge[x].end(), y) == graph.edge[x].end())
+            graph.AddEdge(x, y);
+    }
+    CSRGraph csr;
+    ToCSRGraph(graph, &csr);
+    std::unique_ptr<Model> cn(GetCommonNeighbor(graph, 5)), cn_csr(GetCommonNeighbor(csr, 5));
+    std::unique_ptr<Model> aa(GetAdamicAdar(graph)), aa_csr(GetAdamicAdar(csr));
+    std::vector<Edge> pair;
+    for (int i = 0; i < 2000; ++i)
+        pair.push_back(Edge(rng() % 400, rng() % 400));
+    std::vector<double> batch;
+    ScorePairs(aa.get(), pair, &batch);
+    for (int i = 0; i < (int)pair.size(); ++i) {
+        int x = pair[i].x, y = pair[i].y;
+        double common = 0, adamic = 0;
+        for (int p : graph.edge[x])
+            if (std::find(graph.edge[y].begin(), graph.edge[y].end(), p) != graph.edge[y].end()) {
+                common++;
+                adamic += 1 / log(graph.edge[p].size());
+            }
+        if (std::find(graph.edge[x].begin(), graph.edge[x].end(), y) != graph.edge[x].end())
+            common += sqrt(graph.edge[x].size()) + sqrt(graph.edge[y].size());
+        if (x == y) continue;
+        assert(fabs(cn->Evaluate(x, y) - common / 5) < 1e-9 && cn_csr->Evaluate(x, y) == cn->Evaluate(x, y));
+        assert(fabs(aa->Evaluate(x, y) - adamic) < 1e-9 && aa_csr->Evaluate(x, y) == aa->Evaluate(x, y));
+        assert(batch[i] == aa->Evaluate(x, y));
+    }
+}
+
+void RandomizedSVDTest() {
+    // K(3,4) plus K(5,5): the adjacency matrix has rank 4, so a rank-4 SVD reproduces it
+    Graph graph(17);
+    for (int x = 0; x < 3; ++x)
+        for (int y = 3; y < 7; ++y)
+            graph.AddEdge(x, y);
+    for (int x = 7; x < 12; ++x)
+        for (int y = 12; y < 17; ++y)
+            graph.AddEdge(x, y);
+    std::unique_ptr<Model> model(GetRandomizedSVD(graph, 4));
+    for (int x = 0; x < 17; ++x)
+        for (int y = 0; y < 17; ++y) {
+            bool edge = std::find(graph.edge[x].begin(), graph.edge[x].end(), y) != graph.edge[x].end();
+            assert(fabs(model->Evaluate(x, y) - (edge ? 1 : 0)) < 1e-4);
+        }
+}
+
+// Held-out AP of the seeded problem in PrecisionTest, as trained by the default double build
+#define DOUBLE_PATH_AP 0.370634216
+
+// The FLOAT_EMBEDDING build trains the same seeded problem in float and is held to the AP recorded from
+// the double build; the double build checks that the recording is still current
+void PrecisionTest() {
+    SeedThread(27);
+    SyntheticGraphConfig config;
+    config.model = SYNTHETIC_SBM;
+    config.size = 400;
+    config.edges = 4000;
+    config.communities = 4;
+    Graph graph, test, negative, neg_test;
+    GenerateGraph(config, &graph, nullptr);
+    Graph full = graph;
+    SplitValidation(&graph, 0.2, &test);
+    negative = Graph(config.size);
+    neg_test = Graph(config.size);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(full, &negative);
+    SampleNegativeGraphUniform(test, &neg_test);
+    RemoveRedundant(full, &neg_test);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 16, 0.2, 1));
+    double ap = EvaluateAveragePrecision(model.get(), test, neg_test);
+    // About one held-out pair in five is an edge
+    assert(ap > 0.3);
+    assert(fabs(ap - DOUBLE_PATH_AP) < (sizeof(real) == sizeof(double) ? 1e-8 : 1e-4));
+}
+
+class RecordingMonitor : public TrainingMonitor {
+  public:
+    std::vector<EpochStats> stats;
+    void OnEpoch(Model* model, const EpochStats& epoch) { stats.push_back(epoch); }
+};
+
+// Also keeps the trainer state after every epoch
+class StateMonitor : public RecordingMonitor {
+  public:
+    std::vector<ModelState> states;
+    void OnEpoch(Model* model, const EpochStats& epoch) {
+        RecordingMonitor::OnEpoch(model, epoch);
+        states.push_back(ModelState());
+        model->GetState(&states.back());
+    }
+};
+
+void TrainingMonitorTest() {
+    Graph graph, negative(7);
+    MakeGraph(&graph);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    RecordingMonitor monitor;
+    monitor.SetValidation(graph, negative, 100);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &monitor));
+    assert(monitor.stats.size() == 10);
+    for (int i = 0; i < 10; ++i) {
+        const EpochStats& epoch = monitor.stats[i];
+        assert(epoch.epoch == i && epoch.seconds >= 0 && epoch.active > 0);
+        // Weak duality holds node by node
+        assert(epoch.gap >= -1e-9 && fabs(epoch.gap - (epoch.primal - epoch.dual)) < 1e-9);
+        assert(epoch.validation_ap >= 0 && epoch.validation_ap <= 1);
+    }
+    assert(monitor.stats.back().gap < monitor.stats.front().gap);
+
+    DGraph d_graph, d_negative(8);
+    MakeDGraph(&d_graph);
+    SampleNegativeDGraphUniform(d_graph, &d_negative);
+    RemoveRedundant(d_graph, &d_negative);
+    std::ostringstream out;
+    TrainingLog log(out, "directed");
+    model.reset(GetDirectedFiniteContrastEmbedding(d_graph, d_negative, 2, 3, 1, &log));
+    std::istringstream lines(out.str());
+    std::string line;
+    int count = 0;
+    while (std::getline(lines, line)) {
+        assert(line.find("\"model\": \"directed\"") != std::string::npos && line.find("\"validation_ap\": null") != std::string::npos);
+        ++count;
+    }
+    assert(count == 10);
+}
+
+void EarlyStoppingTest() {
+    Graph graph, negative(7);
+    MakeGraph(&graph);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    RecordingMonitor monitor;
+    StoppingRule rule;
+    rule.max_epochs = 25;
+    monitor.SetStoppingRule(rule);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &monitor));
+    assert(monitor.stats.size() == 25 && monitor.stop_reason() == "epochs");
+
+    // The same monitor starts over with every trainer
+    rule.max_epochs = 1000;
+    rule.min_change = 1e-3;
+    monitor.SetStoppingRule(rule);
+    monitor.stats.clear();
+    model.reset(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &monitor));
+    int epochs = monitor.stats.size();
+    assert(epochs >= 2 && epochs < 1000 && monitor.stop_reason() == "converged");
+    double last = monitor.stats[epochs - 1].primal, before = monitor.stats[epochs - 2].primal;
+    assert(fabs(last - before) <= 1e-3 * fabs(before));
+
+    // Training ends after the epoch that would overrun the budget
+    rule = StoppingRule();
+    rule.seconds = 1e-9;
+    monitor.SetStoppingRule(rule);
+    monitor.stats.clear();
+    model.reset(GetFiniteSGD(graph, negative, 5, 0.2, 1, &monitor));
+    assert(monitor.stats.size() == 1 && monitor.stop_reason() == "time");
+
+    // Past the best validation AP the trainer hands back its copy from that epoch
+    rule = StoppingRule();
+    rule.max_epochs = 30;
+    rule.patience = 2;
+    monitor.SetStoppingRule(rule);
+    monitor.SetValidation(graph, negative, 100);
+    monitor.stats.clear();
+    model.reset(GetFiniteSGD(graph, negative, 5, 0.2, 1, &monitor));
+    double best = 0;
+    for (const EpochStats& epoch : monitor.stats)
+        best = std::max(best, epoch.validation_ap);
+    assert(monitor.stats[monitor.best_epoch()].validation_ap == best);
+    assert(fabs(EvaluateAveragePrecision(model.get(), graph, negative) - best) < 1e-9);
+    assert(monitor.stop_reason() == "epochs" ||
+           (monitor.stop_reason() == "patience" && (int)monitor.stats.size() == monitor.best_epoch() + 3));
+
+    // The dual coefficients come back together with the embedding, so GetState describes the best epoch
+    StateMonitor states;
+    states.SetStoppingRule(rule);
+    states.SetValidation(graph, negative, 100);
+    model.reset(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &states));
+    ModelState final_state;
+    assert(model->GetState(&final_state));
+    const ModelState& best_state = states.states[states.best_epoch()];
+    assert(final_state.embedding == best_state.embedding && final_state.coeff == best_state.coeff);
+
+    // Validation edges come out of the training edges, so model selection never sees the test split
+    Graph train = graph, validation;
+    SplitValidation(&train, 0.5, &validation);
+    for (int x = 0; x < 7; ++x) {
+        assert(train.edge[x].size() + validation.edge[x].size() == graph.edge[x].size());
+        for (int y : validation.edge[x])
+            assert(std::find(train.edge[x].begin(), train.edge[x].end(), y) == train.edge[x].end());
+    }
+}
+
+void WarmStartTest() {
+    Graph graph, negative(7);
+    MakeGraph(&graph);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    RecordingMonitor cold;
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &cold));
+    ModelState state;
+    assert(model->GetState(&state) && state.embedding.size() == 7 && state.coeff.size() == 7);
+
+    // Starting from the solution leaves little to do; a stronger regularizer clips the coefficients
+    RecordingMonitor warm;
+    model.reset(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &warm, &state));
+    assert(warm.stats.front().gap < cold.stats.front().gap);
+    ModelState clipped;
+    model.reset(GetFiniteEmbedding(graph, negative, 5, 0.2, 4, nullptr, &state));
+    assert(model->GetState(&clipped));
+    for (const std::vector<double>& coeff : clipped.coeff)
+        for (double c : coeff)
+            assert(c <= 0.25 + 1e-12 && c >= -0.05 - 1e-12);
+
+    // Contrast models resample the same pairs, so every coefficient keeps its pair
+    model.reset(GetFiniteContrastEmbedding(graph, negative, 2, 3, 1));
+    assert(model->GetState(&state));
+    model.reset(GetFiniteContrastEmbedding(graph, negative, 2, 3, 2, nullptr, &state));
+    assert(model->GetState(&clipped) && clipped.seed == state.seed);
+    for (int x = 0; x < 7; ++x)
+        assert(clipped.coeff[x].size() == state.coeff[x].size());
+    assert(!std::unique_ptr<Model>(GetRandom())->GetState(&state));
+}
+
+// Total updates over all epochs of a monitored run
+double Updates(const RecordingMonitor& monitor) {
+    double updates = 0;
+    for (const EpochStats& epoch : monitor.stats)
+        updates += epoch.updates_per_second * epoch.seconds;
+    return updates;
+}
+
+void GreedyScheduleTest() {
+    Graph graph, negative(7);
+    MakeGraph(&graph);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    DGraph d_graph, d_negative(8);
+    MakeDGraph(&d_graph);
+    SampleNegativeDGraphUniform(d_graph, &d_negative);
+    RemoveRedundant(d_graph, &d_negative);
+    StoppingRule rule;
+    rule.max_epochs = 1000;
+
+    // Greedy runs stop by themselves once every node is solved to the tolerance, long before the epoch limit
+    SetNodeSchedule(SCHEDULE_GREEDY);
+    for (int i = 0; i < 4; ++i) {
+        RecordingMonitor monitor;
+        monitor.SetStoppingRule(rule);
+        std::unique_ptr<Model> model;
+        if (i == 0) model.reset(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &monitor));
+        if (i == 1) model.reset(GetFiniteContrastEmbedding(graph, negative, 2, 5, 1, &monitor));
+        if (i == 2) model.reset(GetDirectedFiniteEmbedding(d_graph, d_negative, 5, 0.2, 1, &monitor));
+        if (i == 3) model.reset(GetDirectedFiniteContrastEmbedding(d_graph, d_negative, 2, 5, 1, &monitor));
+        int size = i < 2 ? 7 : 16;
+        assert(monitor.stop_reason() == "converged" && monitor.stats.size() < 1000);
+        // The last epoch drained the worklist before a full sweep
+        const EpochStats& last = monitor.stats.back();
+        assert(last.updates_per_second * last.seconds < size - 0.5);
+        assert(last.gap < 0.01);
+    }
+    SetNodeSchedule(SCHEDULE_RANDOM);
+
+    RecordingMonitor monitor;
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1, &monitor));
+    assert(monitor.stats.size() == 10 && fabs(Updates(monitor) - 70) < 1e-6);
+}
+
 void EmbeddingTest() {
     FiniteEmbeddingTest();
     FiniteContrastEmbeddingTest();
@@ -125,4 +564,15 @@ void EmbeddingTest() {
     DirectedFiniteEmbeddingTest();
     DirectedFiniteContrastEmbeddingTest();
     CommonNeighborTest();
+    CSRGraphTest();
+    RecommendTest();
+    HNSWIndexTest();
+    QuantizationTest();
+    NeighborHeuristicTest();
+    RandomizedSVDTest();
+    TrainingMonitorTest();
+    EarlyStoppingTest();
+    WarmStartTest();
+    GreedyScheduleTest();
+    PrecisionTest();
 }
\ No newline at end of file
@@ -8,170 +8,277 @@
 #include <random>
 #include <memory>
 #include <unordered_set>
+#include <functional>
 
 namespace {
-    std::mt19937 gen(9119);
+    thread_local ThreadGenerator gen(9119);
 }   // anonymous namespace
 
 #define EPOCHS 100
 #define LINK_EPOCHS 20
+#define NODE_BLOCK 1024
+#define PAIR_BLOCK 16384
+#define PROPAGATION_TOLERANCE 1e-6
+
+namespace {
+    // Scores every (x, y) in adjacency order; each block of nodes writes its own slice of score
+    void ScoreAdjacency(Model* model, const std::vector<std::vector<int>>& edge, std::vector<double>* score) {
+        int size = edge.size();
+        std::vector<long long> offset(size + 1, 0);
+        for (int x = 0; x < size; ++x)
+            offset[x + 1] = offset[x] + edge[x].size();
+        score->resize(offset[size]);
+        auto score_block = [&](int block) {
+            int end = std::min(size, (block + 1) * NODE_BLOCK);
+            for (int x = block * NODE_BLOCK; x < end; ++x) {
+                double* out = score->data() + offset[x];
+                for (int y : edge[x])
+                    *out++ = model->Evaluate(x, y);
+            }
+        };
+        int blocks = (size + NODE_BLOCK - 1) / NODE_BLOCK;
+        if (model->IsThreadSafe()) {
+            ParallelFor(blocks, score_block);
+        } else {
+            for (int block = 0; block < blocks; ++block)
+                score_block(block);
+        }
+    }
+}   // anonymous namespace
+
+namespace {
+    // Sum of term(i) over 0 <= i < size, in blocks of nodes added in block order
+    double SumOverNodes(int size, bool parallel, const std::function<double(int)>& term) {
+        int blocks = (size + NODE_BLOCK - 1) / NODE_BLOCK;
+        std::vector<double> partial(blocks, 0);
+        auto sum_block = [&](int block) {
+            int end = std::min(size, (block + 1) * NODE_BLOCK);
+            for (int i = block * NODE_BLOCK; i < end; ++i)
+                partial[block] += term(i);
+        };
+        if (parallel) {
+            ParallelFor(blocks, sum_block);
+        } else {
+            for (int block = 0; block < blocks; ++block)
+                sum_block(block);
+        }
+        double sum = 0;
+        for (double v : partial)
+            sum += v;
+        return sum;
+    }
+
+    double HingeLoss(const std::vector<double>& score, bool positive) {
+        double v = 0;
+        for (double s : score)
+            v += std::max(positive ? 1 - s : s, (double)0);
+        return v;
+    }
+
+    // score holds train positive, train negative, test positive and test negative pair scores
+    void PrintEvaluation(const std::vector<double>* score, double norm) {
+        std::cout << "Test Average Precision\n" << EvaluateAveragePrecision(score[2], score[3]) << "\n";
+        std::cout << "Empirical Average Precision\n" << EvaluateAveragePrecision(score[0], score[1]) << "\n";
+        std::cout << "Empirical Hinge Loss(Positive)\n";
+        std::cout << HingeLoss(score[0], true) << " / " << (double)score[0].size() << "\n";
+        std::cout << "Empirical Hinge Loss(Negative)\n";
+        std::cout << HingeLoss(score[1], false) << " / " << (double)score[1].size() << "\n";
+        std::cout << "Test Hinge Loss(Positive)\n";
+        std::cout << HingeLoss(score[2], true) << " / " << (double)score[2].size() << "\n";
+        std::cout << "Test Hinge Loss(Negative)\n";
+        std::cout << HingeLoss(score[3], false) << " / " << (double)score[3].size() << "\n";
+        std::cout << "Total L2 Norm\n" << norm << "\n";
+    }
+}   // anonymous namespace
+
+void ScoreEdges(Model* model, const Graph& graph, std::vector<double>* score) {
+    ScoreAdjacency(model, graph.edge, score);
+}
+
+void ScoreEdges(Model* model, const DGraph& graph, std::vector<double>* score) {
+    ScoreAdjacency(model, graph.out_edge, score);
+}
+
+void ScorePairs(Model* model, const std::vector<Edge>& pair, std::vector<double>* score) {
+    long long total = pair.size();
+    score->resize(total);
+    int blocks = (int)((total + PAIR_BLOCK - 1) / PAIR_BLOCK);
+    auto score_block = [&](int block) {
+        long long end = std::min(total, (long long)(block + 1) * PAIR_BLOCK);
+        for (long long i = (long long)block * PAIR_BLOCK; i < end; ++i)
+            (*score)[i] = model->Evaluate(pair[i].x, pair[i].y);
+    };
+    if (model->IsThreadSafe()) {
+        ParallelFor(blocks, score_block);
+    } else {
+        for (int block = 0; block < blocks; ++block)
+            score_block(block);
+    }
+}
 
 double EvaluatePredictedAP(Model* model, const Graph& train, const Graph& pos, const Graph& neg, double regularizer, int sample_ratio) {
     int dim = model->GetEmbedding(0).size();
+    const VectorKernel& kernel = GetVectorKernel(dim);
     std::uniform_int_distribution<int> dist(0, train.size - 1);
 
-    std::vector<std::vector<double>> vec;
-    std::vector<double> norm, penalty_coeff, margin;
-    std::vector<int> label;
+    std::vector<const real*> row(train.size);
+    for (int x = 0; x < train.size; ++x)
+        row[x] = model->GetEmbedding(x).data();
+
+    // A sample is the node quadruple (x, y, xp, yp); its feature e_x * e_y - e_xp * e_yp is rebuilt by
+    // the solver when needed, so memory grows with the sample count but not with the dimension
+    std::vector<int> sample;
     for (int x = 0; x < train.size; ++x)
-        for (int y : train.edge[x]) {
-            std::vector<double> edge_vec(dim);
-            for (int j = 0; j < dim; ++j)
-                edge_vec[j] = model->GetEmbedding(x)[j] * model->GetEmbedding(y)[j];
+        for (int y : train.edge[x])
             for (int i = 0; i < sample_ratio; ++i) {
-                std::vector<double> contrast(dim);
                 int xp = dist(gen), yp = dist(gen);
-                for (int j = 0; j < dim; ++j)
-                    contrast[j] = edge_vec[j] - model->GetEmbedding(xp)[j] * model->GetEmbedding(yp)[j];
-                norm.push_back(InnerProduct(contrast.data(), contrast.data(), dim));
-                label.push_back(1);
-                penalty_coeff.push_back(1 / regularizer);
-                margin.push_back(1);
-                vec.push_back(std::move(contrast));
-            }           
-        }
+                sample.insert(sample.end(), {x, y, xp, yp});
+            }
+    auto make_feature = [&](int i, real* contrast) {
+        const int* q = sample.data() + 4 * (size_t)i;
+        const real *ex = row[q[0]], *ey = row[q[1]], *e_xp = row[q[2]], *e_yp = row[q[3]];
+        for (int j = 0; j < dim; ++j)
+            contrast[j] = ex[j] * ey[j] - e_xp[j] * e_yp[j];
+    };
 
-    std::vector<double> coeff(vec.size(), 0), w(dim, 0);
-    std::vector<const double*> ptr_vec;
-    for (int i = 0; i < (int)vec.size(); ++i)
-        ptr_vec.push_back(vec[i].data());
+    int sample_size = sample.size() / 4;
+    std::vector<double> norm(sample_size), penalty_coeff(sample_size, 1 / regularizer), margin(sample_size, 1);
+    std::vector<int> label(sample_size, 1);
+    std::vector<real> contrast(dim);
+    for (int i = 0; i < sample_size; ++i) {
+        make_feature(i, contrast.data());
+        norm[i] = kernel.inner_product(contrast.data(), contrast.data(), dim);
+    }
 
+    std::vector<double> coeff(sample_size, 0);
+    std::vector<real> w(dim, 0);
     for (int i = 0; i < LINK_EPOCHS; ++i)
-        LinearSVM(ptr_vec, norm, label, penalty_coeff, margin, &coeff, &w, dim, false);
+        ImplicitLinearSVM(sample_size, make_feature, norm, label, penalty_coeff, margin, &coeff, w.data(), kernel, dim, false);
 
+    auto edge_score = [&](int x, int y) {
+        double val = 0;
+        for (int j = 0; j < dim; ++j)
+            val += (double)row[x][j] * row[y][j] * w[j];
+        return val;
+    };
     std::vector<double> p, n;
     for (int x = 0; x < train.size; ++x)
-        for (int y : pos.edge[x]) {
-            std::vector<double> edge_vec(dim);
-            for (int j = 0; j < dim; ++j)
-                edge_vec[j] = model->GetEmbedding(x)[j] * model->GetEmbedding(y)[j];
-            p.push_back(InnerProduct(edge_vec.data(), w.data(), dim));
-        }
-
+        for (int y : pos.edge[x])
+            p.push_back(edge_score(x, y));
     for (int x = 0; x < train.size; ++x)
-        for (int y : neg.edge[x]) {
-            std::vector<double> edge_vec(dim);
-            for (int j = 0; j < dim; ++j)
-                edge_vec[j] = model->GetEmbedding(x)[j] * model->GetEmbedding(y)[j];
-            n.push_back(InnerProduct(edge_vec.data(), w.data(), dim));
-        }
+        for (int y : neg.edge[x])
+            n.push_back(edge_score(x, y));
     return EvaluateAveragePrecision(p, n);
 }
 
 double EvaluateAveragePrecision(Model* model, const Graph& pos, const Graph& neg) {
     std::vector<double> p, n;
-    for (int i = 0; i < pos.size; ++i)
-        for (int y : pos.edge[i])
-            p.push_back(model->Evaluate(i, y));
-    for (int i = 0; i < neg.size; ++i)
-        for (int y : neg.edge[i])
-            n.push_back(model->Evaluate(i, y));
+    ScoreEdges(model, pos, &p);
+    ScoreEdges(model, neg, &n);
     return EvaluateAveragePrecision(p, n);
 }
 
 double EvaluateAveragePrecision(Model* model, const DGraph& pos, const DGraph& neg) {
     std::vector<double> p, n;
-    for (int i = 0; i < pos.size; ++i)
-        for (int y : pos.out_edge[i])
-            p.push_back(model->Evaluate(i, y));
-    for (int i = 0; i < neg.size; ++i)
-        for (int y : neg.out_edge[i])
-            n.push_back(model->Evaluate(i, y));
+    ScoreEdges(model, pos, &p);
+    ScoreEdges(model, neg, &n);
     return EvaluateAveragePrecision(p, n);
 }
 
 double EvaluateF1(Model* model, const Label& train, const Label& test, double regularizer, int sample_ratio, bool normalize) {
     int dim = model->GetEmbedding(0).size();
-    std::vector<const double*> vec;
-    for (int i = 0; i < train.size; ++i)
-        vec.push_back(model->GetEmbedding(i).data());
-    std::vector<double> v_norm(train.size, 0);
-    for (int i = 0; i < train.size; ++i)
-        if (normalize)
-            v_norm[i] = sqrt(InnerProduct(vec[i], vec[i], dim));
-        else
-            v_norm[i] = 1;
+    const VectorKernel& kernel = GetVectorKernel(dim);
 
-    double ave_f1 = 0;
-    for (int a = 0; a < train.card; ++a) {
+    // Rows scaled once up front; every contrast feature is a difference of two of these
+    std::vector<real> row(train.size * (size_t)dim);
+    for (int i = 0; i < train.size; ++i) {
+        EmbeddingView v = model->GetEmbedding(i);
+        double v_norm = normalize ? std::max(sqrt(kernel.inner_product(v.data(), v.data(), dim)), 1e-4) : 1;
+        for (int k = 0; k < dim; ++k)
+            row[i * (size_t)dim + k] = (real)(v[k] / v_norm);
+    }
+
+    // Labels are independent one-vs-rest problems, each trained by one worker with its own sampler;
+    // at most GetThreadCount() feature buffers are alive at once. A label without any negative to draw
+    // has no classifier and scores 0.
+    std::vector<double> f1(train.card, 0);
+    std::vector<unsigned> seed(train.card);
+    for (int a = 0; a < train.card; ++a)
+        seed[a] = gen();
+    ParallelFor(train.card, [&](int a) {
         std::unordered_set<int> positive(test.label_instance[a].begin(), test.label_instance[a].end());
+        // LinearSVM shuffles with the thread's generators, which earlier labels on this worker have advanced
+        SeedThread(seed[a]);
+        std::mt19937 label_gen(seed[a]);
         std::uniform_int_distribution<int> dist(0, train.size - 1);
 
-        std::vector<std::vector<double>> train_vec;
-        std::vector<double> norm, penalty_coeff, margin;
-        std::vector<int> label;
+        bool has_negative = false;
+        for (int t = 0; t < train.size && !has_negative; ++t)
+            has_negative = train.labeled[t] && positive.count(t) == 0;
+        if (!has_negative) return;
+        int sample_size = train.label_instance[a].size() * sample_ratio;
+        std::vector<real> train_vec(sample_size * (size_t)dim);
+        std::vector<const real*> ptr_vec(sample_size);
+        std::vector<double> norm(sample_size), penalty_coeff(sample_size, 1 / regularizer), margin(sample_size, 1);
+        std::vector<int> label(sample_size, 1);
+        int s = 0;
         for (int i : train.label_instance[a]) {
-            for (int j = 0; j < sample_ratio; ++j) {
-                int t = dist(gen);
+            for (int j = 0; j < sample_ratio; ++j, ++s) {
+                int t = dist(label_gen);
                 while (!train.labeled[t] || positive.count(t) > 0)
-                    t = dist(gen);
-                std::vector<double> feature_vec(dim);
-                for (int k = 0; k < dim; ++k) 
-                    feature_vec[k] = vec[i][k] / std::max(v_norm[i], 1e-4) - vec[t][k] / std::max(v_norm[t], 1e-4);
-
-                norm.push_back(InnerProduct(feature_vec.data(), feature_vec.data(), dim));
-                label.push_back(1);
-                penalty_coeff.push_back(1 / regularizer);
-                margin.push_back(1);
-                train_vec.push_back(std::move(feature_vec));
+                    t = dist(label_gen);
+                real* feature_vec = train_vec.data() + s * (size_t)dim;
+                const real* row_i = row.data() + i * (size_t)dim;
+                const real* row_t = row.data() + t * (size_t)dim;
+                for (int k = 0; k < dim; ++k)
+                    feature_vec[k] = row_i[k] - row_t[k];
+                norm[s] = kernel.inner_product(feature_vec, feature_vec, dim);
+                ptr_vec[s] = feature_vec;
             }
         }
 
-        std::vector<const double*> ptr_vec;
-        for (int i = 0; i < (int)train_vec.size(); ++i)
-            ptr_vec.push_back(train_vec[i].data());
-
-        std::vector<double> coeff(train_vec.size(), 0), w(dim, 0), label_prediction(train.size);
+        std::vector<double> coeff(sample_size, 0);
+        std::vector<real> w(dim, 0);
         for (int i = 0; i < EPOCHS; ++i)
-            LinearSVM(ptr_vec, norm, label, penalty_coeff, margin, &coeff, &w, dim, false);
-
-        for (int i = 0; i < train.size; ++i)
-            label_prediction[i] = InnerProduct(vec[i], w.data(), dim) / v_norm[i];
+            LinearSVM(ptr_vec, norm, label, penalty_coeff, margin, &coeff, w.data(), kernel, dim, false);
 
         std::vector<double> p, n;
-        for (int i = 0; i < test.size; ++i)
+        for (int i = 0; i < test.size; ++i) {
+            if (positive.count(i) == 0 && !test.labeled[i]) continue;
+            double prediction = kernel.inner_product(row.data() + i * (size_t)dim, w.data(), dim);
             if (positive.count(i) > 0)
-                p.push_back(label_prediction[i]);
-            else if (test.labeled[i])
-                n.push_back(label_prediction[i]);
+                p.push_back(prediction);
+            else
+                n.push_back(prediction);
+        }
 
-        ave_f1 += EvaluateF1(p, n);
-        std::cout << "Processing " << a << "; Ave: " << ave_f1 / (a + 1) << "\n";
-    }
+        f1[a] = EvaluateF1(p, n);
+    });
 
-    ave_f1 /= train.card;
-    return ave_f1;
+    double ave_f1 = 0;
+    for (int a = 0; a < train.card; ++a) {
+        std::cout << "Processing " << a << "; F1: " << f1[a] << "\n";
+        ave_f1 += f1[a];
+    }
+    return ave_f1 / train.card;
 }
 
 double EvaluateF1LabelPropagation(const Graph& base, const Label& train, const Label& test) {
+    CSRGraph csr;
+    ToCSRGraph(base, &csr);
+    std::unique_ptr<Model> model(GetLabelPropagation(csr, train, PROPAGATION_TOLERANCE));
     double ave_f1 = 0;
     int total = 0;
     for (int a = 0; a < test.card; ++a) {
-        SingleLabel label(train.size);
-        for (int i = 0; i < train.size; ++i)
-            if (train.labeled[i])
-                label.SetLabel(i, 0);
-        for (int i : train.label_instance[a])
-            label.SetLabel(i, 1);
-
-        std::unique_ptr<Model> model(GetLabelPropagation(base, label));
         std::vector<double> p, n;
         std::unordered_set<int> pos(test.label_instance[a].begin(), test.label_instance[a].end());
-        for (int i = 0; i < test.size; ++i)
+        for (int i = 0; i < test.size; ++i) {
+            double score = a < train.card ? model->GetEmbedding(i)[a] : 0;
             if (pos.count(i) > 0)
-                p.push_back(model->GetEmbedding(i)[1]);
+                p.push_back(score);
             else if (test.labeled[i])
-                n.push_back(model->GetEmbedding(i)[1]);
+                n.push_back(score);
+        }
 
         if (p.size() > 0)
             total++;
@@ -185,87 +292,25 @@ double EvaluateF1LabelPropagation(const Graph& base, const Label& train, const L
 }
 
 void EvaluateAll(Model* model, const Graph& train_pos, const Graph& train_neg, const Graph& test_pos, const Graph& test_neg) {
-    double v, cnt;
-    std::cout << "Test Average Precision\n" << EvaluateAveragePrecision(model, test_pos, test_neg) << "\n";
-    std::cout << "Empirical Average Precision\n" << EvaluateAveragePrecision(model, train_pos, train_neg) << "\n";
-    std::cout << "Empirical Hinge Loss(Positive)\n";
-    v = cnt = 0;
-    for (int i = 0; i < train_pos.size; ++i)
-        for (int y : train_pos.edge[i]) {
-            v += std::max(1 - model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Empirical Hinge Loss(Negative)\n";
-    v = cnt = 0;
-    for (int i = 0; i < train_neg.size; ++i)
-        for (int y : train_neg.edge[i]) {
-            v += std::max(model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Test Hinge Loss(Positive)\n";
-    v = cnt = 0;
-    for (int i = 0; i < test_pos.size; ++i)
-        for (int y : test_pos.edge[i]) {
-            v += std::max(1 - model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Test Hinge Loss(Negative)\n";
-    v = cnt = 0;
-    for (int i = 0; i < test_neg.size; ++i)
-        for (int y : test_neg.edge[i]) {
-            v += std::max(model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Total L2 Norm\n";
-    v = 0;
-    for (int i = 0; i < train_pos.size; ++i)
-        v += model->Evaluate(i, i);
-    std::cout << v << "\n";
+    std::vector<double> score[4];
+    ScoreEdges(model, train_pos, &score[0]);
+    ScoreEdges(model, train_neg, &score[1]);
+    ScoreEdges(model, test_pos, &score[2]);
+    ScoreEdges(model, test_neg, &score[3]);
+    double norm = SumOverNodes(train_pos.size, model->IsThreadSafe(), [&](int i) { return model->Evaluate(i, i); });
+    PrintEvaluation(score, norm);
 }
 
 void EvaluateAll(Model* model, const DGraph& train_pos, const DGraph& train_neg, const DGraph& test_pos, const DGraph& test_neg) {
-    double v, cnt;
-    std::cout << "Test Average Precision\n" << EvaluateAveragePrecision(model, test_pos, test_neg) << "\n";
-    std::cout << "Empirical Average Precision\n" << EvaluateAveragePrecision(model, train_pos, train_neg) << "\n";
-    std::cout << "Empirical Hinge Loss(Positive)\n";
-    v = cnt = 0;
-    for (int i = 0; i < train_pos.size; ++i)
-        for (int y : train_pos.out_edge[i]) {
-            v += std::max(1 - model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Empirical Hinge Loss(Negative)\n";
-    v = cnt = 0;
-    for (int i = 0; i < train_neg.size; ++i)
-        for (int y : train_neg.out_edge[i]) {
-            v += std::max(model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Test Hinge Loss(Positive)\n";
-    v = cnt = 0;
-    for (int i = 0; i < test_pos.size; ++i)
-        for (int y : test_pos.out_edge[i]) {
-            v += std::max(1 - model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Test Hinge Loss(Negative)\n";
-    v = cnt = 0;
-    for (int i = 0; i < test_neg.size; ++i)
-        for (int y : test_neg.out_edge[i]) {
-            v += std::max(model->Evaluate(i, y), (double)0);
-            cnt++;
-        }
-    std::cout << v << " / " << cnt << "\n";
-    std::cout << "Total L2 Norm\n";
-    v = 0;
-    for (int i = 0; i < train_pos.size; ++i)
-        v += InnerProduct(model->GetEmbedding(i).data(), model->GetEmbedding(i).data(), model->GetEmbedding(i).size());
-    std::cout << v << "\n";
+    std::vector<double> score[4];
+    ScoreEdges(model, train_pos, &score[0]);
+    ScoreEdges(model, train_neg, &score[1]);
+    ScoreEdges(model, test_pos, &score[2]);
+    ScoreEdges(model, test_neg, &score[3]);
+    const VectorKernel& kernel = GetVectorKernel(model->GetEmbedding(0).size());
+    double norm = SumOverNodes(train_pos.size, true, [&](int i) {
+        EmbeddingView row = model->GetEmbedding(i);
+        return kernel.inner_product(row.data(), row.data(), row.size());
+    });
+    PrintEvaluation(score, norm);
 }
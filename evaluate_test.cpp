@@ -1,8 +1,10 @@
 #include "base.h"
+#include "experiment.h"
 #include "unit_test.h"
 #include <cassert>
 #include <memory>
 #include <iostream>
+#include <sstream>
 
 void MakeGraphLabel(Graph* graph, Label* train, Label* test) {
     *graph = Graph(7);
@@ -35,6 +37,22 @@ void EvaluateF1Test() {
     std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 5, 0.2, 1));
     std::cout << EvaluateF1(model.get(), train, test, 1, 2, true) << "\n";
     assert(fabs(EvaluateF1(model.get(), train, test, 1, 2, true) - 1) < 0.01);
+
+    // Every labeled training node is a test positive of label 2, so it has no negatives and scores 0 in
+    // the average over all labels; the result does not depend on how labels are spread over the workers
+    train.SetLabel(0, 2);
+    test.SetLabel(0, 2);
+    test.SetLabel(3, 2);
+    test.SetLabel(4, 2);
+    int threads = GetThreadCount();
+    double f1[2];
+    for (int k = 0; k < 2; ++k) {
+        SetThreadCount(k == 0 ? 1 : 3);
+        SeedThread(5);
+        f1[k] = EvaluateF1(model.get(), train, test, 1, 2, true);
+    }
+    SetThreadCount(threads);
+    assert(f1[0] == f1[1] && f1[0] > 0.5 && f1[0] <= 2.0 / 3 + 1e-9);
 }
 
 void EvaluateF1LabelPropagationTest() {
@@ -45,7 +63,149 @@ void EvaluateF1LabelPropagationTest() {
     assert(fabs(EvaluateF1LabelPropagation(graph, train, test) - 1) < 0.01);
 }
 
+void MultiLabelPropagationTest() {
+    Graph graph;
+    Label train, test;
+    MakeGraphLabel(&graph, &train, &test);
+    CSRGraph csr;
+    ToCSRGraph(graph, &csr);
+    std::unique_ptr<Model> model(GetLabelPropagation(csr, train, 1e-9));
+    // Column a matches the two-class propagation of label a against the other labels
+    for (int a = 0; a < train.card; ++a) {
+        SingleLabel label(train.size);
+        for (int i = 0; i < train.size; ++i)
+            if (train.labeled[i])
+                label.SetLabel(i, 0);
+        for (int i : train.label_instance[a])
+            label.SetLabel(i, 1);
+        std::unique_ptr<Model> single(GetLabelPropagation(graph, label));
+        for (int i = 0; i < graph.size; ++i)
+            assert(fabs(model->GetEmbedding(i)[a] - single->GetEmbedding(i)[1]) < 1e-4);
+    }
+}
+
+void ExperimentTest() {
+    std::istringstream file(
+        "# two undirected models and one without its graph\n"
+        "[data]\n"
+        "threads = 4\n"
+        "\n"
+        "[model fe]\n"
+        "type = FiniteEmbedding\n"
+        "dim = 5\n"
+        "neg_penalty = 0.2\n"
+        "max_epochs = 3\n"
+        "[model CommonNeighbor]\n"
+        "[model DirectedFiniteEmbedding]\n"
+        "[model fe-again]\n"
+        "type = FiniteEmbedding\n"
+        "dim = 5\n"
+        "neg_penalty = 0.2\n"
+        "max_epochs = 3\n"
+        "[model fe-seed]\n"
+        "type = FiniteEmbedding\n"
+        "seed = 7\n");
+    ExperimentConfig config;
+    assert(ReadExperimentConfig(file, &config));
+    assert(config.threads == 4 && config.models.size() == 5 && config.models[1].type == "CommonNeighbor");
+    assert(config.models[0].seed == 1 && config.models[4].seed == 7 && config.models[4].params.empty());
+    std::istringstream typo("[model FiniteEmbedding]\nregulariser = 1\n");
+    ExperimentConfig bad;
+    assert(!ReadExperimentConfig(typo, &bad));
+
+    ExperimentData data;
+    MakeGraphLabel(&data.train, &data.train_label, &data.test_label);
+    data.test = data.train;
+    data.neg_train = data.neg_test = Graph(7);
+    SampleNegativeGraphUniform(data.train, &data.neg_train);
+    RemoveRedundant(data.train, &data.neg_train);
+    SampleNegativeGraphUniform(data.test, &data.neg_test);
+    RemoveRedundant(data.test, &data.neg_test);
+    std::vector<ExperimentResult> results;
+    RunExperiment(config, data, &results);
+    assert(results.size() == 5);
+    assert(results[0].ok && results[0].name == "fe" && results[0].epochs == 3 && results[0].stop_reason == "epochs");
+    assert(results[0].average_precision >= 0 && results[0].f1 >= 0);
+    std::unique_ptr<Model> cn(GetCommonNeighbor(data.train, 120));
+    assert(results[1].ok && results[1].epochs == 0 && results[1].f1 == -1);
+    assert(fabs(results[1].average_precision - EvaluateAveragePrecision(cn.get(), data.test, data.neg_test)) < 1e-12);
+    assert(!results[2].ok && !results[2].error.empty());
+    // Models are reseeded before training, so the same model gives the same result whichever worker runs it
+    assert(results[3].ok && results[3].average_precision == results[0].average_precision && results[3].f1 == results[0].f1);
+    std::vector<ExperimentResult> alone;
+    config.models.erase(config.models.begin() + 1, config.models.end());
+    RunExperiment(config, data, &alone);
+    assert(alone[0].average_precision == results[0].average_precision);
+    std::ostringstream json;
+    WriteExperimentJson(results, json);
+    assert(json.str().find("\"f1\": null") != std::string::npos);
+
+    // Concurrent models split the threads between them
+    int threads = GetThreadCount();
+    SetThreadCount(5);
+    std::vector<int> share(2);
+    ParallelFor(2, [&](int i) { share[i] = GetThreadCount(); });
+    assert(share[0] >= 2 && share[0] <= 3 && share[1] >= 2 && share[1] <= 3 && GetThreadCount() == 5);
+    SetThreadCount(threads);
+}
+
+void SweepTest() {
+    std::istringstream file(
+        "[data]\n"
+        "threads = 2\n"
+        "schedule = greedy\n"
+        "[sweep path]\n"
+        "type = FiniteEmbedding\n"
+        "dim = 5\n"
+        "neg_penalty = 0.2\n"
+        "regularizer = 0.5 2 1\n"
+        "max_epochs = 3\n"
+        "[sweep random]\n"
+        "type = FiniteContrastEmbedding\n"
+        "dim = 3\n"
+        "sample_ratio = 2\n"
+        "regularizer = 0.5 4\n"
+        "samples = 4\n");
+    ExperimentConfig config;
+    assert(ReadExperimentConfig(file, &config));
+    assert(config.sweeps.size() == 2 && config.sweeps[0].params == std::vector<std::string>{"regularizer"});
+    assert(config.schedule == SCHEDULE_GREEDY);
+    std::istringstream fixed("[sweep s]\ntype = FiniteEmbedding\nregularizer = 1\n");
+    ExperimentConfig bad;
+    assert(!ReadExperimentConfig(fixed, &bad));
+
+    ExperimentData data;
+    MakeGraphLabel(&data.train, &data.train_label, &data.test_label);
+    data.test = data.train;
+    data.neg_train = data.neg_test = Graph(7);
+    SampleNegativeGraphUniform(data.train, &data.neg_train);
+    RemoveRedundant(data.train, &data.neg_train);
+    SampleNegativeGraphUniform(data.test, &data.neg_test);
+    RemoveRedundant(data.test, &data.neg_test);
+
+    // Two workers start cold; the third point starts from a finished one
+    std::vector<SweepResult> results;
+    RunSweep(config, data, config.sweeps[0], &results);
+    assert(results.size() == 3 && results[0].values[0] == 2 && results[2].values[0] == 0.5);
+    assert(results[0].warm_from == -1 && results[2].warm_from >= 0 && results[2].result.name == "regularizer=0.5");
+    for (const SweepResult& r : results)
+        assert(r.result.ok && r.result.epochs == 3 && r.best_average_precision >= r.result.average_precision);
+    std::ostringstream table;
+    WriteSweepCsv(config.sweeps[0], results, table);
+    assert(table.str().find("point,warm_from,regularizer,") == 0);
+    assert(GetNodeSchedule() == SCHEDULE_RANDOM);
+
+    RunSweep(config, data, config.sweeps[1], &results);
+    assert(results.size() == 4);
+    for (int i = 0; i < 4; ++i)
+        assert(results[i].result.ok && results[i].values[0] >= 0.5 && results[i].values[0] <= 4 &&
+               (i == 0 || results[i].values[0] <= results[i - 1].values[0]));
+}
+
 void EvaluateTest() {
     EvaluateF1Test();
     EvaluateF1LabelPropagationTest();
+    MultiLabelPropagationTest();
+    ExperimentTest();
+    SweepTest();
 }
\ No newline at end of file
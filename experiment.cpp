@@ -0,0 +1,647 @@
+#include "experiment.h"
+#include "utility.h"
+
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <cmath>
+#include <mutex>
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct ModelType {
+        const char* name;
+        bool directed, monitored;
+        const char* params;         // space separated
+        const char* warm_params;    // the parameters a warm start may change
+    };
+
+    const ModelType kTypes[] = {
+        {"FiniteEmbedding", false, true, "dim neg_penalty regularizer", "neg_penalty regularizer"},
+        {"FiniteSGD", false, true, "dim neg_penalty regularizer", ""},
+        {"FiniteContrastEmbedding", false, true, "dim sample_ratio regularizer", "regularizer"},
+        {"DirectedFiniteEmbedding", true, true, "dim neg_penalty regularizer", ""},
+        {"DirectedFiniteContrastEmbedding", true, true, "dim sample_ratio regularizer", ""},
+        {"KernelEmbedding", false, true, "neg_penalty regularizer", ""},
+        {"SparseEmbedding", false, true, "neg_penalty regularizer", ""},
+        {"SequentialFiniteEmbedding", false, false, "dim neg_penalty regularizer", ""},
+        {"CommonNeighbor", false, false, "normalizer", ""},
+        {"AdamicAdar", false, false, "", ""},
+        {"RandomizedSVD", false, false, "dim", ""},
+        {"Random", false, false, "", ""},
+    };
+
+    // Accepted by every trainer that takes a TrainingMonitor; validation_sample held-out training edges
+    // of each kind are scored after every epoch for the patience rule
+    const char* kStoppingParams = "max_epochs min_change patience seconds validation_sample";
+
+    const ModelType* FindType(const std::string& name) {
+        for (const ModelType& type : kTypes)
+            if (name == type.name) return &type;
+        return nullptr;
+    }
+
+    std::vector<std::string> Words(const std::string& text) {
+        std::vector<std::string> words;
+        std::istringstream is(text);
+        std::string word;
+        while (is >> word)
+            words.push_back(word);
+        return words;
+    }
+
+    std::string Trim(const std::string& text) {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) return "";
+        return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    bool IsNumber(const std::string& text) {
+        char* end;
+        strtod(text.c_str(), &end);
+        return !text.empty() && *end == '\0';
+    }
+
+    bool ParseBool(const std::string& text, bool* value) {
+        if (text == "true" || text == "yes" || text == "1") {
+            *value = true;
+            return true;
+        }
+        if (text == "false" || text == "no" || text == "0") {
+            *value = false;
+            return true;
+        }
+        return false;
+    }
+
+    bool Fail(int line, const std::string& message) {
+        std::cerr << "Experiment file line " << line << ": " << message << "\n";
+        return false;
+    }
+
+    bool SetData(const std::string& key, const std::string& value, ExperimentConfig* config) {
+        if (key == "node") config->node_file = value;
+        else if (key == "train") config->train_file = value;
+        else if (key == "test") config->test_file = value;
+        else if (key == "directed_train") config->directed_train_file = value;
+        else if (key == "directed_test") config->directed_test_file = value;
+        else if (key == "train_label") config->train_label_file = value;
+        else if (key == "test_label") config->test_label_file = value;
+        else if (key == "output") config->output = value;
+        else if (key == "reorder") return ParseBool(value, &config->reorder);
+        else if (key == "vec_normalize") return ParseBool(value, &config->vec_normalize);
+        else if (key == "schedule") {
+            if (value != "random" && value != "greedy") return false;
+            config->schedule = value == "greedy" ? SCHEDULE_GREEDY : SCHEDULE_RANDOM;
+        }
+        else if (!IsNumber(value)) return false;
+        else if (key == "threads") config->threads = atoi(value.c_str());
+        else if (key == "validation") config->validation = atof(value.c_str());
+        else if (key == "svm_regularizer") config->svm_regularizer = atof(value.c_str());
+        else if (key == "svm_sample_ratio") config->svm_sample_ratio = atoi(value.c_str());
+        else return false;
+        return true;
+    }
+
+    bool CheckModel(const ModelSpec& spec, std::string* error) {
+        const ModelType* type = FindType(spec.type);
+        if (type == nullptr) {
+            *error = "unknown model type " + spec.type;
+            return false;
+        }
+        std::vector<std::string> allowed = Words(type->params);
+        if (type->monitored) {
+            std::vector<std::string> stopping = Words(kStoppingParams);
+            allowed.insert(allowed.end(), stopping.begin(), stopping.end());
+        }
+        for (const auto& param : spec.params) {
+            if (std::find(allowed.begin(), allowed.end(), param.first) == allowed.end()) {
+                *error = spec.type + " has no parameter " + param.first;
+                return false;
+            }
+            if (!IsNumber(param.second)) {
+                *error = param.first + " is not a number";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hyperparameter defaults follow the YouTube setting of main.cpp
+    Model* Train(const ModelType& type, const ModelSpec& spec, const ExperimentData& data, TrainingMonitor* monitor,
+                 const ModelState* warm_start) {
+        std::string name = type.name;
+        int dim = (int)spec.Get("dim", 100);
+        if (name == "FiniteEmbedding")
+            return GetFiniteEmbedding(data.train, data.neg_train, dim, spec.Get("neg_penalty", 0.03), spec.Get("regularizer", 1),
+                                      monitor, warm_start);
+        if (name == "FiniteSGD")
+            return GetFiniteSGD(data.train, data.neg_train, dim, spec.Get("neg_penalty", 0.03), spec.Get("regularizer", 1), monitor);
+        if (name == "FiniteContrastEmbedding")
+            return GetFiniteContrastEmbedding(data.train, data.neg_train, (int)spec.Get("sample_ratio", 4), dim,
+                                              spec.Get("regularizer", 30), monitor, warm_start);
+        if (name == "DirectedFiniteEmbedding")
+            return GetDirectedFiniteEmbedding(data.d_train, data.d_neg_train, dim, spec.Get("neg_penalty", 0.03),
+                                              spec.Get("regularizer", 5), monitor);
+        if (name == "DirectedFiniteContrastEmbedding")
+            return GetDirectedFiniteContrastEmbedding(data.d_train, data.d_neg_train, (int)spec.Get("sample_ratio", 4), dim,
+                                                      spec.Get("regularizer", 50), monitor);
+        if (name == "KernelEmbedding")
+            return GetKernelEmbedding(data.train, data.neg_train, spec.Get("neg_penalty", 0.03), spec.Get("regularizer", 30), monitor);
+        if (name == "SparseEmbedding")
+            return GetSparseEmbedding(data.train, Graph(data.train.size), spec.Get("neg_penalty", 0.015),
+                                      spec.Get("regularizer", 15), monitor);
+        if (name == "SequentialFiniteEmbedding")
+            return GetSequentialFiniteEmbedding(data.train, data.neg_train, dim, spec.Get("neg_penalty", 0.1), spec.Get("regularizer", 2));
+        if (name == "CommonNeighbor") return GetCommonNeighbor(data.train, spec.Get("normalizer", 120));
+        if (name == "AdamicAdar") return GetAdamicAdar(data.train);
+        if (name == "RandomizedSVD") return GetRandomizedSVD(data.train, dim);
+        return GetRandom();
+    }
+
+    // Counts the epochs the stopping rule let the trainer run
+    class EpochCounter : public TrainingMonitor {
+      public:
+        int epochs;
+        EpochCounter() : epochs(0) {}
+        void OnEpoch(Model* model, const EpochStats& stats) { epochs = stats.epoch + 1; }
+    };
+
+    double Seconds(Clock::time_point begin) {
+        return std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+
+    // Keeps the trained state in state, when given and supported
+    void RunModel(const ExperimentConfig& config, const ExperimentData& data, const ModelSpec& spec,
+                  const ModelState* warm_start, ExperimentResult* r, ModelState* state) {
+        r->name = spec.name;
+        r->type = spec.type;
+        r->ok = false;
+        r->epochs = 0;
+        r->train_seconds = r->evaluate_seconds = 0;
+        r->average_precision = r->f1 = -1;
+        if (!CheckModel(spec, &r->error))
+            return;
+        const ModelType* type = FindType(spec.type);
+        if ((type->directed ? data.d_train.size : data.train.size) == 0) {
+            r->error = type->directed ? "no directed training graph" : "no training graph";
+            return;
+        }
+
+        EpochCounter monitor;
+        StoppingRule rule;
+        rule.max_epochs = (int)spec.Get("max_epochs", 0);
+        rule.min_change = spec.Get("min_change", 0);
+        rule.patience = (int)spec.Get("patience", 0);
+        rule.seconds = spec.Get("seconds", 0);
+        monitor.SetStoppingRule(rule);
+        int sample = (int)spec.Get("validation_sample", 0);
+        if (sample > 0 && type->directed && data.d_validation.size > 0)
+            monitor.SetValidation(data.d_validation, data.d_neg_validation, sample);
+        else if (sample > 0 && !type->directed && data.validation.size > 0)
+            monitor.SetValidation(data.validation, data.neg_validation, sample);
+
+        SeedThread(spec.seed);
+        Clock::time_point begin = Clock::now();
+        std::unique_ptr<Model> model(Train(*type, spec, data, type->monitored ? &monitor : nullptr, warm_start));
+        r->train_seconds = Seconds(begin);
+        r->epochs = monitor.epochs;
+        r->stop_reason = monitor.stop_reason();
+
+        begin = Clock::now();
+        if (type->directed && data.d_test.size > 0)
+            r->average_precision = EvaluateAveragePrecision(model.get(), data.d_test, data.d_neg_test);
+        else if (!type->directed && data.test.size > 0)
+            r->average_precision = EvaluateAveragePrecision(model.get(), data.test, data.neg_test);
+        if (data.train_label.size > 0 && data.test_label.size > 0 && model->GetEmbedding(0).size() > 0)
+            r->f1 = EvaluateF1(model.get(), data.train_label, data.test_label, config.svm_regularizer,
+                               config.svm_sample_ratio, config.vec_normalize);
+        r->evaluate_seconds = Seconds(begin);
+        r->ok = true;
+        if (state != nullptr && !model->GetState(state))
+            *state = ModelState();
+    }
+
+    bool SetSweep(const std::string& key, const std::string& value, SweepSpec* sweep) {
+        std::vector<std::string> words = Words(value);
+        if (key == "type") {
+            sweep->base.type = value;
+            return true;
+        }
+        if (key == "output") {
+            sweep->output = value;
+            return true;
+        }
+        if (key == "warm_start")
+            return ParseBool(value, &sweep->warm_start);
+        for (const std::string& word : words)
+            if (!IsNumber(word)) return false;
+        if (words.empty()) return false;
+        if (key == "samples")
+            sweep->samples = atoi(value.c_str());
+        else if (key == "seed")
+            sweep->seed = (unsigned)atol(value.c_str());
+        else if (words.size() == 1)
+            sweep->base.params[key] = value;
+        else {
+            std::vector<double> values;
+            for (const std::string& word : words) {
+                values.push_back(atof(word.c_str()));
+                if (values.back() <= 0) return false;
+            }
+            sweep->params.push_back(key);
+            sweep->values.push_back(values);
+        }
+        return true;
+    }
+
+    std::string FormatValue(double value) {
+        std::ostringstream os;
+        os << value;
+        return os.str();
+    }
+
+    std::vector<double> FirstPoint(const SweepSpec& sweep) {
+        std::vector<double> point;
+        for (const std::vector<double>& values : sweep.values)
+            point.push_back(values[0]);
+        return point;
+    }
+
+    ModelSpec PointSpec(const SweepSpec& sweep, const std::vector<double>& point) {
+        ModelSpec spec = sweep.base;
+        spec.name.clear();
+        for (int k = 0; k < (int)sweep.params.size(); ++k) {
+            spec.params[sweep.params[k]] = FormatValue(point[k]);
+            spec.name += (k > 0 ? " " : "") + sweep.params[k] + "=" + FormatValue(point[k]);
+        }
+        return spec;
+    }
+
+    // The grid, or samples points drawn log-uniformly from the range of each parameter
+    void SweepPoints(const SweepSpec& sweep, std::vector<std::vector<double>>* points) {
+        if (sweep.samples > 0) {
+            std::mt19937 sweep_gen(sweep.seed);
+            for (int i = 0; i < sweep.samples; ++i) {
+                std::vector<double> point;
+                for (const std::vector<double>& values : sweep.values) {
+                    double lo = *std::min_element(values.begin(), values.end());
+                    double hi = *std::max_element(values.begin(), values.end());
+                    std::uniform_real_distribution<double> dist(log(lo), log(hi));
+                    point.push_back(exp(dist(sweep_gen)));
+                }
+                points->push_back(point);
+            }
+        } else {
+            points->push_back(std::vector<double>());
+            for (const std::vector<double>& values : sweep.values) {
+                std::vector<std::vector<double>> grid;
+                for (const std::vector<double>& point : *points)
+                    for (double value : values) {
+                        grid.push_back(point);
+                        grid.back().push_back(value);
+                    }
+                points->swap(grid);
+            }
+        }
+        std::sort(points->begin(), points->end(), std::greater<std::vector<double>>());
+    }
+
+    bool CanWarmStart(const SweepSpec& sweep) {
+        const ModelType* type = FindType(sweep.base.type);
+        if (type == nullptr) return false;
+        std::vector<std::string> warm = Words(type->warm_params);
+        for (const std::string& param : sweep.params)
+            if (std::find(warm.begin(), warm.end(), param) == warm.end()) return false;
+        return sweep.warm_start && !warm.empty();
+    }
+
+    double LogDistance(const std::vector<double>& a, const std::vector<double>& b) {
+        double distance = 0;
+        for (int k = 0; k < (int)a.size(); ++k)
+            distance += (log(a[k]) - log(b[k])) * (log(a[k]) - log(b[k]));
+        return distance;
+    }
+
+    bool UsesValidation(const ExperimentConfig& config) {
+        for (const ModelSpec& spec : config.models)
+            if (spec.Get("validation_sample", 0) > 0) return true;
+        for (const SweepSpec& sweep : config.sweeps)
+            if (sweep.base.Get("validation_sample", 0) > 0) return true;
+        return false;
+    }
+
+    void WriteNumber(std::ostream& out, double value) {
+        if (value >= 0)
+            out << value;
+        else
+            out << "null";
+    }
+}   // anonymous namespace
+
+double ModelSpec::Get(const std::string& key, double fallback) const {
+    auto it = params.find(key);
+    return it == params.end() ? fallback : atof(it->second.c_str());
+}
+
+std::vector<std::string> ExperimentModels() {
+    std::vector<std::string> names;
+    for (const ModelType& type : kTypes)
+        names.push_back(type.name);
+    return names;
+}
+
+std::vector<std::string> ExperimentParams(const std::string& type) {
+    const ModelType* found = FindType(type);
+    if (found == nullptr) return std::vector<std::string>();
+    std::vector<std::string> params = Words(found->params);
+    if (found->monitored) {
+        std::vector<std::string> stopping = Words(kStoppingParams);
+        params.insert(params.end(), stopping.begin(), stopping.end());
+    }
+    params.push_back("seed");
+    return params;
+}
+
+bool ReadExperimentConfig(std::istream& in, ExperimentConfig* config) {
+    std::string line, section;
+    std::vector<int> model_line, sweep_line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+        if (line[0] == '[') {
+            if (line.back() != ']')
+                return Fail(number, "unterminated section header");
+            std::vector<std::string> header = Words(line.substr(1, line.size() - 2));
+            section = header.empty() ? "" : header[0];
+            if (section == "data" && header.size() == 1) continue;
+            if ((section != "model" && section != "sweep") || header.size() != 2)
+                return Fail(number, "expected [data], [model <name>] or [sweep <name>]");
+            if (section == "model") {
+                config->models.push_back(ModelSpec());
+                config->models.back().name = config->models.back().type = header[1];
+                model_line.push_back(number);
+            } else {
+                config->sweeps.push_back(SweepSpec());
+                config->sweeps.back().name = config->sweeps.back().base.name = config->sweeps.back().base.type = header[1];
+                sweep_line.push_back(number);
+            }
+            continue;
+        }
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            return Fail(number, "expected key = value");
+        std::string key = Trim(line.substr(0, eq)), value = Trim(line.substr(eq + 1));
+        if (section == "data") {
+            if (!SetData(key, value, config))
+                return Fail(number, "bad data setting " + key);
+        } else if (section == "model") {
+            if (key == "type")
+                config->models.back().type = value;
+            else if (key == "seed") {
+                if (!IsNumber(value))
+                    return Fail(number, "seed is not a number");
+                config->models.back().seed = (unsigned)atol(value.c_str());
+            } else
+                config->models.back().params[key] = value;
+        } else if (section == "sweep") {
+            if (!SetSweep(key, value, &config->sweeps.back()))
+                return Fail(number, "bad sweep setting " + key);
+        } else {
+            return Fail(number, "setting outside a section");
+        }
+    }
+    for (int i = 0; i < (int)config->models.size(); ++i) {
+        std::string error;
+        if (!CheckModel(config->models[i], &error))
+            return Fail(model_line[i], error);
+        for (int j = 0; j < i; ++j)
+            if (config->models[j].name == config->models[i].name)
+                return Fail(model_line[i], "duplicate model " + config->models[i].name);
+    }
+    for (int i = 0; i < (int)config->sweeps.size(); ++i) {
+        const SweepSpec& sweep = config->sweeps[i];
+        std::string error;
+        if (sweep.params.empty())
+            return Fail(sweep_line[i], "sweep " + sweep.name + " has no parameter with several values");
+        if (!CheckModel(PointSpec(sweep, FirstPoint(sweep)), &error))
+            return Fail(sweep_line[i], error);
+    }
+    return true;
+}
+
+bool ReadExperimentConfig(const std::string& file_name, ExperimentConfig* config) {
+    std::ifstream fin(file_name);
+    if (!fin) {
+        std::cerr << "Cannot open " << file_name << "\n";
+        return false;
+    }
+    return ReadExperimentConfig(fin, config);
+}
+
+void LoadExperimentData(const ExperimentConfig& config, ExperimentData* data) {
+    std::cerr << "Reading Dataset\n";
+    if (!config.train_file.empty())
+        ReadDataset(config.node_file, config.train_file, &data->train);
+    if (!config.test_file.empty())
+        ReadDataset(config.node_file, config.test_file, &data->test);
+    if (!config.directed_train_file.empty())
+        ReadDirectedDataset(config.node_file, config.directed_train_file, &data->d_train);
+    if (!config.directed_test_file.empty())
+        ReadDirectedDataset(config.node_file, config.directed_test_file, &data->d_test);
+    if (!config.train_label_file.empty())
+        ReadLabel(config.node_file, config.train_label_file, &data->train_label);
+    if (!config.test_label_file.empty())
+        ReadLabel(config.node_file, config.test_label_file, &data->test_label);
+
+    std::cerr << "Sampling Negative Dataset\n";
+    if (UsesValidation(config) && config.validation > 0) {
+        if (data->train.size > 0) {
+            SplitValidation(&data->train, config.validation, &data->validation);
+            data->neg_validation = Graph(data->validation.size);
+            SampleNegativeGraphUniform(data->validation, &data->neg_validation);
+            RemoveRedundant(data->train, &data->neg_validation);
+            RemoveRedundant(data->validation, &data->neg_validation);
+        }
+        if (data->d_train.size > 0) {
+            SplitValidation(&data->d_train, config.validation, &data->d_validation);
+            data->d_neg_validation = DGraph(data->d_validation.size);
+            SampleNegativeDGraphUniform(data->d_validation, &data->d_neg_validation);
+            RemoveRedundant(data->d_train, &data->d_neg_validation);
+            RemoveRedundant(data->d_validation, &data->d_neg_validation);
+        }
+    }
+    if (data->train.size > 0) {
+        data->neg_train = Graph(data->train.size);
+        SampleNegativeGraphUniform(data->train, &data->neg_train);
+        RemoveRedundant(data->train, &data->neg_train);
+    }
+    if (data->test.size > 0) {
+        data->neg_test = Graph(data->test.size);
+        SampleNegativeGraphUniform(data->test, &data->neg_test);
+        RemoveRedundant(data->train, &data->neg_test);
+        RemoveRedundant(data->test, &data->neg_test);
+        // Validation edges were split off the training graph but are still real edges
+        if (data->validation.size > 0)
+            RemoveRedundant(data->validation, &data->neg_test);
+    }
+    if (data->d_train.size > 0) {
+        data->d_neg_train = DGraph(data->d_train.size);
+        SampleNegativeDGraphUniform(data->d_train, &data->d_neg_train);
+        RemoveRedundant(data->d_train, &data->d_neg_train);
+    }
+    if (data->d_test.size > 0) {
+        data->d_neg_test = DGraph(data->d_test.size);
+        SampleNegativeDGraphUniform(data->d_test, &data->d_neg_test);
+        RemoveRedundant(data->d_train, &data->d_neg_test);
+        RemoveRedundant(data->d_test, &data->d_neg_test);
+        if (data->d_validation.size > 0)
+            RemoveRedundant(data->d_validation, &data->d_neg_test);
+    }
+
+    if (config.reorder && (data->train.size > 0 || data->d_train.size > 0)) {
+        std::cerr << "Reordering Nodes\n";
+        std::vector<int> perm;
+        if (data->train.size > 0)
+            ComputeNodeOrder(data->train, ORDER_RCM, &perm);
+        else
+            ComputeNodeOrder(data->d_train, ORDER_RCM, &perm);
+        PermuteGraph(perm, &data->train);
+        PermuteGraph(perm, &data->neg_train);
+        PermuteGraph(perm, &data->test);
+        PermuteGraph(perm, &data->neg_test);
+        PermuteGraph(perm, &data->d_train);
+        PermuteGraph(perm, &data->d_neg_train);
+        PermuteGraph(perm, &data->d_test);
+        PermuteGraph(perm, &data->d_neg_test);
+        PermuteGraph(perm, &data->validation);
+        PermuteGraph(perm, &data->neg_validation);
+        PermuteGraph(perm, &data->d_validation);
+        PermuteGraph(perm, &data->d_neg_validation);
+        PermuteLabel(perm, &data->train_label);
+        PermuteLabel(perm, &data->test_label);
+    }
+}
+
+void RunExperiment(const ExperimentConfig& config, const ExperimentData& data, std::vector<ExperimentResult>* results) {
+    int threads = GetThreadCount();
+    if (config.threads > 0)
+        SetThreadCount(config.threads);
+    NodeSchedule schedule = GetNodeSchedule();
+    SetNodeSchedule(config.schedule);
+    // Each model trains on one worker; the loops inside it share whatever threads the others leave
+    results->assign(config.models.size(), ExperimentResult());
+    ParallelFor(config.models.size(), [&](int i) {
+        RunModel(config, data, config.models[i], nullptr, &(*results)[i], nullptr);
+        const ExperimentResult& r = (*results)[i];
+        std::cerr << (r.ok ? "Finished " : "Failed ") + r.name + (r.ok ? "" : ": " + r.error) + "\n";
+    });
+    SetThreadCount(threads);
+    SetNodeSchedule(schedule);
+}
+
+void RunSweep(const ExperimentConfig& config, const ExperimentData& data, const SweepSpec& sweep,
+              std::vector<SweepResult>* results) {
+    std::vector<std::vector<double>> points;
+    SweepPoints(sweep, &points);
+    int threads = GetThreadCount();
+    if (config.threads > 0)
+        SetThreadCount(config.threads);
+    NodeSchedule schedule = GetNodeSchedule();
+    SetNodeSchedule(config.schedule);
+    bool warm_start = CanWarmStart(sweep);
+    // States of the most recently finished points, at most one per thread so that memory stays bounded
+    int kept_states = GetThreadCount();
+    std::vector<std::pair<int, std::shared_ptr<ModelState>>> states;
+    std::mutex lock;
+    Clock::time_point begin = Clock::now();
+    results->assign(points.size(), SweepResult());
+    ParallelFor(points.size(), [&](int i) {
+        SweepResult& r = (*results)[i];
+        r.values = points[i];
+        r.warm_from = -1;
+        std::shared_ptr<ModelState> warm;
+        if (warm_start) {
+            std::lock_guard<std::mutex> guard(lock);
+            for (const auto& state : states)
+                if (r.warm_from < 0 || LogDistance(points[state.first], points[i]) < LogDistance(points[r.warm_from], points[i])) {
+                    r.warm_from = state.first;
+                    warm = state.second;
+                }
+        }
+        std::shared_ptr<ModelState> state(new ModelState());
+        r.start_seconds = Seconds(begin);
+        RunModel(config, data, PointSpec(sweep, points[i]), warm.get(), &r.result, warm_start ? state.get() : nullptr);
+        r.finish_seconds = Seconds(begin);
+        std::cerr << sweep.name + " " + r.result.name + (r.result.ok ? "" : ": " + r.result.error) + "\n";
+        if (warm_start && !state->embedding.empty()) {
+            std::lock_guard<std::mutex> guard(lock);
+            states.push_back(std::make_pair(i, state));
+            if ((int)states.size() > kept_states)
+                states.erase(states.begin());
+        }
+    });
+    SetThreadCount(threads);
+    SetNodeSchedule(schedule);
+
+    std::vector<int> order(points.size());
+    for (int i = 0; i < (int)order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return (*results)[a].finish_seconds < (*results)[b].finish_seconds; });
+    double best = -1;
+    for (int i : order) {
+        best = std::max(best, (*results)[i].result.average_precision);
+        (*results)[i].best_average_precision = best;
+    }
+}
+
+void WriteExperimentCsv(const std::vector<ExperimentResult>& results, std::ostream& out) {
+    out << "name,type,ok,epochs,stop_reason,train_seconds,evaluate_seconds,average_precision,f1,error\n";
+    for (const ExperimentResult& r : results)
+        out << r.name << "," << r.type << "," << (r.ok ? 1 : 0) << "," << r.epochs << "," << r.stop_reason << ","
+            << r.train_seconds << "," << r.evaluate_seconds << "," << r.average_precision << "," << r.f1 << ","
+            << r.error << "\n";
+}
+
+void WriteExperimentJson(const std::vector<ExperimentResult>& results, std::ostream& out) {
+    out << "[\n";
+    for (int i = 0; i < (int)results.size(); ++i) {
+        const ExperimentResult& r = results[i];
+        out << "  {\"name\": \"" << r.name << "\", \"type\": \"" << r.type << "\", \"ok\": " << (r.ok ? "true" : "false")
+            << ", \"epochs\": " << r.epochs << ", \"stop_reason\": \"" << r.stop_reason << "\", \"train_seconds\": "
+            << r.train_seconds << ", \"evaluate_seconds\": " << r.evaluate_seconds << ", \"average_precision\": ";
+        WriteNumber(out, r.average_precision);
+        out << ", \"f1\": ";
+        WriteNumber(out, r.f1);
+        out << ", \"error\": \"" << r.error << "\"}" << (i + 1 < (int)results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+void WriteSweepCsv(const SweepSpec& sweep, const std::vector<SweepResult>& results, std::ostream& out) {
+    std::vector<int> order(results.size());
+    for (int i = 0; i < (int)order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return results[a].finish_seconds < results[b].finish_seconds; });
+    out << "point,warm_from";
+    for (const std::string& param : sweep.params)
+        out << "," << param;
+    out << ",start_seconds,finish_seconds,train_seconds,epochs,average_precision,f1,best_average_precision,ok\n";
+    for (int i : order) {
+        const SweepResult& r = results[i];
+        out << i << "," << r.warm_from;
+        for (double value : r.values)
+            out << "," << value;
+        out << "," << r.start_seconds << "," << r.finish_seconds << "," << r.result.train_seconds << "," << r.result.epochs
+            << "," << r.result.average_precision << "," << r.result.f1 << "," << r.best_average_precision << ","
+            << (r.result.ok ? 1 : 0) << "\n";
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "base.h"
+#include "utility.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <istream>
+#include <ostream>
+
+// One [model <name>] section of an experiment file. type defaults to the name, so that a section
+// header alone such as [model FiniteEmbedding] trains that model with its default parameters.
+struct ModelSpec {
+    std::string name, type;
+    std::map<std::string, std::string> params;
+    // The thread's generators are reseeded with it before training, so a model trains the same way
+    // alone or next to others; set by the seed key
+    unsigned seed;
+    double Get(const std::string& key, double fallback) const;
+    ModelSpec() : seed(1) {}
+};
+
+// An experiment file is an INI file: a [data] section naming the dataset, then one section per model.
+//
+//   [data]
+//   node = youtube-node.txt
+//   train = youtube-edge-undirected-train.txt
+//   test = youtube-edge-undirected-val.txt
+//   train_label = youtube-label-train.txt
+//   test_label = youtube-label-val.txt
+//   output = results.json
+//
+//   [model fe-reg1]
+//   type = FiniteEmbedding
+//   regularizer = 1
+//   seconds = 1200
+//
+// Models with validation_sample set score their stopping rule on a validation split of the training
+// edges (a fraction validation = 0.1 in [data]), held out before any model trains, never on the test
+// edges. Lines starting with # or ; are comments. ExperimentModels() lists the types, and
+// ExperimentParams(type) the keys a model section accepts.
+//
+// A [sweep <name>] section takes the keys of a model section, where a list of values sweeps that
+// parameter, together with samples, seed, warm_start and output:
+//
+//   [sweep fe-path]
+//   type = FiniteEmbedding
+//   regularizer = 0.3 1 3 10
+//   neg_penalty = 0.01 0.03 0.1
+//   max_epochs = 20
+//
+// trains the 12 points of the grid. With samples = n, n points are drawn log-uniformly between the
+// smallest and largest value of each swept parameter instead.
+struct SweepSpec {
+    std::string name;
+    ModelSpec base;                             // type and the parameters shared by every point
+    std::vector<std::string> params;            // swept parameters
+    std::vector<std::vector<double>> values;    // positive values of each swept parameter
+    int samples;                                // 0 for the full grid
+    unsigned seed;
+    // Points start from the state of the nearest finished point, in log-parameter distance. This applies
+    // to models with a GetState when only penalties and regularizers are swept.
+    bool warm_start;
+    std::string output;                         // .csv table, required by experiment_main
+    SweepSpec() : samples(0), seed(1), warm_start(true) {}
+};
+
+struct ExperimentConfig {
+    std::string node_file, train_file, test_file, directed_train_file, directed_test_file;
+    std::string train_label_file, test_label_file;
+    std::string output;         // .json or .csv report, required by experiment_main with [model] sections
+    bool reorder;
+    int threads;                // shared by all models; 0 keeps GetThreadCount()
+    double validation;          // fraction of the training edges held out for validation_sample
+    NodeSchedule schedule;      // "random" or "greedy" node order of the coordinate descent trainers
+    // Label prediction parameters, as in main.cpp
+    double svm_regularizer;
+    int svm_sample_ratio;
+    bool vec_normalize;
+    std::vector<ModelSpec> models;
+    std::vector<SweepSpec> sweeps;
+    ExperimentConfig() : reorder(false), threads(0), validation(0.1), schedule(SCHEDULE_RANDOM), svm_regularizer(1), svm_sample_ratio(5), vec_normalize(true) {}
+};
+
+// Graphs, negatives and labels shared read-only by every model of an experiment
+struct ExperimentData {
+    Graph train, neg_train, test, neg_test;
+    DGraph d_train, d_neg_train, d_test, d_neg_test;
+    Graph validation, neg_validation;           // empty unless some model sets validation_sample
+    DGraph d_validation, d_neg_validation;
+    Label train_label, test_label;
+};
+
+struct ExperimentResult {
+    std::string name, type;
+    bool ok;
+    std::string error;          // why the model was not trained when !ok
+    int epochs;                 // epochs run by the iterative trainers; 0 for the others
+    std::string stop_reason;    // see TrainingMonitor::stop_reason
+    double train_seconds, evaluate_seconds;
+    double average_precision;   // -1 without test edges
+    double f1;                  // -1 without labels or for models without embeddings
+};
+
+// One point of a sweep; times are wall-clock seconds since the sweep began
+struct SweepResult {
+    ExperimentResult result;        // result.name lists the swept values, e.g. "regularizer=3 neg_penalty=0.03"
+    std::vector<double> values;     // in the order of SweepSpec::params
+    int warm_from;                  // the point whose state it started from; -1 for a cold start
+    double start_seconds, finish_seconds;
+    double best_average_precision;  // best AP among the points finished by finish_seconds
+};
+
+std::vector<std::string> ExperimentModels();
+std::vector<std::string> ExperimentParams(const std::string& type);
+// Returns false and reports the first error to stderr on a malformed file
+bool ReadExperimentConfig(std::istream& in, ExperimentConfig* config);
+bool ReadExperimentConfig(const std::string& file_name, ExperimentConfig* config);
+// Reads the graphs and labels, holds out the validation edges, samples negatives and optionally reorders
+// the nodes, once for all models
+void LoadExperimentData(const ExperimentConfig& config, ExperimentData* data);
+// Trains and evaluates every model, running independent models concurrently; results follow config.models
+void RunExperiment(const ExperimentConfig& config, const ExperimentData& data, std::vector<ExperimentResult>* results);
+// Trains the points of a sweep concurrently with the threads setting of config. Points are handed out in
+// descending order of their swept values, so each regularization path runs from strong to weak
+// regularization; results follow that order.
+void RunSweep(const ExperimentConfig& config, const ExperimentData& data, const SweepSpec& sweep,
+              std::vector<SweepResult>* results);
+void WriteExperimentCsv(const std::vector<ExperimentResult>& results, std::ostream& out);
+void WriteExperimentJson(const std::vector<ExperimentResult>& results, std::ostream& out);
+// One row per point in order of finishing time, so that best_average_precision traces AP against time
+void WriteSweepCsv(const SweepSpec& sweep, const std::vector<SweepResult>& results, std::ostream& out);
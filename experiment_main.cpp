@@ -0,0 +1,44 @@
+#include "experiment.h"
+
+#include <fstream>
+#include <iostream>
+
+// Usage: experiment config.ini
+// Loads the dataset of the [data] section once, then trains and evaluates every [model] section and runs
+// every [sweep] section. The model report format follows the extension of the output setting. It and the
+// output of every sweep are required, since the dataset readers and evaluators log to stdout.
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: experiment config.ini\n";
+        return 1;
+    }
+    ExperimentConfig config;
+    if (!ReadExperimentConfig(argv[1], &config))
+        return 1;
+    if (!config.models.empty() && config.output.empty()) {
+        std::cerr << argv[1] << ": [data] needs an output file for the model report\n";
+        return 1;
+    }
+    for (const SweepSpec& sweep : config.sweeps)
+        if (sweep.output.empty()) {
+            std::cerr << argv[1] << ": sweep " << sweep.name << " needs an output file\n";
+            return 1;
+        }
+    ExperimentData data;
+    LoadExperimentData(config, &data);
+    std::vector<ExperimentResult> results;
+    if (!config.models.empty()) {
+        RunExperiment(config, data, &results);
+        std::ofstream fout(config.output);
+        if (config.output.size() > 5 && config.output.substr(config.output.size() - 5) == ".json")
+            WriteExperimentJson(results, fout);
+        else
+            WriteExperimentCsv(results, fout);
+    }
+    for (const SweepSpec& sweep : config.sweeps) {
+        std::vector<SweepResult> points;
+        RunSweep(config, data, sweep, &points);
+        std::ofstream fout(sweep.output);
+        WriteSweepCsv(sweep, points, fout);
+    }
+}
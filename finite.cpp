@@ -7,50 +7,72 @@
 #include <cmath>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 10
+// Greedy scheduling stops once no node's projected gradient exceeds this
+#define GREEDY_TOLERANCE 1e-3
 
+// GraphT is Graph or CSRGraph; only Neighbors() is used
+template <typename GraphT>
 class FiniteEmbedding : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double neg_penalty_, regularizer_;
-    std::vector<std::vector<double>> embedding;
+    std::vector<std::vector<real>> embedding;
     std::vector<double> sqr_norm;
     std::vector<std::vector<double>> coeff;
 
-    void UpdateEmbedding(const Graph& positive, const Graph& negative, int x);
+    void MakeProblem(const GraphT& positive, const GraphT& negative, int x, LinearSVMProblem* problem);
+    double UpdateEmbedding(const GraphT& positive, const GraphT& negative, int x);
+    void UpdateGreedy(const GraphT& positive, const GraphT& negative, int x, NodeWorklist* worklist);
   public:
-    FiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer);
+    FiniteEmbedding(const GraphT& graph, const GraphT& negative, int dimension, double neg_penalty, double regularizer,
+                    TrainingMonitor* monitor, const ModelState* warm_start);
     double Evaluate(int x, int y);
-    const std::vector<double>& GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return embedding[x]; }
+    bool GetState(ModelState* state);
 };
 
-void FiniteEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> penalty_coeff, margin, f_sqr_norm;
-    for (int i : positive.edge[x]) {
-        feature.push_back(embedding[i].data());
-        label.push_back(1);
-        penalty_coeff.push_back(1 / regularizer_);
-        margin.push_back(1);
-        f_sqr_norm.push_back(sqr_norm[i]);
-    }
-    for (int i : negative.edge[x]) {
-        feature.push_back(embedding[i].data());
-        label.push_back(-1);
-        penalty_coeff.push_back(neg_penalty_ / regularizer_);
-        margin.push_back(0);
-        f_sqr_norm.push_back(sqr_norm[i]);
-    }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &coeff[x], &embedding[x], dim_, false);
-    sqr_norm[x] = InnerProduct(embedding[x].data(), embedding[x].data(), dim_);
+template <typename GraphT>
+void FiniteEmbedding<GraphT>::MakeProblem(const GraphT& positive, const GraphT& negative, int x, LinearSVMProblem* problem) {
+    for (int i : positive.Neighbors(x))
+        problem->Add(embedding[i].data(), sqr_norm[i], 1, 1 / regularizer_, 1);
+    for (int i : negative.Neighbors(x))
+        problem->Add(embedding[i].data(), sqr_norm[i], -1, neg_penalty_ / regularizer_, 0);
+}
+
+template <typename GraphT>
+double FiniteEmbedding<GraphT>::UpdateEmbedding(const GraphT& positive, const GraphT& negative, int x) {
+    LinearSVMProblem problem;
+    MakeProblem(positive, negative, x, &problem);
+    double violation = LinearSVM(problem, &coeff[x], embedding[x].data(), *kernel_, dim_, false);
+    sqr_norm[x] = kernel_->inner_product(embedding[x].data(), embedding[x].data(), dim_);
+    return violation;
+}
+
+// The margins of a neighbor i move by at most |change of x| * |embedding i|, which is added to its priority
+template <typename GraphT>
+void FiniteEmbedding<GraphT>::UpdateGreedy(const GraphT& positive, const GraphT& negative, int x, NodeWorklist* worklist) {
+    std::vector<real> old = embedding[x];
+    worklist->Set(x, UpdateEmbedding(positive, negative, x));
+    double change = sqrt(SquaredDistance(old.data(), embedding[x].data(), dim_));
+    if (change == 0) return;
+    for (int i : positive.Neighbors(x))
+        worklist->Add(i, change * sqrt(sqr_norm[i]));
+    for (int i : negative.Neighbors(x))
+        worklist->Add(i, change * sqrt(sqr_norm[i]));
 }
 
-FiniteEmbedding::FiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) :
+template <typename GraphT>
+FiniteEmbedding<GraphT>::FiniteEmbedding(const GraphT& graph, const GraphT& negative, int dimension, double neg_penalty, double regularizer,
+    TrainingMonitor* monitor, const ModelState* warm_start) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     neg_penalty_(neg_penalty), 
     regularizer_(regularizer) {
     
@@ -61,29 +83,115 @@ FiniteEmbedding::FiniteEmbedding(const Graph& graph, const Graph& negative, int
     for (int i = 0; i < size_; ++i)
         for (int j = 0; j < dim_; ++j)
             embedding[i][j] = dist(gen);
+    if (warm_start != nullptr)
+        embedding = warm_start->embedding;
 
     sqr_norm.resize(size_);
     for (int i = 0; i < size_; ++i)
-        sqr_norm[i] = InnerProduct(embedding[i].data(), embedding[i].data(), dim_);
+        sqr_norm[i] = kernel_->inner_product(embedding[i].data(), embedding[i].data(), dim_);
 
     coeff.resize(size_);
     for (int i = 0; i < size_; ++i)
-        coeff[i].resize(graph.edge[i].size() + negative.edge[i].size());
+        coeff[i].resize(graph.Neighbors(i).size() + negative.Neighbors(i).size());
+    if (warm_start != nullptr) {
+        // Positive edges come first, with coefficients in [0, 1 / regularizer]; negative ones lie in
+        // [-neg_penalty / regularizer, 0]
+        coeff = warm_start->coeff;
+        for (int i = 0; i < size_; ++i) {
+            int positives = graph.Neighbors(i).size();
+            for (int k = 0; k < (int)coeff[i].size(); ++k)
+                if (k < positives)
+                    coeff[i][k] = std::min(std::max(coeff[i][k], 0.0), 1 / regularizer_);
+                else
+                    coeff[i][k] = std::max(std::min(coeff[i][k], 0.0), -neg_penalty_ / regularizer_);
+        }
+    }
 
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
+    std::vector<std::vector<real>> best;
+    std::vector<std::vector<double>> best_coeff;
+    std::vector<double> best_sqr_norm;
+    bool greedy = GetNodeSchedule() == SCHEDULE_GREEDY;
+    NodeWorklist worklist(greedy ? size_ : 0);
+    if (greedy) {
         RandomPermutation(&order);
         for (int j : order)
-            UpdateEmbedding(graph, negative, j);
+            worklist.Set(j, INFINITY);
+    }
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
+        int updates = 0;
+        if (greedy) {
+            // An epoch is size_ updates of the most violated nodes
+            for (int j; updates < size_ && (j = worklist.Pop(GREEDY_TOLERANCE)) >= 0; ++updates)
+                UpdateGreedy(graph, negative, j, &worklist);
+            if (updates == 0) {
+                if (monitor != nullptr)
+                    monitor->Converged();
+                break;
+            }
+        } else {
+            RandomPermutation(&order);
+            for (int j : order)
+                UpdateEmbedding(graph, negative, j);
+            updates = size_;
+        }
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, updates, [&](int x, NodeObjective* objective) {
+                LinearSVMProblem problem;
+                MakeProblem(graph, negative, x, &problem);
+                int active;
+                LinearSVMObjective(problem, coeff[x], embedding[x].data(), *kernel_, dim_, &objective->primal, &objective->dual, &active);
+                objective->active = active;
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_coeff = coeff;
+            best_sqr_norm = sqr_norm;
+        }
+    }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        coeff.swap(best_coeff);
+        sqr_norm.swap(best_sqr_norm);
     }
 }
 
-double FiniteEmbedding::Evaluate(int x, int y) {
-    return InnerProduct(embedding[x].data(), embedding[y].data(), dim_);
+template <typename GraphT>
+double FiniteEmbedding<GraphT>::Evaluate(int x, int y) {
+    return kernel_->inner_product(embedding[x].data(), embedding[y].data(), dim_);
+}
+
+template <typename GraphT>
+bool FiniteEmbedding<GraphT>::GetState(ModelState* state) {
+    state->embedding = embedding;
+    state->coeff = coeff;
+    state->seed = 0;
+    return true;
+}
+
+Model* GetFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor) {
+    return new FiniteEmbedding<Graph>(graph, negative, dimension, neg_penalty, regularizer, monitor, nullptr);
+}
+
+Model* GetFiniteEmbedding(const CSRGraph& graph, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor) {
+    return new FiniteEmbedding<CSRGraph>(graph, negative, dimension, neg_penalty, regularizer, monitor, nullptr);
+}
+
+Model* GetFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor, const ModelState* warm_start) {
+    return new FiniteEmbedding<Graph>(graph, negative, dimension, neg_penalty, regularizer, monitor, warm_start);
 }
 
 Model* GetFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) {
-    return new FiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer);
+    return GetFiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer, nullptr);
+}
+
+Model* GetFiniteEmbedding(const CSRGraph& graph, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer) {
+    return GetFiniteEmbedding(graph, negative, dimension, neg_penalty, regularizer, nullptr);
 }
\ No newline at end of file
@@ -7,10 +7,14 @@
 #include <cmath>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 10
+// Draws per contrast pair before an edge whose negatives all touch it gets fewer pairs
+#define PAIR_TRIES 100
+// Greedy scheduling stops once no node's projected gradient exceeds this
+#define GREEDY_TOLERANCE 1e-3
 
 struct ContrastEdgePair {
     int b, c, d, label;
@@ -23,36 +27,60 @@ typedef std::vector<std::vector<ContrastEdgePair>> ContrastEdgeAdjacencyList;
 
 class FiniteContrastEmbedding : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double regularizer_;
-    std::vector<std::vector<double>> embedding;
+    unsigned seed_;
+    std::vector<std::vector<real>> embedding;
     std::vector<std::vector<double>> coeff;
     std::vector<double> sqr_norm;
 
-    void UpdateEmbedding(const ContrastEdgeAdjacencyList& table, int x);
+    void MakeProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem);
+    double UpdateEmbedding(const ContrastEdgeAdjacencyList& table, int x);
+    void UpdateGreedy(const ContrastEdgeAdjacencyList& table, int x, NodeWorklist* worklist);
 public:
-    FiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer);
+    FiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+                            TrainingMonitor* monitor, const ModelState* warm_start);
     double Evaluate(int x, int y);
-    const std::vector<double>& GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return embedding[x]; }
+    bool GetState(ModelState* state);
 };
 
-void FiniteContrastEmbedding::UpdateEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
-    std::vector<const double*> feature;
-    std::vector<int> label;
-    std::vector<double> margin, penalty_coeff, f_sqr_norm;
+void FiniteContrastEmbedding::MakeProblem(const ContrastEdgeAdjacencyList& table, int x, LinearSVMProblem* problem) {
+    for (const ContrastEdgePair& pair : table[x])
+        problem->Add(embedding[pair.b].data(), sqr_norm[pair.b], pair.label, 1 / regularizer_,
+                     1 + pair.label * kernel_->inner_product(embedding[pair.c].data(), embedding[pair.d].data(), dim_));
+}
+
+double FiniteContrastEmbedding::UpdateEmbedding(const ContrastEdgeAdjacencyList& table, int x) {
+    LinearSVMProblem problem;
+    MakeProblem(table, x, &problem);
+    double violation = LinearSVM(problem, &coeff[x], embedding[x].data(), *kernel_, dim_, false);
+    sqr_norm[x] = kernel_->inner_product(embedding[x].data(), embedding[x].data(), dim_);
+    return violation;
+}
+
+// Each pair (b, c, d) of x is also a pair of b, with x as the partner, and of c and d, with <x, b> in the
+// margin, so their margins move by at most |change of x| * |embedding b|
+void FiniteContrastEmbedding::UpdateGreedy(const ContrastEdgeAdjacencyList& table, int x, NodeWorklist* worklist) {
+    std::vector<real> old = embedding[x];
+    worklist->Set(x, UpdateEmbedding(table, x));
+    double change = sqrt(SquaredDistance(old.data(), embedding[x].data(), dim_));
+    if (change == 0) return;
     for (const ContrastEdgePair& pair : table[x]) {
-        feature.push_back(embedding[pair.b].data());
-        label.push_back(pair.label);
-        margin.push_back(1 + pair.label * InnerProduct(embedding[pair.c].data(), embedding[pair.d].data(), dim_));
-        penalty_coeff.push_back(1 / regularizer_);
-        f_sqr_norm.push_back(sqr_norm[pair.b]);
+        double delta = change * sqrt(sqr_norm[pair.b]);
+        worklist->Add(pair.b, delta);
+        worklist->Add(pair.c, delta);
+        worklist->Add(pair.d, delta);
     }
-    LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &coeff[x], &embedding[x], dim_, false);
-    sqr_norm[x] = InnerProduct(embedding[x].data(), embedding[x].data(), dim_);
 }
 
-FiniteContrastEmbedding::FiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer) :
+FiniteContrastEmbedding::FiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+    TrainingMonitor* monitor, const ModelState* warm_start) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     regularizer_(regularizer) {
 
     std::uniform_real_distribution<double> dist_d(-1, 1);
@@ -62,8 +90,12 @@ FiniteContrastEmbedding::FiniteContrastEmbedding(const Graph& graph, const Graph
     for (int i = 0; i < size_; ++i)
         for (int j = 0; j < dim_; ++j)
             embedding[i][j] = dist_d(gen);
+    if (warm_start != nullptr)
+        embedding = warm_start->embedding;
 
-    // Construct Contrast Pair Adjacency List
+    // Construct Contrast Pair Adjacency List; a warm start draws the same pairs as the model it starts from
+    seed_ = warm_start != nullptr ? warm_start->seed : (unsigned)gen();
+    std::mt19937 table_gen(seed_);
     ContrastEdgeAdjacencyList table(size_);
     std::vector<std::pair<int, int>> edge_list;
     for (int x = 0; x < size_; ++x)
@@ -72,9 +104,9 @@ FiniteContrastEmbedding::FiniteContrastEmbedding(const Graph& graph, const Graph
     std::uniform_int_distribution<int> dist_i(0, edge_list.size() - 1);
     for (int a = 0; a < size_; ++a)
         for (int b : graph.edge[a]) {
-            int cnt = 0;
-            while (1) {
-                int i = dist_i(gen);
+            int cnt = 0, tries = 0;
+            while (tries++ < PAIR_TRIES * sample_ratio) {
+                int i = dist_i(table_gen);
                 int c = edge_list[i].first, d = edge_list[i].second;
                 if (a == c || a == d || b == c || b == d) continue;
                 table[a].push_back(ContrastEdgePair(b, c, d, 1));
@@ -88,26 +120,92 @@ FiniteContrastEmbedding::FiniteContrastEmbedding(const Graph& graph, const Graph
 
     sqr_norm.resize(size_);
     for (int i = 0; i < size_; ++i)
-        sqr_norm[i] = InnerProduct(embedding[i].data(), embedding[i].data(), dim_);
+        sqr_norm[i] = kernel_->inner_product(embedding[i].data(), embedding[i].data(), dim_);
 
     coeff.resize(size_);
     for (int i = 0; i < size_; ++i)
         coeff[i].resize(table[i].size());
+    if (warm_start != nullptr) {
+        coeff = warm_start->coeff;
+        for (int i = 0; i < size_; ++i)
+            for (int k = 0; k < (int)coeff[i].size(); ++k)
+                coeff[i][k] = table[i][k].label * std::min(std::max(table[i][k].label * coeff[i][k], 0.0), 1 / regularizer_);
+    }
 
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
+    std::vector<std::vector<real>> best;
+    std::vector<std::vector<double>> best_coeff;
+    std::vector<double> best_sqr_norm;
+    bool greedy = GetNodeSchedule() == SCHEDULE_GREEDY;
+    NodeWorklist worklist(greedy ? size_ : 0);
+    if (greedy) {
         RandomPermutation(&order);
         for (int j : order)
-            UpdateEmbedding(table, j);
+            worklist.Set(j, INFINITY);
+    }
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
+        int updates = 0;
+        if (greedy) {
+            // An epoch is size_ updates of the most violated nodes
+            for (int j; updates < size_ && (j = worklist.Pop(GREEDY_TOLERANCE)) >= 0; ++updates)
+                UpdateGreedy(table, j, &worklist);
+            if (updates == 0) {
+                if (monitor != nullptr)
+                    monitor->Converged();
+                break;
+            }
+        } else {
+            RandomPermutation(&order);
+            for (int j : order)
+                UpdateEmbedding(table, j);
+            updates = size_;
+        }
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, updates, [&](int x, NodeObjective* objective) {
+                LinearSVMProblem problem;
+                MakeProblem(table, x, &problem);
+                int active;
+                LinearSVMObjective(problem, coeff[x], embedding[x].data(), *kernel_, dim_, &objective->primal, &objective->dual, &active);
+                objective->active = active;
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_coeff = coeff;
+            best_sqr_norm = sqr_norm;
+        }
+    }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        coeff.swap(best_coeff);
+        sqr_norm.swap(best_sqr_norm);
     }
 }
 
 double FiniteContrastEmbedding::Evaluate(int x, int y) {
-    return InnerProduct(embedding[x].data(), embedding[y].data(), dim_);
+    return kernel_->inner_product(embedding[x].data(), embedding[y].data(), dim_);
+}
+
+bool FiniteContrastEmbedding::GetState(ModelState* state) {
+    state->embedding = embedding;
+    state->coeff = coeff;
+    state->seed = seed_;
+    return true;
+}
+
+Model* GetFiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+                                  TrainingMonitor* monitor) {
+    return new FiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer, monitor, nullptr);
+}
+
+Model* GetFiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer,
+                                  TrainingMonitor* monitor, const ModelState* warm_start) {
+    return new FiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer, monitor, warm_start);
 }
 
 Model* GetFiniteContrastEmbedding(const Graph& graph, const Graph& negative, int sample_ratio, int dimension, double regularizer) {
-    return new FiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer);
+    return GetFiniteContrastEmbedding(graph, negative, sample_ratio, dimension, regularizer, nullptr);
 }
\ No newline at end of file
@@ -6,47 +6,68 @@
 #include <cmath>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 100
 
+// GraphT is Graph or CSRGraph; only Neighbors() is used
+template <typename GraphT>
 class FiniteSGD : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double neg_penalty_, regularizer_;
-    std::vector<std::vector<double>> embedding;
+    std::vector<std::vector<real>> embedding;
     std::vector<double> sqr_norm;
 
-    void UpdateEmbedding(const Graph& positive, const Graph& negative, int x, double learn_rate);
+    void UpdateEmbedding(const GraphT& positive, const GraphT& negative, int x, double learn_rate);
+    double Objective(const GraphT& positive, const GraphT& negative, int x);
   public:
-    FiniteSGD(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer);
+    FiniteSGD(const GraphT& graph, const GraphT& negative, int dimension, double neg_penalty, double regularizer,
+              TrainingMonitor* monitor);
     double Evaluate(int x, int y);
-    const std::vector<double>& GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return embedding[x]; }
 };
 
-void FiniteSGD::UpdateEmbedding(const Graph& positive, const Graph& negative, int x, double learn_rate) {
-    double *vx = embedding[x].data();
-    for (int i : positive.edge[x]) {
-        const double* feature = embedding[i].data();
-        double ip = InnerProduct(vx, feature, dim_);
+template <typename GraphT>
+void FiniteSGD<GraphT>::UpdateEmbedding(const GraphT& positive, const GraphT& negative, int x, double learn_rate) {
+    real *vx = embedding[x].data();
+    for (int i : positive.Neighbors(x)) {
+        const real* feature = embedding[i].data();
+        double ip = kernel_->inner_product(vx, feature, dim_);
         double coeff = -sigmoid(-ip);
-        for (int j = 0; j < dim_; ++j)
-            vx[j] -= learn_rate * coeff * feature[j];
+        kernel_->axpy(-learn_rate * coeff, feature, vx, dim_);
     }
-    for (int i : negative.edge[x]) {
-        const double* feature = embedding[i].data();
-        double ip = InnerProduct(vx, feature, dim_);
+    for (int i : negative.Neighbors(x)) {
+        const real* feature = embedding[i].data();
+        double ip = kernel_->inner_product(vx, feature, dim_);
         double coeff = sigmoid(ip);
-        for (int j = 0; j < dim_; ++j)
-            vx[j] -= learn_rate * coeff * feature[j];
+        kernel_->axpy(-learn_rate * coeff, feature, vx, dim_);
     }
     for (int j = 0; j < dim_; ++j)
         vx[j] -= 2 * regularizer_ * learn_rate * vx[j];
 }
 
-FiniteSGD::FiniteSGD(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) :
+// Logistic loss of the edges at x plus the regularizer, the function UpdateEmbedding descends
+template <typename GraphT>
+double FiniteSGD<GraphT>::Objective(const GraphT& positive, const GraphT& negative, int x) {
+    const real* vx = embedding[x].data();
+    double loss = 0;
+    for (int i : positive.Neighbors(x))
+        loss += softplus(-kernel_->inner_product(vx, embedding[i].data(), dim_));
+    for (int i : negative.Neighbors(x))
+        loss += softplus(kernel_->inner_product(vx, embedding[i].data(), dim_));
+    return loss + regularizer_ * kernel_->inner_product(vx, vx, dim_);
+}
+
+template <typename GraphT>
+FiniteSGD<GraphT>::FiniteSGD(const GraphT& graph, const GraphT& negative, int dimension, double neg_penalty, double regularizer,
+    TrainingMonitor* monitor) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     neg_penalty_(neg_penalty), 
     regularizer_(regularizer) {
     
@@ -60,23 +81,55 @@ FiniteSGD::FiniteSGD(const Graph& graph, const Graph& negative, int dimension, d
 
     sqr_norm.resize(size_);
     for (int i = 0; i < size_; ++i)
-        sqr_norm[i] = InnerProduct(embedding[i].data(), embedding[i].data(), dim_);
+        sqr_norm[i] = kernel_->inner_product(embedding[i].data(), embedding[i].data(), dim_);
 
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
+    std::vector<std::vector<real>> best;
+    std::vector<double> best_sqr_norm;
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
         double learn_rate = 1 / sqrt(i + 10);
         RandomPermutation(&order);
         for (int j : order)
             UpdateEmbedding(graph, negative, j, learn_rate);
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, size_, [&](int x, NodeObjective* objective) {
+                objective->primal = Objective(graph, negative, x);
+                objective->dual = NAN;
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_sqr_norm = sqr_norm;
+        }
+    }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        sqr_norm.swap(best_sqr_norm);
     }
 }
 
-double FiniteSGD::Evaluate(int x, int y) {
-    return InnerProduct(embedding[x].data(), embedding[y].data(), dim_);
+template <typename GraphT>
+double FiniteSGD<GraphT>::Evaluate(int x, int y) {
+    return kernel_->inner_product(embedding[x].data(), embedding[y].data(), dim_);
+}
+
+Model* GetFiniteSGD(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer,
+                    TrainingMonitor* monitor) {
+    return new FiniteSGD<Graph>(graph, negative, dimension, neg_penalty, regularizer, monitor);
+}
+
+Model* GetFiniteSGD(const CSRGraph& graph, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer,
+                    TrainingMonitor* monitor) {
+    return new FiniteSGD<CSRGraph>(graph, negative, dimension, neg_penalty, regularizer, monitor);
 }
 
 Model* GetFiniteSGD(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) {
-    return new FiniteSGD(graph, negative, dimension, neg_penalty, regularizer);
+    return GetFiniteSGD(graph, negative, dimension, neg_penalty, regularizer, nullptr);
+}
+
+Model* GetFiniteSGD(const CSRGraph& graph, const CSRGraph& negative, int dimension, double neg_penalty, double regularizer) {
+    return GetFiniteSGD(graph, negative, dimension, neg_penalty, regularizer, nullptr);
 }
\ No newline at end of file
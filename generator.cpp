@@ -0,0 +1,217 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <algorithm>
+
+#define EDGE_BLOCK (1 << 16)
+
+namespace {
+    // splitmix64 finalizer
+    unsigned long long Mix(unsigned long long z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Counter-based random stream: every edge (or node) draws from its own stream keyed by its index,
+    // so the result does not depend on how the blocks are handed out to threads
+    class Stream {
+        unsigned long long state_;
+      public:
+        Stream(unsigned long long seed, long long index) : state_(Mix(seed ^ Mix(index))) {}
+        unsigned long long Next() { return Mix(state_ += 0x9e3779b97f4a7c15ULL); }
+        double Uniform() { return (Next() >> 11) * (1.0 / (1ULL << 53)); }
+        long long Below(long long n) { return (long long)(Next() % (unsigned long long)n); }
+    };
+
+    // Independent seeds for the edge, label and permutation streams
+    unsigned long long EdgeSeed(const SyntheticGraphConfig& config) { return Mix(config.seed); }
+    unsigned long long LabelSeed(const SyntheticGraphConfig& config) { return Mix(config.seed + 1); }
+    unsigned long long PermutationSeed(const SyntheticGraphConfig& config) { return Mix(config.seed + 2); }
+
+    int Scale(int size) {
+        int scale = 0;
+        while ((1LL << scale) < size)
+            ++scale;
+        return scale;
+    }
+
+    long long LinksPerNode(const SyntheticGraphConfig& config) {
+        return std::max(1LL, config.edges / config.size);
+    }
+
+    long long EdgeCount(const SyntheticGraphConfig& config) {
+        if (config.model == SYNTHETIC_BA)
+            return LinksPerNode(config) * (config.size - 1);
+        return config.edges;
+    }
+
+    void RMATEdge(const SyntheticGraphConfig& config, int scale, Stream* stream, int* x, int* y) {
+        do {
+            long long u = 0, v = 0;
+            for (int level = 0; level < scale; ++level) {
+                double r = stream->Uniform();
+                u <<= 1;
+                v <<= 1;
+                if (r < config.a) {
+                } else if (r < config.a + config.b) {
+                    v |= 1;
+                } else if (r < config.a + config.b + config.c) {
+                    u |= 1;
+                } else {
+                    u |= 1;
+                    v |= 1;
+                }
+            }
+            *x = (int)u;
+            *y = (int)v;
+        } while (*x >= config.size || *y >= config.size || *x == *y);
+    }
+
+    // Consecutive blocks of ids; for R-MAT these follow the top levels of the recursion
+    int BlockCommunity(const SyntheticGraphConfig& config, int x) {
+        return (int)((long long)x * config.communities / config.size);
+    }
+
+    void SBMEdge(const SyntheticGraphConfig& config, Stream* stream, int* x, int* y) {
+        do {
+            *x = (int)stream->Below(config.size);
+            long long k = BlockCommunity(config, *x);
+            long long lo = (k * config.size + config.communities - 1) / config.communities;
+            long long hi = ((k + 1) * config.size + config.communities - 1) / config.communities;
+            if (stream->Uniform() < config.intra_fraction && hi - lo >= 2)
+                *y = (int)(lo + stream->Below(hi - lo));
+            else
+                *y = (int)stream->Below(config.size);
+        } while (*x == *y);
+    }
+
+    // Batagelj & Brandes / Sanders & Schulz: edge i links node i / m + 1 to an endpoint drawn uniformly
+    // from the edges of all earlier nodes, which picks a node with probability proportional to its
+    // degree. Landing on a source names that node; landing on a target defers to the earlier edge, so
+    // each edge is resolved on its own without reading the others.
+    int BATarget(unsigned long long seed, long long m, long long i) {
+        while (true) {
+            long long first = i / m * m;
+            if (first == 0) return 0;
+            long long r = Stream(seed, i).Below(2 * first);
+            if (r % 2 == 0) return (int)(r / 2 / m + 1);
+            i = r / 2;
+        }
+    }
+
+    void RandomPermutation(const SyntheticGraphConfig& config, std::vector<int>* perm) {
+        perm->resize(config.size);
+        for (int x = 0; x < config.size; ++x)
+            (*perm)[x] = x;
+        Stream stream(PermutationSeed(config), 0);
+        for (int x = config.size - 1; x > 0; --x)
+            std::swap((*perm)[x], (*perm)[stream.Below(x + 1)]);
+    }
+
+    // Calls emit(i, x, y) for every generated edge i, in parallel, with x the newer node for BA
+    template <typename Emit>
+    void GenerateEdges(const SyntheticGraphConfig& config, const std::vector<int>& perm, Emit emit) {
+        long long count = EdgeCount(config);
+        int scale = Scale(config.size);
+        long long m = LinksPerNode(config);
+        unsigned long long seed = EdgeSeed(config);
+        ParallelFor((int)((count + EDGE_BLOCK - 1) / EDGE_BLOCK), [&](int block) {
+            long long end = std::min(count, (long long)(block + 1) * EDGE_BLOCK);
+            for (long long i = (long long)block * EDGE_BLOCK; i < end; ++i) {
+                int x, y;
+                if (config.model == SYNTHETIC_BA) {
+                    x = (int)(i / m + 1);
+                    y = BATarget(seed, m, i);
+                } else {
+                    Stream stream(seed, i);
+                    if (config.model == SYNTHETIC_RMAT)
+                        RMATEdge(config, scale, &stream, &x, &y);
+                    else
+                        SBMEdge(config, &stream, &x, &y);
+                }
+                emit(i, perm[x], perm[y]);
+            }
+        });
+    }
+
+    void PlantLabels(const SyntheticGraphConfig& config, const std::vector<int>& perm, Label* label) {
+        if (label == nullptr) return;
+        std::vector<int> community(config.size);
+        if (config.model != SYNTHETIC_BA) {
+            for (int x = 0; x < config.size; ++x)
+                community[x] = BlockCommunity(config, x);
+        } else {
+            // Labels spread along the first link of each node, which always points to an older node
+            long long m = LinksPerNode(config);
+            for (int x = 0; x < config.size; ++x) {
+                Stream stream(LabelSeed(config), x);
+                if (x < config.communities)
+                    community[x] = x;
+                else if (stream.Uniform() < config.intra_fraction)
+                    community[x] = community[BATarget(EdgeSeed(config), m, (x - 1) * m)];
+                else
+                    community[x] = (int)stream.Below(config.communities);
+            }
+        }
+        std::vector<int> node(config.size);
+        for (int x = 0; x < config.size; ++x)
+            node[perm[x]] = x;
+        *label = Label(config.size);
+        for (int x = 0; x < config.size; ++x)
+            label->SetLabel(x, community[node[x]]);
+    }
+
+    void CopyAdjacency(const CSRGraph& csr, std::vector<std::vector<int>>* edge) {
+        edge->assign(csr.size, std::vector<int>());
+        ParallelFor(csr.size, [&](int x) {
+            NeighborRange range = csr.Neighbors(x);
+            (*edge)[x].assign(range.begin(), range.end());
+        });
+    }
+}   // anonymous namespace
+
+void GenerateGraph(const SyntheticGraphConfig& config, CSRGraph* graph, Label* label) {
+    std::vector<int> perm;
+    RandomPermutation(config, &perm);
+    CSRGraphBuilder builder(config.size);
+    builder.Resize(2 * EdgeCount(config));
+    GenerateEdges(config, perm, [&](long long i, int x, int y) {
+        builder.SetArc(2 * i, x, y);
+        builder.SetArc(2 * i + 1, y, x);
+    });
+    builder.Build(graph, true);
+    PlantLabels(config, perm, label);
+}
+
+void GenerateGraph(const SyntheticGraphConfig& config, CSRDGraph* graph, Label* label) {
+    std::vector<int> perm;
+    RandomPermutation(config, &perm);
+    CSRGraphBuilder out(config.size), in(config.size);
+    out.Resize(EdgeCount(config));
+    in.Resize(EdgeCount(config));
+    GenerateEdges(config, perm, [&](long long i, int x, int y) {
+        out.SetArc(i, x, y);
+        in.SetArc(i, y, x);
+    });
+    graph->size = config.size;
+    out.Build(&graph->out_edge, true);
+    in.Build(&graph->in_edge, true);
+    PlantLabels(config, perm, label);
+}
+
+void GenerateGraph(const SyntheticGraphConfig& config, Graph* graph, Label* label) {
+    CSRGraph csr;
+    GenerateGraph(config, &csr, label);
+    graph->size = csr.size;
+    CopyAdjacency(csr, &graph->edge);
+}
+
+void GenerateGraph(const SyntheticGraphConfig& config, DGraph* graph, Label* label) {
+    CSRDGraph csr;
+    GenerateGraph(config, &csr, label);
+    graph->size = csr.size;
+    CopyAdjacency(csr.out_edge, &graph->out_edge);
+    CopyAdjacency(csr.in_edge, &graph->in_edge);
+}
@@ -3,46 +3,56 @@
 #include "svm.h"
 #include <vector>
 #include <algorithm>
-#include <iostream>
 
 #define EPOCHS 5
 
+// Subproblem of one node: its neighbors and the kernel among them
+struct KernelProblem {
+    std::vector<int> instance, label;
+    std::vector<double> penalty_coeff, margin;
+    std::vector<std::vector<double>> local;
+};
+
 class KernelEmbedding : public Model {
     int size_;
     const double neg_penalty_, regularizer_;
     std::vector<std::vector<double>> kernel;
     std::vector<std::vector<double>> coeff;
 
+    void MakeProblem(const Graph& positive, const Graph& negative, int x, KernelProblem* problem);
     void UpdateEmbedding(const Graph& positive, const Graph& negative, int x);
 public:
-    KernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer);
+    KernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer, TrainingMonitor* monitor);
     double Evaluate(int x, int y);
 };
 
-void KernelEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
-    std::vector<std::vector<double>> local;
-    std::vector<int> label, instance;
-    std::vector<double> penalty_coeff, margin;
+void KernelEmbedding::MakeProblem(const Graph& positive, const Graph& negative, int x, KernelProblem* problem) {
     for (int i : positive.edge[x]) {
-        instance.push_back(i);
-        label.push_back(1);
-        penalty_coeff.push_back(1 / regularizer_);
-        margin.push_back(1);
+        problem->instance.push_back(i);
+        problem->label.push_back(1);
+        problem->penalty_coeff.push_back(1 / regularizer_);
+        problem->margin.push_back(1);
     }
     for (int i : negative.edge[x]) {
-        instance.push_back(i);
-        label.push_back(-1);
-        penalty_coeff.push_back(neg_penalty_ / regularizer_);
-        margin.push_back(0);
+        problem->instance.push_back(i);
+        problem->label.push_back(-1);
+        problem->penalty_coeff.push_back(neg_penalty_ / regularizer_);
+        problem->margin.push_back(0);
     }
-    local.resize(instance.size());
+    const std::vector<int>& instance = problem->instance;
+    problem->local.resize(instance.size());
     for (int i = 0; i < (int)instance.size(); ++i) {
-        local[i].resize(instance.size());
+        problem->local[i].resize(instance.size());
         for (int j = 0; j < (int)instance.size(); ++j)
-            local[i][j] = kernel[instance[i]][instance[j]];
+            problem->local[i][j] = kernel[instance[i]][instance[j]];
     }
+}
 
-    KernelSVM(local, label, penalty_coeff, margin, &coeff[x], false);
+void KernelEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
+    KernelProblem problem;
+    MakeProblem(positive, negative, x, &problem);
+    const std::vector<int>& instance = problem.instance;
+    KernelSVM(problem.local, problem.label, problem.penalty_coeff, problem.margin, &coeff[x], false);
     for (int i = 0; i < size_; ++i)
         if (i != x) {
             double val = 0;
@@ -56,7 +66,8 @@ void KernelEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negati
     kernel[x][x] = val;
 }
 
-KernelEmbedding::KernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer) :
+KernelEmbedding::KernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer,
+    TrainingMonitor* monitor) :
     size_(graph.size),
     neg_penalty_(neg_penalty),
     regularizer_(regularizer) {
@@ -76,22 +87,43 @@ KernelEmbedding::KernelEmbedding(const Graph& graph, const Graph& negative, doub
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
-        int cnt = 0;
-        std::cout << "epoch " << i << "\n";
+    std::vector<std::vector<double>> best;
+    std::vector<std::vector<double>> best_coeff;
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
         RandomPermutation(&order);
-        for (int j : order) {
+        for (int j : order)
             UpdateEmbedding(graph, negative, j);
-            if (++cnt % 100 == 0)
-                std::cout << "executed " << cnt << "\n";
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, size_, [&](int x, NodeObjective* objective) {
+                KernelProblem problem;
+                MakeProblem(graph, negative, x, &problem);
+                int active;
+                KernelSVMObjective(problem.local, problem.label, problem.penalty_coeff, problem.margin, coeff[x],
+                                   &objective->primal, &objective->dual, &active);
+                objective->active = active;
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = kernel;
+            best_coeff = coeff;
         }
     }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        kernel.swap(best);
+        coeff.swap(best_coeff);
+    }
 }
 
 double KernelEmbedding::Evaluate(int x, int y) {
     return kernel[x][y];
 }
 
+Model* GetKernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor) {
+    return new KernelEmbedding(graph, negative, neg_penalty, regularizer, monitor);
+}
+
 Model* GetKernelEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer) {
-    return new KernelEmbedding(graph, negative, neg_penalty, regularizer);
+    return GetKernelEmbedding(graph, negative, neg_penalty, regularizer, nullptr);
 }
\ No newline at end of file
@@ -2,16 +2,21 @@
 #include "utility.h"
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
     
 #define EPOCHS 100
+// A few Jacobi sweeps already settle the argmax label of most nodes; the scores need not converge
+#define MAX_SWEEPS 20
+#define NODE_BLOCK 1024
 
 class LabelPropagation : public Model {
     int size_, dim_;
-    std::vector<std::vector<double>> embedding_;
+    std::vector<std::vector<real>> embedding_;
     void UpdateEmbedding(const Graph& base, int x);
   public:
     LabelPropagation(const Graph& base, const SingleLabel& label);
-    const std::vector<double>& GetEmbedding(int x) { return embedding_[x]; }
+    EmbeddingView GetEmbedding(int x) { return embedding_[x]; }
 };
 
 void LabelPropagation::UpdateEmbedding(const Graph& base, int x) {
@@ -45,4 +50,60 @@ LabelPropagation::LabelPropagation(const Graph& base, const SingleLabel& label)
 
 Model* GetLabelPropagation(const Graph& base, const SingleLabel& label) {
     return new LabelPropagation(base, label);
-}
\ No newline at end of file
+}
+
+// Jacobi sweeps of X <- D^-1 A X over all labels at once, with the rows of labeled nodes clamped
+class MultiLabelPropagation : public Model {
+    int size_, card_;
+    std::vector<real> score_;
+  public:
+    MultiLabelPropagation(const CSRGraph& base, const Label& label, double tolerance);
+    EmbeddingView GetEmbedding(int x) { return EmbeddingView(score_.data() + (size_t)x * card_, card_); }
+};
+
+MultiLabelPropagation::MultiLabelPropagation(const CSRGraph& base, const Label& label, double tolerance) :
+    size_(base.size),
+    card_(label.card),
+    score_((size_t)base.size * label.card, 0) {
+
+    for (int l = 0; l < card_; ++l)
+        for (int x : label.label_instance[l])
+            score_[(size_t)x * card_ + l] = 1;
+    std::vector<real> inv_degree(size_, 0);
+    for (int x = 0; x < size_; ++x)
+        if (base.offset[x + 1] > base.offset[x])
+            inv_degree[x] = (real)1 / (base.offset[x + 1] - base.offset[x]);
+
+    std::vector<real> next(score_);
+    int blocks = (size_ + NODE_BLOCK - 1) / NODE_BLOCK;
+    std::vector<double> change(blocks);
+    for (int sweep = 0; sweep < MAX_SWEEPS; ++sweep) {
+        ParallelFor(blocks, [&](int block) {
+            int end = std::min(size_, (block + 1) * NODE_BLOCK);
+            double max_change = 0;
+            for (int x = block * NODE_BLOCK; x < end; ++x) {
+                if (label.labeled[x]) continue;
+                real* out = next.data() + (size_t)x * card_;
+                std::fill(out, out + card_, 0);
+                for (int y : base.Neighbors(x)) {
+                    const real* in = score_.data() + (size_t)y * card_;
+                    for (int l = 0; l < card_; ++l)
+                        out[l] += in[l];
+                }
+                const real* old = score_.data() + (size_t)x * card_;
+                for (int l = 0; l < card_; ++l) {
+                    out[l] *= inv_degree[x];
+                    max_change = std::max(max_change, (double)fabs(out[l] - old[l]));
+                }
+            }
+            change[block] = max_change;
+        });
+        score_.swap(next);
+        if (*std::max_element(change.begin(), change.end()) < tolerance)
+            break;
+    }
+}
+
+Model* GetLabelPropagation(const CSRGraph& base, const Label& label, double tolerance) {
+    return new MultiLabelPropagation(base, label, tolerance);
+}
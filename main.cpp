@@ -1,14 +1,26 @@
 #include "base.h"
+#include "ann_index.h"
+#include "quantize.h"
 
 #include <memory>
 #include <iostream>
 
+#define VALIDATION_FRACTION 0.1
+
 struct EvaluateConfig {
     Graph train, neg_train, test, neg_test;
     DGraph d_train, d_neg_train, d_test, d_neg_test;
+    // Training edges held out for the TrainingMonitor when training_log_sample > 0
+    Graph validation, neg_validation;
+    DGraph d_validation, d_neg_validation;
     Label train_label, test_label;
     bool predict_edge, predict_label;
 
+    // Relabel nodes in RCM order before training for better cache locality
+    bool reorder;
+    // perm[old_id] = new_id and its inverse once reorder has been applied, empty otherwise
+    std::vector<int> perm, inverse_perm;
+
     // Finite Embedding parameters
     int finite_dim;
     double finite_neg_penalty, finite_regularizer;
@@ -47,20 +59,108 @@ struct EvaluateConfig {
     double link_svm_regularizer;
     int link_svm_sample_ratio;
 
+    // Link Recommendation parameters (0 disables Hits@K / MRR)
+    int rank_k;
+    // HNSW search beam width for recall@rank_k against exact search (0 disables the index)
+    int ann_ef;
+
+    // Product quantization subspaces for the compressed-model report (0 disables it)
+    int pq_subspaces;
+
+    // Trained inner-product models are saved here for the scoring server (empty disables it)
+    std::string snapshot_file;
+
+    // Log per-epoch training statistics to stderr as JSON lines, with AP on this many sampled validation
+    // edges, held out of the training edges (0 disables the log)
+    int training_log_sample;
+    // Early stopping and time budget for the iterative trainers; patience needs training_log_sample
+    StoppingRule stopping;
+
     // Predefined parameters
     std::string node_file, embedding_file;
 
     // SVD parameters
     std::string svd_u_file, svd_sv_file, svd_v_file;
+    // Rank of the in-process randomized SVD (0 reads the factor files above)
+    int svd_rank;
 };
 
+void EvalRanking(Model* model, const EvaluateConfig& config) {
+    if (config.rank_k <= 0) return;
+    double hits, mrr;
+    EvaluateRanking(model, config.train, config.test, config.rank_k, &hits, &mrr);
+    std::cout << "Hits@" << config.rank_k << ": " << hits << "; MRR: " << mrr << "\n";
+
+    HNSWIndex index;
+    if (config.ann_ef <= 0 || !index.Build(model, config.train.size, 16, 200)) return;
+    std::vector<int> query;
+    for (int x = 0; x < config.test.size; ++x)
+        if (!config.test.edge[x].empty())
+            query.push_back(x);
+    std::cout << "HNSW Recall@" << config.rank_k << ": "
+              << EvaluateIndexRecall(index, model, query, config.rank_k, config.ann_ef) << "\n";
+}
+
+void EvalQuantization(Model* model, const EvaluateConfig& config) {
+    if (config.pq_subspaces <= 0 || model->GetTargetEmbedding(0).size() == 0) return;
+    double ap = EvaluateAveragePrecision(model, config.test, config.neg_test);
+    std::unique_ptr<QuantizedModel> pq(GetProductQuantizedModel(model, config.train.size, config.pq_subspaces));
+    std::cout << "PQ Compression: " << CompressionRatio(model, pq.get(), config.train.size)
+              << "; AP Loss: " << ap - EvaluateAveragePrecision(pq.get(), config.test, config.neg_test) << "\n";
+    std::unique_ptr<QuantizedModel> int8(GetScalarQuantizedModel(model, config.train.size));
+    std::cout << "Int8 Compression: " << CompressionRatio(model, int8.get(), config.train.size)
+              << "; AP Loss: " << ap - EvaluateAveragePrecision(int8.get(), config.test, config.neg_test) << "\n";
+}
+
+// Embeddings read from files are in node file order; after reordering they are wrapped so that the
+// relabeled graphs can query them. Returns model itself when the nodes kept their order.
+Model* InTrainingOrder(Model* model, const EvaluateConfig& config, std::unique_ptr<Model>* wrapper) {
+    if (config.perm.empty()) return model;
+    wrapper->reset(GetPermutedModel(model, config.inverse_perm));
+    return wrapper->get();
+}
+
+void SaveTrainedModel(Model* model, const EvaluateConfig& config) {
+    if (config.snapshot_file.empty()) return;
+    // Snapshot rows follow the node file, so the relabeling is undone first
+    std::unique_ptr<Model> original;
+    if (!config.perm.empty()) {
+        original.reset(GetPermutedModel(model, config.perm));
+        model = original.get();
+    }
+    if (SaveSnapshot(model, config.train.size, config.snapshot_file))
+        std::cout << "Snapshot saved to " << config.snapshot_file << "\n";
+}
+
+TrainingMonitor* GetTrainingLog(const EvaluateConfig& config, const std::string& name, bool directed) {
+    const StoppingRule& rule = config.stopping;
+    bool stopping = rule.max_epochs > 0 || rule.min_change > 0 || rule.seconds > 0;
+    if (config.training_log_sample <= 0 && !stopping) return nullptr;
+    TrainingMonitor* monitor;
+    if (config.training_log_sample > 0)
+        monitor = new TrainingLog(std::cerr, name);
+    else
+        monitor = new TrainingMonitor();
+    monitor->SetStoppingRule(rule);
+    if (directed)
+        monitor->SetValidation(config.d_validation, config.d_neg_validation, config.training_log_sample);
+    else
+        monitor->SetValidation(config.validation, config.neg_validation, config.training_log_sample);
+    return monitor;
+}
+
 void EvalFiniteEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "FiniteEmbedding", false));
     std::cout << "Training Finite Embedding\n";
-    model.reset(GetFiniteEmbedding(config.train, config.neg_train, config.finite_dim, config.finite_neg_penalty, config.finite_regularizer));
+    model.reset(GetFiniteEmbedding(config.train, config.neg_train, config.finite_dim, config.finite_neg_penalty, config.finite_regularizer,
+                                   monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.train, config.neg_train, config.test, config.neg_test);
+        EvalRanking(model.get(), config);
+        EvalQuantization(model.get(), config);
+        SaveTrainedModel(model.get(), config);
         //std::cout << "Predicted AP: " << EvaluatePredictedAP(model.get(), config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
     }
     if (config.predict_label) {
@@ -72,11 +172,16 @@ void EvalFiniteEmbedding(const EvaluateConfig& config) {
 
 void EvalFiniteSGD(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "FiniteSGD", false));
     std::cout << "Training Finite SGD\n";
-    model.reset(GetFiniteSGD(config.train, config.neg_train, config.finite_dim, config.finite_neg_penalty, config.finite_regularizer));
+    model.reset(GetFiniteSGD(config.train, config.neg_train, config.finite_dim, config.finite_neg_penalty, config.finite_regularizer,
+                             monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.train, config.neg_train, config.test, config.neg_test);
+        EvalRanking(model.get(), config);
+        EvalQuantization(model.get(), config);
+        SaveTrainedModel(model.get(), config);
         //std::cout << "Predicted AP: " << EvaluatePredictedAP(model.get(), config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
     }
     if (config.predict_label) {
@@ -88,11 +193,16 @@ void EvalFiniteSGD(const EvaluateConfig& config) {
 
 void EvalFiniteContrastEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "FiniteContrastEmbedding", false));
     std::cout << "Training Finite Contrast Embedding\n";
-    model.reset(GetFiniteContrastEmbedding(config.train, config.neg_train, config.finite_contrast_sample_ratio, config.finite_contrast_dim, config.finite_contrast_regularizer));
+    model.reset(GetFiniteContrastEmbedding(config.train, config.neg_train, config.finite_contrast_sample_ratio, config.finite_contrast_dim, config.finite_contrast_regularizer,
+                                           monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.train, config.neg_train, config.test, config.neg_test);
+        EvalRanking(model.get(), config);
+        EvalQuantization(model.get(), config);
+        SaveTrainedModel(model.get(), config);
         //std::cout << "Predicted AP: " << EvaluatePredictedAP(model.get(), config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
     }
     if (config.predict_label) {
@@ -103,8 +213,10 @@ void EvalFiniteContrastEmbedding(const EvaluateConfig& config) {
 
 void EvalDirectedFiniteEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "DirectedFiniteEmbedding", true));
     std::cout << "Training Directed Finite Embedding\n";
-    model.reset(GetDirectedFiniteEmbedding(config.d_train, config.d_neg_train, config.d_finite_dim, config.d_finite_neg_penalty, config.d_finite_regularizer));
+    model.reset(GetDirectedFiniteEmbedding(config.d_train, config.d_neg_train, config.d_finite_dim, config.d_finite_neg_penalty, config.d_finite_regularizer,
+                                           monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.d_train, config.d_neg_train, config.d_test, config.d_neg_test);
@@ -118,8 +230,10 @@ void EvalDirectedFiniteEmbedding(const EvaluateConfig& config) {
 
 void EvalDirectedFiniteContrastEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "DirectedFiniteContrastEmbedding", true));
     std::cout << "Training Finite Contrast Embedding\n";
-    model.reset(GetDirectedFiniteContrastEmbedding(config.d_train, config.d_neg_train, config.d_finite_contrast_sample_ratio, config.d_finite_contrast_dim, config.d_finite_contrast_regularizer));
+    model.reset(GetDirectedFiniteContrastEmbedding(config.d_train, config.d_neg_train, config.d_finite_contrast_sample_ratio, config.d_finite_contrast_dim, config.d_finite_contrast_regularizer,
+                                                   monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.d_train, config.d_neg_train, config.d_test, config.d_neg_test);
@@ -132,8 +246,9 @@ void EvalDirectedFiniteContrastEmbedding(const EvaluateConfig& config) {
 
 void EvalKernelEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "KernelEmbedding", false));
     std::cout << "Training Kernel Embedding\n";
-    model.reset(GetKernelEmbedding(config.train, config.neg_train, config.kernel_neg_penalty, config.kernel_regularizer));
+    model.reset(GetKernelEmbedding(config.train, config.neg_train, config.kernel_neg_penalty, config.kernel_regularizer, monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.train, config.neg_train, config.test, config.neg_test);
@@ -143,8 +258,9 @@ void EvalKernelEmbedding(const EvaluateConfig& config) {
 void EvalSparseEmbedding(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
     Graph neg_empty(config.train.size);
+    std::unique_ptr<TrainingMonitor> monitor(GetTrainingLog(config, "SparseEmbedding", false));
     std::cout << "Training Sparse Embedding\n";
-    model.reset(GetSparseEmbedding(config.train, neg_empty, config.sparse_neg_penalty, config.sparse_regularizer));
+    model.reset(GetSparseEmbedding(config.train, neg_empty, config.sparse_neg_penalty, config.sparse_regularizer, monitor.get()));
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
         EvaluateAll(model.get(), config.train, config.neg_train, config.test, config.neg_test);
@@ -174,30 +290,59 @@ void EvalCommonNeighbor(const EvaluateConfig& config) {
 void EvalPredefined(const EvaluateConfig& config) {
     std::unique_ptr<Model> model;
     std::cout << "Training Predefined\n";
-    model.reset(GetPredefined(config.node_file, config.embedding_file));
+    // Binary snapshots (see ConvertEmbedding) are mapped in place; anything else is parsed as text
+    int size;
+    std::vector<std::string> node_name, snapshot_name;
+    model.reset(GetSnapshot(config.embedding_file, &size, &snapshot_name));
+    if (model) {
+        // Rows are indexed by the snapshot's node order, which has to be that of the dataset
+        ReadNodeNames(config.node_file, &node_name);
+        if (size != (int)node_name.size() || (!snapshot_name.empty() && snapshot_name != node_name)) {
+            std::cerr << "Snapshot " << config.embedding_file << " does not match node file " << config.node_file << "\n";
+            return;
+        }
+    } else {
+        model.reset(GetPredefined(config.node_file, config.embedding_file));
+        if (!model) {
+            std::cerr << "Cannot read embedding file " << config.embedding_file << "\n";
+            return;
+        }
+    }
+    std::unique_ptr<Model> wrapper;
+    Model* scored = InTrainingOrder(model.get(), config, &wrapper);
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
-        std::cout << "Average Precision: " << EvaluateAveragePrecision(model.get(), config.test, config.neg_test) << "\n";
-        std::cout << "Predicted Average Precision: " << EvaluatePredictedAP(model.get(), config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
+        std::cout << "Average Precision: " << EvaluateAveragePrecision(scored, config.test, config.neg_test) << "\n";
+        std::cout << "Predicted Average Precision: " << EvaluatePredictedAP(scored, config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
+        EvalRanking(scored, config);
+        EvalQuantization(scored, config);
+        SaveTrainedModel(scored, config);
     }
     if (config.predict_label) {
         std::cout << "Evaluating Label Prediction\n";
-        std::cout << "Average F1:" << EvaluateF1(model.get(), config.train_label, config.test_label, config.svm_regularizer, config.svm_sample_ratio, config.vec_normalize) << "\n";
+        std::cout << "Average F1:" << EvaluateF1(scored, config.train_label, config.test_label, config.svm_regularizer, config.svm_sample_ratio, config.vec_normalize) << "\n";
     }
 }
 
 void EvalSVD(const EvaluateConfig& config) {
-    std::unique_ptr<Model> model;
+    std::unique_ptr<Model> model, wrapper;
+    Model* scored;
     std::cout << "Training SVD\n";
-    model.reset(GetSVD(config.node_file, config.svd_u_file, config.svd_sv_file, config.svd_v_file));
+    if (config.svd_rank > 0) {
+        model.reset(GetRandomizedSVD(config.train, config.svd_rank));
+        scored = model.get();
+    } else {
+        model.reset(GetSVD(config.node_file, config.svd_u_file, config.svd_sv_file, config.svd_v_file));
+        scored = InTrainingOrder(model.get(), config, &wrapper);
+    }
     if (config.predict_edge) {
         std::cout << "Evaluating Link Prediction\n";
-        //std::cout << "Average Precision: " << EvaluateAveragePrecision(model.get(), config.test, config.neg_test) << "\n";
-        std::cout << "Predicted Average Precision: " << EvaluatePredictedAP(model.get(), config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
+        //std::cout << "Average Precision: " << EvaluateAveragePrecision(scored, config.test, config.neg_test) << "\n";
+        std::cout << "Predicted Average Precision: " << EvaluatePredictedAP(scored, config.train, config.test, config.neg_test, config.link_svm_regularizer, config.link_svm_sample_ratio) << "\n";
     }
     if (config.predict_label) {
         std::cout << "Evaluating Label Prediction\n";
-        std::cout << "Average F1:" << EvaluateF1(model.get(), config.train_label, config.test_label, config.svm_regularizer, config.svm_sample_ratio, config.vec_normalize) << "\n";
+        std::cout << "Average F1:" << EvaluateF1(scored, config.train_label, config.test_label, config.svm_regularizer, config.svm_sample_ratio, config.vec_normalize) << "\n";
     }
 }
 
@@ -221,6 +366,12 @@ int main() {
     int test_case = 2;
 
     EvaluateConfig config;
+    config.reorder = false;
+    config.rank_k = 0;
+    config.ann_ef = 0;
+    config.pq_subspaces = 0;
+    config.svd_rank = 0;
+    config.training_log_sample = 0;
     std::cout << "Reading Dataset\n";
     switch (test_case) {
     case 0:
@@ -286,6 +437,21 @@ int main() {
         break;
     }
 
+    if (config.training_log_sample > 0) {
+        SplitValidation(&config.train, VALIDATION_FRACTION, &config.validation);
+        config.neg_validation = Graph(config.validation.size);
+        SampleNegativeGraphUniform(config.validation, &config.neg_validation);
+        RemoveRedundant(config.train, &config.neg_validation);
+        RemoveRedundant(config.validation, &config.neg_validation);
+        if (config.d_train.size > 0) {
+            SplitValidation(&config.d_train, VALIDATION_FRACTION, &config.d_validation);
+            config.d_neg_validation = DGraph(config.d_validation.size);
+            SampleNegativeDGraphUniform(config.d_validation, &config.d_neg_validation);
+            RemoveRedundant(config.d_train, &config.d_neg_validation);
+            RemoveRedundant(config.d_validation, &config.d_neg_validation);
+        }
+    }
+
     std::cout << "Sampling Negative Dataset\n";
     config.neg_train = Graph(config.train.size);
     SampleNegativeGraphUniform(config.train, &config.neg_train);
@@ -297,6 +463,36 @@ int main() {
     RemoveRedundant(config.train, &config.neg_train);
     RemoveRedundant(config.train, &config.neg_test);
     RemoveRedundant(config.test, &config.neg_test);
+    // Validation edges were split off the training graph but are still real edges
+    if (config.validation.size > 0)
+        RemoveRedundant(config.validation, &config.neg_test);
+    if (config.d_validation.size > 0)
+        RemoveRedundant(config.d_validation, &config.d_neg_test);
+
+    if (config.reorder) {
+        std::cout << "Reordering Nodes\n";
+        std::vector<int> perm;
+        if (config.train.size > 0)
+            ComputeNodeOrder(config.train, ORDER_RCM, &perm);
+        else
+            ComputeNodeOrder(config.d_train, ORDER_RCM, &perm);
+        PermuteGraph(perm, &config.train);
+        PermuteGraph(perm, &config.neg_train);
+        PermuteGraph(perm, &config.test);
+        PermuteGraph(perm, &config.neg_test);
+        PermuteGraph(perm, &config.validation);
+        PermuteGraph(perm, &config.neg_validation);
+        PermuteGraph(perm, &config.d_train);
+        PermuteGraph(perm, &config.d_neg_train);
+        PermuteGraph(perm, &config.d_test);
+        PermuteGraph(perm, &config.d_neg_test);
+        PermuteGraph(perm, &config.d_validation);
+        PermuteGraph(perm, &config.d_neg_validation);
+        PermuteLabel(perm, &config.train_label);
+        PermuteLabel(perm, &config.test_label);
+        config.perm.swap(perm);
+        InvertPermutation(config.perm, &config.inverse_perm);
+    }
 
     //EvalFiniteEmbedding(config);
     EvalFiniteSGD(config);
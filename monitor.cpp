@@ -0,0 +1,154 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#define NODE_BLOCK 1024
+
+namespace {
+    thread_local ThreadGenerator gen;
+
+    double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Keeps a uniform sample of at most sample edges
+    void SampleEdges(std::vector<Edge> edges, int sample, std::vector<Edge>* kept) {
+        if ((int)edges.size() > sample) {
+            for (int i = 0; i < sample; ++i) {
+                std::uniform_int_distribution<int> pick(i, edges.size() - 1);
+                std::swap(edges[i], edges[pick(gen)]);
+            }
+            edges.resize(sample, Edge(0, 0));
+        }
+        kept->swap(edges);
+    }
+
+    void UndirectedEdges(const Graph& graph, std::vector<Edge>* edges) {
+        for (int x = 0; x < graph.size; ++x)
+            for (int y : graph.edge[x])
+                if (x < y)
+                    edges->push_back(Edge(x, y));
+    }
+
+    void DirectedEdges(const DGraph& graph, std::vector<Edge>* edges) {
+        for (int x = 0; x < graph.size; ++x)
+            for (int y : graph.out_edge[x])
+                edges->push_back(Edge(x, y));
+    }
+
+    void WriteNumber(std::ostream& out, double value) {
+        if (std::isfinite(value))
+            out << value;
+        else
+            out << "null";
+    }
+}   // anonymous namespace
+
+void TrainingMonitor::SetValidation(const Graph& pos, const Graph& neg, int sample) {
+    std::vector<Edge> pos_edges, neg_edges;
+    UndirectedEdges(pos, &pos_edges);
+    UndirectedEdges(neg, &neg_edges);
+    SampleEdges(pos_edges, sample, &validation_pos_);
+    SampleEdges(neg_edges, sample, &validation_neg_);
+}
+
+void TrainingMonitor::SetValidation(const DGraph& pos, const DGraph& neg, int sample) {
+    std::vector<Edge> pos_edges, neg_edges;
+    DirectedEdges(pos, &pos_edges);
+    DirectedEdges(neg, &neg_edges);
+    SampleEdges(pos_edges, sample, &validation_pos_);
+    SampleEdges(neg_edges, sample, &validation_neg_);
+}
+
+void TrainingMonitor::Reset() {
+    last_primal_ = NAN;
+    best_ap_ = -1;
+    last_epoch_ = best_epoch_ = -1;
+    stop_reason_.clear();
+}
+
+bool TrainingMonitor::Continue(int epoch, int epochs) {
+    if (epoch == 0)
+        Reset();
+    if (stop_reason_.empty() && epoch >= (rule_.max_epochs > 0 ? rule_.max_epochs : epochs))
+        stop_reason_ = "epochs";
+    return stop_reason_.empty();
+}
+
+void TrainingMonitor::BeginEpoch() {
+    begin_ = Now();
+    if (last_epoch_ < 0)
+        start_ = begin_;
+}
+
+void TrainingMonitor::EndEpoch(Model* model, int epoch, int size, long long updates,
+                               const std::function<void(int, NodeObjective*)>& objective) {
+    EpochStats stats;
+    stats.epoch = epoch;
+    stats.seconds = Now() - begin_;
+    stats.updates_per_second = stats.seconds > 0 ? updates / stats.seconds : 0;
+
+    int blocks = (size + NODE_BLOCK - 1) / NODE_BLOCK;
+    std::vector<NodeObjective> partial(blocks);
+    ParallelFor(blocks, [&](int block) {
+        int end = std::min(size, (block + 1) * NODE_BLOCK);
+        for (int x = block * NODE_BLOCK; x < end; ++x) {
+            NodeObjective node;
+            objective(x, &node);
+            partial[block].primal += node.primal;
+            partial[block].dual += node.dual;
+            partial[block].active += node.active;
+        }
+    });
+    stats.primal = stats.dual = 0;
+    stats.active = 0;
+    for (const NodeObjective& sum : partial) {
+        stats.primal += sum.primal;
+        stats.dual += sum.dual;
+        stats.active += sum.active;
+    }
+    stats.gap = stats.primal - stats.dual;
+
+    stats.validation_ap = -1;
+    if (!validation_pos_.empty() && !validation_neg_.empty()) {
+        std::vector<double> pos_score, neg_score;
+        ScorePairs(model, validation_pos_, &pos_score);
+        ScorePairs(model, validation_neg_, &neg_score);
+        stats.validation_ap = EvaluateAveragePrecision(pos_score, neg_score);
+    }
+
+    // The next epoch is expected to take as long as this one with its statistics pass
+    double now = Now();
+    last_epoch_ = epoch;
+    if (stats.validation_ap > best_ap_) {
+        best_ap_ = stats.validation_ap;
+        best_epoch_ = epoch;
+    }
+    if (rule_.min_change > 0 && std::isfinite(last_primal_) &&
+        fabs(stats.primal - last_primal_) <= rule_.min_change * fabs(last_primal_))
+        stop_reason_ = "converged";
+    else if (rule_.patience > 0 && best_epoch_ >= 0 && epoch - best_epoch_ >= rule_.patience)
+        stop_reason_ = "patience";
+    else if (rule_.seconds > 0 && now - start_ + (now - begin_) > rule_.seconds)
+        stop_reason_ = "time";
+    last_primal_ = stats.primal;
+    OnEpoch(model, stats);
+}
+
+void TrainingLog::OnEpoch(Model* model, const EpochStats& stats) {
+    out_ << "{\"model\": \"" << name_ << "\", \"epoch\": " << stats.epoch << ", \"seconds\": " << stats.seconds
+         << ", \"updates_per_second\": " << stats.updates_per_second << ", \"primal\": ";
+    WriteNumber(out_, stats.primal);
+    out_ << ", \"dual\": ";
+    WriteNumber(out_, stats.dual);
+    out_ << ", \"gap\": ";
+    WriteNumber(out_, stats.gap);
+    out_ << ", \"active\": " << stats.active << ", \"validation_ap\": ";
+    WriteNumber(out_, stats.validation_ap >= 0 ? stats.validation_ap : NAN);
+    out_ << "}" << std::endl;
+}
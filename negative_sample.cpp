@@ -7,7 +7,7 @@
 #define NEGATIVE_RATIO 2
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 void SampleNegativeGraphUniform(const Graph& positive, Graph* negative) {
@@ -89,4 +89,25 @@ void RemoveRedundant(const DGraph& positive, DGraph* negative) {
         negative->in_edge[i] = std::move(new_edge);
     }
 
-}
\ No newline at end of file
+}
+
+void SplitValidation(Graph* graph, double fraction, Graph* validation) {
+    std::bernoulli_distribution held_out(fraction);
+    Graph kept(graph->size);
+    *validation = Graph(graph->size);
+    for (int x = 0; x < graph->size; ++x)
+        for (int y : graph->edge[x])
+            if (x < y)
+                (held_out(gen) ? validation : &kept)->AddEdge(x, y);
+    *graph = std::move(kept);
+}
+
+void SplitValidation(DGraph* graph, double fraction, DGraph* validation) {
+    std::bernoulli_distribution held_out(fraction);
+    DGraph kept(graph->size);
+    *validation = DGraph(graph->size);
+    for (int x = 0; x < graph->size; ++x)
+        for (int y : graph->out_edge[x])
+            (held_out(gen) ? validation : &kept)->AddEdge(x, y);
+    *graph = std::move(kept);
+}
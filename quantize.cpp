@@ -0,0 +1,287 @@
+#include "quantize.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#define CENTROIDS 256
+#define KMEANS_ITERATIONS 10
+#define KMEANS_SAMPLE 65536
+
+namespace {
+    thread_local ThreadGenerator gen;
+
+    bool SharedSides(Model* model) {
+        return model->GetSourceEmbedding(0).data() == model->GetTargetEmbedding(0).data();
+    }
+
+    EmbeddingView SourceRow(Model* model, int x) {
+        EmbeddingView row = model->GetSourceEmbedding(x);
+        return row.size() > 0 ? row : model->GetEmbedding(x);
+    }
+
+    EmbeddingView TargetRow(Model* model, int x) {
+        EmbeddingView row = model->GetTargetEmbedding(x);
+        return row.size() > 0 ? row : model->GetEmbedding(x);
+    }
+
+    // Per-subspace codebooks and the codes of every node for one side of a model
+    struct ProductCode {
+        int subspaces, centroids;
+        std::vector<int> offset;
+        std::vector<real> centroid;
+        std::vector<uint8_t> code;
+
+        const real* Centroid(int s, int c) const {
+            return centroid.data() + (size_t)centroids * offset[s] + (size_t)c * (offset[s + 1] - offset[s]);
+        }
+
+        int Nearest(int s, const real* v) const {
+            int sub_dim = offset[s + 1] - offset[s], best = 0;
+            double best_dist = std::numeric_limits<double>::max();
+            for (int c = 0; c < centroids; ++c) {
+                double dist = SquaredDistance(v, Centroid(s, c), sub_dim);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = c;
+                }
+            }
+            return best;
+        }
+
+        void Train(const std::vector<const real*>& row, int dim, int subspaces_) {
+            int size = row.size();
+            subspaces = std::min(subspaces_, dim);
+            offset.resize(subspaces + 1);
+            for (int s = 0; s <= subspaces; ++s)
+                offset[s] = (long long)dim * s / subspaces;
+            std::vector<int> sample(size);
+            for (int i = 0; i < size; ++i)
+                sample[i] = i;
+            std::shuffle(sample.begin(), sample.end(), gen);
+            sample.resize(std::min(size, KMEANS_SAMPLE));
+            centroids = std::min(CENTROIDS, (int)sample.size());
+            centroid.assign((size_t)centroids * dim, 0);
+
+            std::uniform_int_distribution<int> pick(0, sample.size() - 1);
+            std::vector<int> assign(sample.size());
+            for (int s = 0; s < subspaces; ++s) {
+                int first = offset[s], sub_dim = offset[s + 1] - offset[s];
+                real* base = centroid.data() + (size_t)centroids * first;
+                for (int c = 0; c < centroids; ++c)
+                    std::copy(row[sample[c]] + first, row[sample[c]] + first + sub_dim, base + (size_t)c * sub_dim);
+                std::vector<double> sum((size_t)centroids * sub_dim);
+                std::vector<int> count(centroids);
+                for (int iter = 0; iter < KMEANS_ITERATIONS; ++iter) {
+                    ParallelFor(sample.size(), [&](int i) { assign[i] = Nearest(s, row[sample[i]] + first); });
+                    std::fill(sum.begin(), sum.end(), 0);
+                    std::fill(count.begin(), count.end(), 0);
+                    for (int i = 0; i < (int)sample.size(); ++i) {
+                        const real* v = row[sample[i]] + first;
+                        ++count[assign[i]];
+                        for (int j = 0; j < sub_dim; ++j)
+                            sum[(size_t)assign[i] * sub_dim + j] += v[j];
+                    }
+                    for (int c = 0; c < centroids; ++c) {
+                        real* target = base + (size_t)c * sub_dim;
+                        // Empty clusters restart from a random sample
+                        if (count[c] == 0) {
+                            const real* v = row[sample[pick(gen)]] + first;
+                            std::copy(v, v + sub_dim, target);
+                            continue;
+                        }
+                        for (int j = 0; j < sub_dim; ++j)
+                            target[j] = sum[(size_t)c * sub_dim + j] / count[c];
+                    }
+                }
+            }
+
+            code.resize((size_t)size * subspaces);
+            ParallelFor(size, [&](int x) {
+                for (int s = 0; s < subspaces; ++s)
+                    code[(size_t)x * subspaces + s] = Nearest(s, row[x] + offset[s]);
+            });
+        }
+
+        void Decode(int x, real* out) const {
+            for (int s = 0; s < subspaces; ++s) {
+                const real* c = Centroid(s, code[(size_t)x * subspaces + s]);
+                std::copy(c, c + offset[s + 1] - offset[s], out + offset[s]);
+            }
+        }
+
+        double Score(const real* query, int y) const {
+            double sum = 0;
+            for (int s = 0; s < subspaces; ++s)
+                sum += InnerProduct(query + offset[s], Centroid(s, code[(size_t)y * subspaces + s]), offset[s + 1] - offset[s]);
+            return sum;
+        }
+
+        size_t Bytes() const { return code.size() + centroid.size() * sizeof(real) + offset.size() * sizeof(int); }
+    };
+
+    // int8 codes with one scale per node: v ~ scale * code
+    struct ScalarCode {
+        int dim;
+        std::vector<int8_t> code;
+        std::vector<real> scale;
+
+        void Train(const std::vector<const real*>& row, int dim_) {
+            int size = row.size();
+            dim = dim_;
+            code.resize((size_t)size * dim);
+            scale.resize(size);
+            ParallelFor(size, [&](int x) {
+                double max_abs = 0;
+                for (int i = 0; i < dim; ++i)
+                    max_abs = std::max(max_abs, (double)fabs(row[x][i]));
+                scale[x] = max_abs / 127;
+                for (int i = 0; i < dim; ++i)
+                    code[(size_t)x * dim + i] = max_abs > 0 ? (int8_t)lround(row[x][i] / scale[x]) : 0;
+            });
+        }
+
+        const int8_t* Code(int x) const { return code.data() + (size_t)x * dim; }
+
+        size_t Bytes() const { return code.size() + scale.size() * sizeof(real); }
+    };
+
+    std::vector<real>& DecodeBuffer(int dim) {
+        thread_local std::vector<real> buffer;
+        buffer.resize(dim);
+        return buffer;
+    }
+}   // anonymous namespace
+
+class ProductQuantizedModel : public QuantizedModel {
+    int size_, dim_;
+    bool shared_;
+    ProductCode source_, target_;
+  public:
+    ProductQuantizedModel(Model* model, int size, int subspaces) : size_(size) {
+        dim_ = TargetRow(model, 0).size();
+        shared_ = SharedSides(model);
+        std::vector<const real*> row(size);
+        for (int x = 0; x < size; ++x)
+            row[x] = TargetRow(model, x).data();
+        target_.Train(row, dim_, subspaces);
+        if (!shared_) {
+            for (int x = 0; x < size; ++x)
+                row[x] = SourceRow(model, x).data();
+            source_.Train(row, dim_, subspaces);
+        }
+    }
+    double Evaluate(int x, int y) {
+        std::vector<real>& query = DecodeBuffer(dim_);
+        DecodeSource(x, query.data());
+        return target_.Score(query.data(), y);
+    }
+    int Dimension() { return dim_; }
+    size_t MemoryBytes() { return target_.Bytes() + (shared_ ? 0 : source_.Bytes()); }
+    void DecodeSource(int x, real* out) { (shared_ ? target_ : source_).Decode(x, out); }
+    // Asymmetric distance computation: one table of <query, centroid> per subspace, then one lookup per code
+    void ScoreTargets(const real* query, double* score) {
+        int subspaces = target_.subspaces, centroids = target_.centroids;
+        std::vector<double> table((size_t)subspaces * centroids);
+        for (int s = 0; s < subspaces; ++s)
+            for (int c = 0; c < centroids; ++c)
+                table[(size_t)s * centroids + c] = InnerProduct(query + target_.offset[s], target_.Centroid(s, c),
+                                                                target_.offset[s + 1] - target_.offset[s]);
+        for (int y = 0; y < size_; ++y) {
+            const uint8_t* code = target_.code.data() + (size_t)y * subspaces;
+            double sum = 0;
+            for (int s = 0; s < subspaces; ++s)
+                sum += table[(size_t)s * centroids + code[s]];
+            score[y] = sum;
+        }
+    }
+};
+
+class ScalarQuantizedModel : public QuantizedModel {
+    int size_, dim_;
+    bool shared_;
+    ScalarCode source_, target_;
+  public:
+    ScalarQuantizedModel(Model* model, int size) : size_(size) {
+        dim_ = TargetRow(model, 0).size();
+        shared_ = SharedSides(model);
+        std::vector<const real*> row(size);
+        for (int x = 0; x < size; ++x)
+            row[x] = TargetRow(model, x).data();
+        target_.Train(row, dim_);
+        if (!shared_) {
+            for (int x = 0; x < size; ++x)
+                row[x] = SourceRow(model, x).data();
+            source_.Train(row, dim_);
+        }
+    }
+    // Both sides are codes here, so the product is an integer dot product
+    double Evaluate(int x, int y) {
+        const ScalarCode& source = shared_ ? target_ : source_;
+        const int8_t* a = source.Code(x);
+        const int8_t* b = target_.Code(y);
+        int sum = 0;
+        for (int i = 0; i < dim_; ++i)
+            sum += a[i] * b[i];
+        return (double)sum * source.scale[x] * target_.scale[y];
+    }
+    int Dimension() { return dim_; }
+    size_t MemoryBytes() { return target_.Bytes() + (shared_ ? 0 : source_.Bytes()); }
+    void DecodeSource(int x, real* out) {
+        const ScalarCode& source = shared_ ? target_ : source_;
+        const int8_t* a = source.Code(x);
+        for (int i = 0; i < dim_; ++i)
+            out[i] = a[i] * source.scale[x];
+    }
+    void ScoreTargets(const real* query, double* score) {
+        for (int y = 0; y < size_; ++y) {
+            const int8_t* b = target_.Code(y);
+            double sum = 0;
+            for (int i = 0; i < dim_; ++i)
+                sum += query[i] * b[i];
+            score[y] = sum * target_.scale[y];
+        }
+    }
+};
+
+QuantizedModel* GetProductQuantizedModel(Model* model, int size, int subspaces) {
+    return new ProductQuantizedModel(model, size, subspaces);
+}
+
+QuantizedModel* GetScalarQuantizedModel(Model* model, int size) {
+    return new ScalarQuantizedModel(model, size);
+}
+
+void QuantizedTopK(QuantizedModel* model, const Graph& exclude, const std::vector<int>& query, int k,
+                   std::vector<std::vector<std::pair<int, double>>>* result) {
+    int size = exclude.size, dim = model->Dimension();
+    result->assign(query.size(), std::vector<std::pair<int, double>>());
+    ParallelFor(query.size(), [&](int q) {
+        int x = query[q];
+        std::vector<real> source(dim);
+        std::vector<double> score(size);
+        model->DecodeSource(x, source.data());
+        model->ScoreTargets(source.data(), score.data());
+
+        std::vector<bool> skip(size, false);
+        skip[x] = true;
+        for (int y : exclude.edge[x])
+            skip[y] = true;
+        std::vector<std::pair<double, int>> candidate;
+        candidate.reserve(size);
+        for (int y = 0; y < size; ++y)
+            if (!skip[y])
+                candidate.push_back(std::make_pair(-score[y], y));
+        int top = std::min(k, (int)candidate.size());
+        std::partial_sort(candidate.begin(), candidate.begin() + top, candidate.end());
+        for (int r = 0; r < top; ++r)
+            result->at(q).push_back(std::make_pair(candidate[r].second, -candidate[r].first));
+    });
+}
+
+double CompressionRatio(Model* model, QuantizedModel* quantized, int size) {
+    double dense = (double)size * quantized->Dimension() * sizeof(real) * (SharedSides(model) ? 1 : 2);
+    return dense / quantized->MemoryBytes();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include "base.h"
+#include "utility.h"
+
+// A model whose target embeddings are stored as compact codes. Scoring is asymmetric: the query side
+// stays a real vector and only the targets are approximated.
+class QuantizedModel : public Model {
+  public:
+    virtual int Dimension() = 0;
+    // Bytes held by codes, scales and codebooks
+    virtual size_t MemoryBytes() = 0;
+    // Reconstructed source vector of x, written to dim values
+    virtual void DecodeSource(int x, real* out) = 0;
+    // score[y] approximates <query, target y> for every node y
+    virtual void ScoreTargets(const real* query, double* score) = 0;
+};
+
+// Product quantization: the dimensions are split into subspaces, each encoded by one byte indexing
+// a k-means codebook of up to 256 centroids. Source and target sides share codes when the model
+// returns the same rows for both.
+QuantizedModel* GetProductQuantizedModel(Model* model, int size, int subspaces);
+// int8 scalar quantization with one scale per node and side
+QuantizedModel* GetScalarQuantizedModel(Model* model, int size);
+
+// Same contract as RecommendTopK, scored on codes through ScoreTargets
+void QuantizedTopK(QuantizedModel* model, const Graph& exclude, const std::vector<int>& query, int k,
+                   std::vector<std::vector<std::pair<int, double>>>* result);
+// Bytes of the dense embeddings of model divided by the bytes of its quantized form
+double CompressionRatio(Model* model, QuantizedModel* quantized, int size);
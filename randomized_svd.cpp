@@ -0,0 +1,278 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+#define OVERSAMPLE 10
+#define POWER_ITERATIONS 2
+#define JACOBI_SWEEPS 50
+#define NODE_BLOCK 1024
+#define GRAM_PARTS 64
+// Cholesky pivots below this fraction of the largest Gram diagonal entry drop their column
+#define CHOLESKY_TOLERANCE 1e-14
+
+namespace {
+    thread_local ThreadGenerator gen;
+
+    // Tall n x width matrices are stored row-major, one row per node, so that a sparse-times-dense
+    // product reads whole neighbor rows
+    struct DenseRows {
+        int rows, width;
+        std::vector<double> value;
+        DenseRows(int rows_, int width_) : rows(rows_), width(width_), value((size_t)rows_ * width_, 0) {}
+        double* Row(int x) { return value.data() + (size_t)x * width; }
+        const double* Row(int x) const { return value.data() + (size_t)x * width; }
+    };
+
+    int Blocks(int rows) {
+        return (rows + NODE_BLOCK - 1) / NODE_BLOCK;
+    }
+
+    // out = A * in, A being the adjacency matrix of graph
+    void Multiply(const CSRGraph& graph, const DenseRows& in, DenseRows* out) {
+        int width = in.width;
+        ParallelFor(Blocks(graph.size), [&](int block) {
+            int end = std::min(graph.size, (block + 1) * NODE_BLOCK);
+            for (int x = block * NODE_BLOCK; x < end; ++x) {
+                double* row = out->Row(x);
+                std::fill(row, row + width, 0);
+                for (int y : graph.Neighbors(x)) {
+                    const double* add = in.Row(y);
+                    for (int j = 0; j < width; ++j)
+                        row[j] += add[j];
+                }
+            }
+        });
+    }
+
+    // Row-block parallel (m * w) for a k x k matrix w, keeping the first rank columns
+    void MultiplySmall(const DenseRows& m, const std::vector<double>& w, int rank, DenseRows* out) {
+        int k = m.width;
+        ParallelFor(Blocks(m.rows), [&](int block) {
+            int end = std::min(m.rows, (block + 1) * NODE_BLOCK);
+            for (int x = block * NODE_BLOCK; x < end; ++x) {
+                const double* row = m.Row(x);
+                double* target = out->Row(x);
+                for (int c = 0; c < rank; ++c) {
+                    double sum = 0;
+                    for (int i = 0; i < k; ++i)
+                        sum += row[i] * w[(size_t)i * k + c];
+                    target[c] = sum;
+                }
+            }
+        });
+    }
+
+    // m^T m as a row-major k x k matrix, summed over GRAM_PARTS fixed row ranges and then across them,
+    // so the result does not depend on the thread count
+    void Gram(const DenseRows& m, std::vector<double>* gram) {
+        int k = m.width, parts = std::min(GRAM_PARTS, std::max(1, m.rows));
+        std::vector<double> partial((size_t)parts * k * k, 0);
+        ParallelFor(parts, [&](int part) {
+            double* sum = partial.data() + (size_t)part * k * k;
+            int end = (long long)m.rows * (part + 1) / parts;
+            for (int x = (long long)m.rows * part / parts; x < end; ++x) {
+                const double* row = m.Row(x);
+                for (int i = 0; i < k; ++i)
+                    for (int j = i; j < k; ++j)
+                        sum[(size_t)i * k + j] += row[i] * row[j];
+            }
+        });
+        gram->assign((size_t)k * k, 0);
+        for (int part = 0; part < parts; ++part)
+            for (int i = 0; i < k; ++i)
+                for (int j = i; j < k; ++j)
+                    (*gram)[(size_t)i * k + j] += partial[((size_t)part * k + i) * k + j];
+        for (int i = 0; i < k; ++i)
+            for (int j = 0; j < i; ++j)
+                (*gram)[(size_t)i * k + j] = (*gram)[(size_t)j * k + i];
+    }
+
+    // Inverse of the upper-triangular Cholesky factor r of gram (r^T r = gram). A pivot that is
+    // negligible next to the largest diagonal entry marks a column that depends on the earlier ones;
+    // its row and column of the inverse are left at zero.
+    void CholeskyInverse(const std::vector<double>& gram, int k, std::vector<double>* inverse) {
+        double max_diagonal = 0;
+        for (int i = 0; i < k; ++i)
+            max_diagonal = std::max(max_diagonal, gram[(size_t)i * k + i]);
+        std::vector<double> r((size_t)k * k, 0);
+        for (int j = 0; j < k; ++j) {
+            for (int i = 0; i < j; ++i) {
+                if (r[(size_t)i * k + i] == 0) continue;
+                double sum = gram[(size_t)i * k + j];
+                for (int l = 0; l < i; ++l)
+                    sum -= r[(size_t)l * k + i] * r[(size_t)l * k + j];
+                r[(size_t)i * k + j] = sum / r[(size_t)i * k + i];
+            }
+            double pivot = gram[(size_t)j * k + j];
+            for (int l = 0; l < j; ++l)
+                pivot -= r[(size_t)l * k + j] * r[(size_t)l * k + j];
+            r[(size_t)j * k + j] = pivot > CHOLESKY_TOLERANCE * max_diagonal ? sqrt(pivot) : 0;
+        }
+        inverse->assign((size_t)k * k, 0);
+        for (int j = 0; j < k; ++j) {
+            double diagonal = r[(size_t)j * k + j];
+            if (diagonal == 0) continue;
+            (*inverse)[(size_t)j * k + j] = 1 / diagonal;
+            for (int i = 0; i < j; ++i) {
+                double sum = 0;
+                for (int l = i; l < j; ++l)
+                    sum += (*inverse)[(size_t)i * k + l] * r[(size_t)l * k + j];
+                (*inverse)[(size_t)i * k + j] = -sum / diagonal;
+            }
+        }
+    }
+
+    // Orthonormalizes the columns of m by CholeskyQR2: m <- m R^-1 with R the Cholesky factor of m^T m,
+    // done twice since one pass loses orthogonality with the squared condition number of m. Each pass
+    // reads m twice, instead of twice per column as Gram-Schmidt does. Columns that vanish, or depend
+    // on earlier ones, are left at zero.
+    void Orthonormalize(DenseRows* m) {
+        DenseRows out(m->rows, m->width);
+        std::vector<double> gram, inverse;
+        for (int pass = 0; pass < 2; ++pass) {
+            Gram(*m, &gram);
+            CholeskyInverse(gram, m->width, &inverse);
+            MultiplySmall(*m, inverse, m->width, &out);
+            m->value.swap(out.value);
+        }
+    }
+
+    // Cyclic Jacobi eigendecomposition of the symmetric k x k matrix a (row-major). Eigenvalues are
+    // returned in decreasing order with the matching eigenvectors as columns of vec.
+    void SymmetricEigen(std::vector<double> a, int k, std::vector<double>* value, std::vector<double>* vec) {
+        vec->assign((size_t)k * k, 0);
+        for (int i = 0; i < k; ++i)
+            (*vec)[(size_t)i * k + i] = 1;
+        for (int sweep = 0; sweep < JACOBI_SWEEPS; ++sweep) {
+            double off = 0, total = 0;
+            for (int i = 0; i < k; ++i)
+                for (int j = 0; j < k; ++j) {
+                    total += a[(size_t)i * k + j] * a[(size_t)i * k + j];
+                    if (i != j) off += a[(size_t)i * k + j] * a[(size_t)i * k + j];
+                }
+            if (off <= 1e-30 * total) break;
+            for (int p = 0; p < k; ++p)
+                for (int q = p + 1; q < k; ++q) {
+                    double apq = a[(size_t)p * k + q];
+                    if (fabs(apq) < 1e-300) continue;
+                    double theta = (a[(size_t)q * k + q] - a[(size_t)p * k + p]) / (2 * apq);
+                    double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                    double c = 1 / sqrt(t * t + 1), s = t * c;
+                    for (int r = 0; r < k; ++r) {
+                        double arp = a[(size_t)r * k + p], arq = a[(size_t)r * k + q];
+                        a[(size_t)r * k + p] = c * arp - s * arq;
+                        a[(size_t)r * k + q] = s * arp + c * arq;
+                    }
+                    for (int r = 0; r < k; ++r) {
+                        double apr = a[(size_t)p * k + r], aqr = a[(size_t)q * k + r];
+                        a[(size_t)p * k + r] = c * apr - s * aqr;
+                        a[(size_t)q * k + r] = s * apr + c * aqr;
+                    }
+                    for (int r = 0; r < k; ++r) {
+                        double vrp = (*vec)[(size_t)r * k + p], vrq = (*vec)[(size_t)r * k + q];
+                        (*vec)[(size_t)r * k + p] = c * vrp - s * vrq;
+                        (*vec)[(size_t)r * k + q] = s * vrp + c * vrq;
+                    }
+                }
+        }
+        std::vector<int> order(k);
+        for (int i = 0; i < k; ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int i, int j) { return a[(size_t)i * k + i] > a[(size_t)j * k + j]; });
+        std::vector<double> sorted_vec((size_t)k * k);
+        value->resize(k);
+        for (int c = 0; c < k; ++c) {
+            (*value)[c] = a[(size_t)order[c] * k + order[c]];
+            for (int r = 0; r < k; ++r)
+                sorted_vec[(size_t)r * k + c] = (*vec)[(size_t)r * k + order[c]];
+        }
+        vec->swap(sorted_vec);
+    }
+}   // anonymous namespace
+
+// Halko, Martinsson & Tropp randomized truncated SVD of the adjacency matrix A ~ U S V^T. Only
+// n x (rank + OVERSAMPLE) dense blocks are ever formed. Scores are <U_x S^1/2, V_y S^1/2>.
+class RandomizedSVD : public Model {
+    int size_, rank_;
+    std::vector<std::vector<real>> source_, target_;
+    std::vector<double> singular_value_;
+  public:
+    RandomizedSVD(const CSRGraph& graph, int rank);
+    double Evaluate(int x, int y) {
+        return InnerProduct(source_[x].data(), target_[y].data(), rank_);
+    }
+    EmbeddingView GetEmbedding(int x) { return source_[x]; }
+    EmbeddingView GetSourceEmbedding(int x) { return source_[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return target_[x]; }
+};
+
+RandomizedSVD::RandomizedSVD(const CSRGraph& graph, int rank) : size_(graph.size) {
+    int width = std::min(rank + OVERSAMPLE, std::max(1, size_));
+    rank_ = std::min(rank, width);
+
+    // Gaussian test matrix, one generator per node block so the fill runs in parallel
+    DenseRows y(size_, width), q(size_, width);
+    std::vector<unsigned> seed(Blocks(size_));
+    for (unsigned& s : seed)
+        s = gen();
+    ParallelFor(seed.size(), [&](int block) {
+        std::mt19937 block_gen(seed[block]);
+        std::normal_distribution<double> normal(0, 1);
+        int end = std::min(size_, (block + 1) * NODE_BLOCK);
+        for (int x = block * NODE_BLOCK; x < end; ++x)
+            for (int j = 0; j < width; ++j)
+                y.Row(x)[j] = normal(block_gen);
+    });
+
+    // Range finder with power iterations; A is symmetric, so A^T products are A products
+    Multiply(graph, y, &q);
+    Orthonormalize(&q);
+    for (int iter = 0; iter < POWER_ITERATIONS; ++iter) {
+        Multiply(graph, q, &y);
+        Orthonormalize(&y);
+        Multiply(graph, y, &q);
+        Orthonormalize(&q);
+    }
+
+    // B = Q^T A is width x n; with C = A Q = B^T, B B^T = C^T C = W L W^T gives S = L^1/2,
+    // U = Q W and V = C W S^-1
+    DenseRows& c = y;
+    Multiply(graph, q, &c);
+    std::vector<double> gram;
+    Gram(c, &gram);
+    std::vector<double> eigenvalue, w;
+    SymmetricEigen(gram, width, &eigenvalue, &w);
+    singular_value_.resize(rank_);
+    for (int i = 0; i < rank_; ++i)
+        singular_value_[i] = sqrt(std::max(0.0, eigenvalue[i]));
+
+    DenseRows u(size_, rank_), v(size_, rank_);
+    MultiplySmall(q, w, rank_, &u);
+    MultiplySmall(c, w, rank_, &v);
+    source_.assign(size_, std::vector<real>(rank_));
+    target_.assign(size_, std::vector<real>(rank_));
+    ParallelFor(Blocks(size_), [&](int block) {
+        int end = std::min(size_, (block + 1) * NODE_BLOCK);
+        for (int x = block * NODE_BLOCK; x < end; ++x)
+            for (int i = 0; i < rank_; ++i) {
+                double s = singular_value_[i];
+                source_[x][i] = u.Row(x)[i] * sqrt(s);
+                // V = C W S^-1, scaled by S^1/2
+                target_[x][i] = s > 1e-12 ? v.Row(x)[i] / sqrt(s) : 0;
+            }
+    });
+}
+
+Model* GetRandomizedSVD(const CSRGraph& graph, int rank) {
+    return new RandomizedSVD(graph, rank);
+}
+
+Model* GetRandomizedSVD(const Graph& graph, int rank) {
+    CSRGraph csr;
+    ToCSRGraph(graph, &csr);
+    return new RandomizedSVD(csr, rank);
+}
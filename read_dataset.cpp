@@ -5,6 +5,11 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
 
 void ReadDataset(const std::string& nodefile, const std::string& edgefile, Graph* graph) {
     std::map<std::string, int> index_map;
@@ -37,6 +42,38 @@ void ReadDataset(const std::string& nodefile, const std::string& edgefile, Graph
     std::cout << "Node File: " << nodefile << "; Edge File: " << edgefile << "; Total Edges: " << e_index << "\n";
 }
 
+void ReadDataset(const std::string& nodefile, const std::string& edgefile, CSRGraph* graph) {
+    std::map<std::string, int> index_map;
+    char buffer[256];
+    int index = 0;
+
+    std::ifstream fin(nodefile);
+    while (fin.getline(buffer, 256))
+        index_map[std::string(buffer)] = index++;
+
+    std::ifstream fin2(edgefile);
+    char w1[256], w2[256];
+    double weight;
+    CSRGraphBuilder builder(index);
+
+    int e_index = 0;
+    while (fin2.getline(buffer, 256)) {
+        std::istringstream is(buffer);
+        is.getline(w1, 256, '\t');
+        is.getline(w2, 256, '\t');
+        is >> weight;
+        int w1_index = index_map[std::string(w1)];
+        int w2_index = index_map[std::string(w2)];
+        if (w1_index < w2_index) {
+            builder.AddEdge(w1_index, w2_index);
+            ++e_index;
+        }
+    }
+    builder.Build(graph, false);
+
+    std::cout << "Node File: " << nodefile << "; Edge File: " << edgefile << "; Total Edges: " << e_index << "\n";
+}
+
 void ReadDirectedDataset(const std::string& nodefile, const std::string& edgefile, DGraph* graph) {
     std::map<std::string, int> index_map;
     char buffer[256];
@@ -92,4 +129,65 @@ void ReadLabel(const std::string& nodefile, const std::string& labelfile, Label*
     }
 
     std::cout << "Node File: " << nodefile << "; Label File: " << labelfile << "; Total Labels: " << label->card << "\n";
-}
\ No newline at end of file
+}
+void ReadNodeNames(const std::string& nodefile, std::vector<std::string>* node_name) {
+    std::ifstream fin(nodefile);
+    std::string line;
+    node_name->clear();
+    while (std::getline(fin, line))
+        node_name->push_back(line);
+}
+
+bool ReadEmbedding(const std::string& nodefile, const std::string& embedding_file, bool line_binary,
+                   std::vector<std::string>* node_name, int* dim, std::vector<real>* matrix) {
+    ReadNodeNames(nodefile, node_name);
+    std::unordered_map<std::string, int> index_map;
+    for (int i = 0; i < (int)node_name->size(); ++i)
+        index_map[node_name->at(i)] = i;
+
+    std::ifstream fin(embedding_file, std::ios::binary);
+    std::string line;
+    int n;
+    if (!std::getline(fin, line) || !(std::istringstream(line) >> n >> *dim) || *dim <= 0) return false;
+    matrix->assign(node_name->size() * (size_t)*dim, 0);
+
+    if (line_binary) {
+        // line-package rows: key, a space, dim raw floats, a newline
+        std::vector<float> value(*dim);
+        std::string key;
+        for (int i = 0; i < n; ++i) {
+            if (!std::getline(fin, key, ' ')) return false;
+            if (!key.empty() && key[0] == '\n')
+                key.erase(0, 1);
+            if (!fin.read((char*)value.data(), *dim * sizeof(float))) return false;
+            auto it = index_map.find(key);
+            if (it != index_map.end())
+                std::copy(value.begin(), value.end(), matrix->begin() + (size_t)it->second * *dim);
+        }
+        return true;
+    }
+
+    // Text rows end with dim values; everything before them is the key, which may contain spaces
+    std::vector<size_t> start, end;
+    for (int i = 0; i < n && std::getline(fin, line); ++i) {
+        start.clear();
+        end.clear();
+        for (size_t p = 0; p < line.size();) {
+            while (p < line.size() && isspace((unsigned char)line[p]))
+                ++p;
+            if (p == line.size()) break;
+            start.push_back(p);
+            while (p < line.size() && !isspace((unsigned char)line[p]))
+                ++p;
+            end.push_back(p);
+        }
+        int count = start.size();
+        if (count <= *dim) continue;
+        auto it = index_map.find(line.substr(start[0], end[count - *dim - 1] - start[0]));
+        if (it == index_map.end()) continue;
+        real* row = matrix->data() + (size_t)it->second * *dim;
+        for (int j = 0; j < *dim; ++j)
+            row[j] = (real)strtod(line.c_str() + start[count - *dim + j], nullptr);
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+
+#define QUERY_BLOCK 32
+#define TARGET_BLOCK 2048
+
+namespace {
+    typedef std::pair<double, int> ScoredNode;
+    // Min-heap on score, so the weakest of the current top k sits on top
+    typedef std::priority_queue<ScoredNode, std::vector<ScoredNode>, std::greater<ScoredNode>> TopKHeap;
+
+    void Offer(TopKHeap* heap, int k, int y, double score) {
+        if ((int)heap->size() < k) {
+            heap->push(ScoredNode(score, y));
+        } else if (score > heap->top().first) {
+            heap->pop();
+            heap->push(ScoredNode(score, y));
+        }
+    }
+
+    void PopSorted(TopKHeap* heap, std::vector<std::pair<int, double>>* result) {
+        result->resize(heap->size());
+        for (int i = heap->size() - 1; i >= 0; --i) {
+            result->at(i) = std::make_pair(heap->top().second, heap->top().first);
+            heap->pop();
+        }
+    }
+
+    void ExcludedNodes(const Graph& exclude, int x, std::vector<int>* excluded) {
+        excluded->clear();
+        if (x < exclude.size)
+            excluded->assign(exclude.edge[x].begin(), exclude.edge[x].end());
+        excluded->push_back(x);
+        std::sort(excluded->begin(), excluded->end());
+    }
+}   // anonymous namespace
+
+void RecommendTopK(Model* model, const Graph& exclude, const std::vector<int>& query, int k,
+                   std::vector<std::vector<std::pair<int, double>>>* result) {
+    int size = exclude.size;
+    result->assign(query.size(), std::vector<std::pair<int, double>>());
+    int batches = (query.size() + QUERY_BLOCK - 1) / QUERY_BLOCK;
+    bool inner_product = size > 0 && model->GetTargetEmbedding(0).size() > 0;
+
+    std::vector<const real*> target;
+    int dim = 0;
+    if (inner_product) {
+        dim = model->GetTargetEmbedding(0).size();
+        target.resize(size);
+        for (int y = 0; y < size; ++y)
+            target[y] = model->GetTargetEmbedding(y).data();
+    }
+    const VectorKernel& kernel = GetVectorKernel(dim);
+
+    // Each batch of queries sweeps the targets block by block, so a block of target rows is reused
+    // by every query of the batch while it is still in cache
+    auto process_batch = [&](int batch) {
+        int first = batch * QUERY_BLOCK, last = std::min((int)query.size(), first + QUERY_BLOCK);
+        std::vector<TopKHeap> heap(last - first);
+        std::vector<std::vector<int>> excluded(last - first);
+        std::vector<size_t> cursor(last - first, 0);
+        std::vector<const real*> source(last - first);
+        for (int q = first; q < last; ++q) {
+            ExcludedNodes(exclude, query[q], &excluded[q - first]);
+            if (inner_product)
+                source[q - first] = model->GetSourceEmbedding(query[q]).data();
+        }
+        for (int block = 0; block < size; block += TARGET_BLOCK) {
+            int end = std::min(size, block + TARGET_BLOCK);
+            for (int q = 0; q < last - first; ++q) {
+                const std::vector<int>& skip = excluded[q];
+                size_t& c = cursor[q];
+                for (int y = block; y < end; ++y) {
+                    while (c < skip.size() && skip[c] < y)
+                        ++c;
+                    if (c < skip.size() && skip[c] == y)
+                        continue;
+                    double score = inner_product ? kernel.inner_product(source[q], target[y], dim)
+                                                 : model->Evaluate(query[first + q], y);
+                    Offer(&heap[q], k, y, score);
+                }
+            }
+        }
+        for (int q = first; q < last; ++q)
+            PopSorted(&heap[q - first], &result->at(q));
+    };
+    if (inner_product || model->IsThreadSafe()) {
+        ParallelFor(batches, process_batch);
+    } else {
+        for (int batch = 0; batch < batches; ++batch)
+            process_batch(batch);
+    }
+}
+
+void EvaluateRanking(Model* model, const Graph& train, const Graph& test, int k, double* hits, double* mrr) {
+    std::vector<int> query;
+    for (int x = 0; x < test.size; ++x)
+        if (!test.edge[x].empty())
+            query.push_back(x);
+    std::vector<std::vector<std::pair<int, double>>> result;
+    RecommendTopK(model, train, query, k, &result);
+
+    long long found = 0, total = 0;
+    double reciprocal = 0;
+    std::vector<bool> relevant(test.size, false);
+    for (int q = 0; q < (int)query.size(); ++q) {
+        int x = query[q];
+        for (int y : test.edge[x])
+            relevant[y] = true;
+        bool first = true;
+        for (int r = 0; r < (int)result[q].size(); ++r)
+            if (relevant[result[q][r].first]) {
+                ++found;
+                if (first)
+                    reciprocal += 1.0 / (r + 1);
+                first = false;
+            }
+        total += test.edge[x].size();
+        for (int y : test.edge[x])
+            relevant[y] = false;
+    }
+    *hits = total > 0 ? (double)found / total : 0;
+    *mrr = query.empty() ? 0 : reciprocal / query.size();
+}
@@ -0,0 +1,118 @@
+#include "base.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace {
+    void ComputeOrder(const std::vector<std::vector<int>>& edge, const std::vector<int>& degree, NodeOrder type, std::vector<int>* perm) {
+        int size = degree.size();
+        std::vector<int> by_degree(size);
+        for (int i = 0; i < size; ++i)
+            by_degree[i] = i;
+        std::stable_sort(by_degree.begin(), by_degree.end(), [&degree](int a, int b) { return degree[a] > degree[b]; });
+        if (type == ORDER_DEGREE) {
+            // by_degree[k] is the old id placed at position k
+            InvertPermutation(by_degree, perm);
+            return;
+        }
+
+        // Reverse Cuthill-McKee: BFS from a low-degree node of each component, visiting neighbors
+        // by increasing degree, then reverse the whole sequence
+        std::vector<int> order;
+        std::vector<bool> visited(size, false);
+        std::vector<int> neighbor;
+        order.reserve(size);
+        for (int k = size - 1; k >= 0; --k) {
+            int start = by_degree[k];
+            if (visited[start]) continue;
+            int head = order.size();
+            order.push_back(start);
+            visited[start] = true;
+            while (head < (int)order.size()) {
+                int x = order[head++];
+                neighbor.clear();
+                for (int y : edge[x])
+                    if (!visited[y]) {
+                        visited[y] = true;
+                        neighbor.push_back(y);
+                    }
+                std::stable_sort(neighbor.begin(), neighbor.end(), [&degree](int a, int b) { return degree[a] < degree[b]; });
+                order.insert(order.end(), neighbor.begin(), neighbor.end());
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        InvertPermutation(order, perm);
+    }
+
+    void PermuteAdjacency(const std::vector<int>& perm, std::vector<std::vector<int>>* edge) {
+        std::vector<std::vector<int>> permuted(edge->size());
+        for (int x = 0; x < (int)edge->size(); ++x) {
+            std::vector<int>& list = permuted[perm[x]];
+            list.swap(edge->at(x));
+            for (int& y : list)
+                y = perm[y];
+            std::sort(list.begin(), list.end());
+        }
+        edge->swap(permuted);
+    }
+
+    class PermutedModel : public Model {
+        Model* model_;
+        std::vector<int> perm_;
+      public:
+        PermutedModel(Model* model, const std::vector<int>& perm) : model_(model), perm_(perm) {}
+        double Evaluate(int x, int y) { return model_->Evaluate(perm_[x], perm_[y]); }
+        EmbeddingView GetEmbedding(int x) { return model_->GetEmbedding(perm_[x]); }
+        bool IsThreadSafe() { return model_->IsThreadSafe(); }
+        EmbeddingView GetSourceEmbedding(int x) { return model_->GetSourceEmbedding(perm_[x]); }
+        EmbeddingView GetTargetEmbedding(int x) { return model_->GetTargetEmbedding(perm_[x]); }
+    };
+}   // anonymous namespace
+
+void ComputeNodeOrder(const Graph& graph, NodeOrder type, std::vector<int>* perm) {
+    std::vector<int> degree(graph.size);
+    for (int i = 0; i < graph.size; ++i)
+        degree[i] = graph.edge[i].size();
+    ComputeOrder(graph.edge, degree, type, perm);
+}
+
+void ComputeNodeOrder(const DGraph& graph, NodeOrder type, std::vector<int>* perm) {
+    // Order on the underlying undirected graph so both edge directions stay local
+    std::vector<std::vector<int>> edge(graph.size);
+    std::vector<int> degree(graph.size);
+    for (int i = 0; i < graph.size; ++i) {
+        edge[i] = graph.out_edge[i];
+        edge[i].insert(edge[i].end(), graph.in_edge[i].begin(), graph.in_edge[i].end());
+        degree[i] = edge[i].size();
+    }
+    ComputeOrder(edge, degree, type, perm);
+}
+
+void PermuteGraph(const std::vector<int>& perm, Graph* graph) {
+    PermuteAdjacency(perm, &graph->edge);
+}
+
+void PermuteGraph(const std::vector<int>& perm, DGraph* graph) {
+    PermuteAdjacency(perm, &graph->out_edge);
+    PermuteAdjacency(perm, &graph->in_edge);
+}
+
+void PermuteLabel(const std::vector<int>& perm, Label* label) {
+    std::vector<bool> labeled(label->size, false);
+    for (std::vector<int>& instance : label->label_instance)
+        for (int& x : instance)
+            x = perm[x];
+    for (int x = 0; x < label->size; ++x)
+        labeled[perm[x]] = label->labeled[x];
+    label->labeled.swap(labeled);
+}
+
+void InvertPermutation(const std::vector<int>& perm, std::vector<int>* inverse) {
+    inverse->assign(perm.size(), 0);
+    for (int x = 0; x < (int)perm.size(); ++x)
+        inverse->at(perm[x]) = x;
+}
+
+Model* GetPermutedModel(Model* model, const std::vector<int>& perm) {
+    return new PermutedModel(model, perm);
+}
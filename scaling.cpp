@@ -0,0 +1,274 @@
+#include "benchmark.h"
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <iostream>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define TEST_FRACTION 0.1
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct ScalingModel {
+        const char* name;
+        bool directed, has_dim;
+    };
+
+    const ScalingModel kModels[] = {
+        {"FiniteEmbedding", false, true},
+        {"FiniteSGD", false, true},
+        {"FiniteContrastEmbedding", false, true},
+        {"DirectedFiniteEmbedding", true, true},
+        {"DirectedFiniteContrastEmbedding", true, true},
+        {"CommonNeighbor", false, false},
+        {"AdamicAdar", false, false},
+        {"RandomizedSVD", false, true},
+    };
+
+    const ScalingModel* FindModel(const std::string& name) {
+        for (const ScalingModel& model : kModels)
+            if (name == model.name) return &model;
+        return nullptr;
+    }
+
+    // Everything a point measures, as plain data so a child process can hand it back through a pipe
+    struct Measurement {
+        long long edges;
+        double load_seconds, sample_seconds, remove_seconds, train_seconds, evaluate_seconds;
+        double average_precision;
+        long long peak_rss_bytes;
+    };
+
+    double Seconds(Clock::time_point begin) {
+        return std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+
+    // Hyperparameters follow the YouTube setting of main.cpp
+    Model* Train(const std::string& name, int dim, const Graph& graph, const Graph& negative,
+                 const DGraph& d_graph, const DGraph& d_negative) {
+        if (name == "FiniteEmbedding") return GetFiniteEmbedding(graph, negative, dim, 0.03, 1);
+        if (name == "FiniteSGD") return GetFiniteSGD(graph, negative, dim, 0.03, 1);
+        if (name == "FiniteContrastEmbedding") return GetFiniteContrastEmbedding(graph, negative, 4, dim, 30);
+        if (name == "DirectedFiniteEmbedding") return GetDirectedFiniteEmbedding(d_graph, d_negative, dim, 0.03, 5);
+        if (name == "DirectedFiniteContrastEmbedding")
+            return GetDirectedFiniteContrastEmbedding(d_graph, d_negative, 4, dim, 50);
+        if (name == "CommonNeighbor") return GetCommonNeighbor(graph, 120);
+        if (name == "AdamicAdar") return GetAdamicAdar(graph);
+        return GetRandomizedSVD(graph, dim);
+    }
+
+    // Generated graph split into train and test edges
+    void Load(const ScalingModel& model, int size, int degree, Graph* train, Graph* test, DGraph* d_train, DGraph* d_test) {
+        SyntheticGraphConfig config;
+        config.model = SYNTHETIC_SBM;
+        config.size = size;
+        config.edges = (long long)size * degree / 2;
+        std::mt19937 split_gen(size);
+        std::bernoulli_distribution held_out(TEST_FRACTION);
+        if (model.directed) {
+            DGraph graph;
+            GenerateGraph(config, &graph, nullptr);
+            *d_train = DGraph(size);
+            *d_test = DGraph(size);
+            for (int x = 0; x < size; ++x)
+                for (int y : graph.out_edge[x])
+                    (held_out(split_gen) ? d_test : d_train)->AddEdge(x, y);
+        } else {
+            Graph graph;
+            GenerateGraph(config, &graph, nullptr);
+            *train = Graph(size);
+            *test = Graph(size);
+            for (int x = 0; x < size; ++x)
+                for (int y : graph.edge[x])
+                    if (x < y)
+                        (held_out(split_gen) ? test : train)->AddEdge(x, y);
+        }
+    }
+
+    long long ArcCount(const std::vector<std::vector<int>>& edge) {
+        long long count = 0;
+        for (const std::vector<int>& list : edge)
+            count += list.size();
+        return count;
+    }
+
+    // The stages of main.cpp, timed one by one
+    Measurement Measure(const ScalingModel& model, int size, int dim, int threads, int degree) {
+        SetThreadCount(threads);
+        Measurement m;
+        Graph train, test, negative, neg_test;
+        DGraph d_train, d_test, d_negative, d_neg_test;
+
+        Clock::time_point begin = Clock::now();
+        Load(model, size, degree, &train, &test, &d_train, &d_test);
+        m.load_seconds = Seconds(begin);
+
+        begin = Clock::now();
+        if (model.directed) {
+            d_negative = DGraph(size);
+            d_neg_test = DGraph(size);
+            SampleNegativeDGraphUniform(d_train, &d_negative);
+            SampleNegativeDGraphUniform(d_test, &d_neg_test);
+        } else {
+            negative = Graph(size);
+            neg_test = Graph(size);
+            SampleNegativeGraphUniform(train, &negative);
+            SampleNegativeGraphUniform(test, &neg_test);
+        }
+        m.sample_seconds = Seconds(begin);
+
+        begin = Clock::now();
+        if (model.directed) {
+            RemoveRedundant(d_train, &d_negative);
+            RemoveRedundant(d_train, &d_neg_test);
+            RemoveRedundant(d_test, &d_neg_test);
+        } else {
+            RemoveRedundant(train, &negative);
+            RemoveRedundant(train, &neg_test);
+            RemoveRedundant(test, &neg_test);
+        }
+        m.remove_seconds = Seconds(begin);
+
+        begin = Clock::now();
+        std::unique_ptr<Model> trained(Train(model.name, dim, train, negative, d_train, d_negative));
+        m.train_seconds = Seconds(begin);
+        m.edges = model.directed ? ArcCount(d_train.out_edge) : ArcCount(train.edge) / 2;
+
+        begin = Clock::now();
+        if (model.directed)
+            m.average_precision = EvaluateAveragePrecision(trained.get(), d_test, d_neg_test);
+        else
+            m.average_precision = EvaluateAveragePrecision(trained.get(), test, neg_test);
+        m.evaluate_seconds = Seconds(begin);
+        m.peak_rss_bytes = PeakResidentBytes();
+        return m;
+    }
+
+    // Runs a point in a forked child so that its peak RSS is its own; falls back to running in process
+    bool MeasureIsolated(const ScalingModel& model, int size, int dim, int threads, int degree, Measurement* m) {
+#ifndef _WIN32
+        int fd[2];
+        if (pipe(fd) == 0) {
+            std::cout.flush();
+            std::cerr.flush();
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fd[0]);
+                Measurement result = Measure(model, size, dim, threads, degree);
+                bool sent = write(fd[1], &result, sizeof(result)) == (ssize_t)sizeof(result);
+                _exit(sent ? 0 : 1);
+            }
+            close(fd[1]);
+            size_t got = 0;
+            while (pid > 0 && got < sizeof(Measurement)) {
+                ssize_t n = read(fd[0], (char*)m + got, sizeof(Measurement) - got);
+                if (n <= 0) break;
+                got += n;
+            }
+            close(fd[0]);
+            if (pid > 0) {
+                int status;
+                waitpid(pid, &status, 0);
+                return got == sizeof(Measurement) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            }
+        }
+#endif
+        *m = Measure(model, size, dim, threads, degree);
+        return true;
+    }
+
+    void RunSeries(const std::string& mode, const ScalingModel& model, int dim, const ScalingConfig& config,
+                   int size, std::vector<ScalingResult>* results) {
+        double base_train = 0;
+        for (int threads : config.threads) {
+            int point_size = mode == "weak" ? config.weak_size * threads : size;
+            ScalingResult r;
+            Measurement m;
+            r.ok = MeasureIsolated(model, point_size, dim, threads, config.degree, &m);
+            if (!r.ok)
+                m = Measurement();
+            r.mode = mode;
+            r.model = model.name;
+            r.size = point_size;
+            r.dim = model.has_dim ? dim : 0;
+            r.threads = threads;
+            r.edges = m.edges;
+            r.load_seconds = m.load_seconds;
+            r.sample_seconds = m.sample_seconds;
+            r.remove_seconds = m.remove_seconds;
+            r.train_seconds = m.train_seconds;
+            r.evaluate_seconds = m.evaluate_seconds;
+            r.average_precision = m.average_precision;
+            r.peak_rss_bytes = m.peak_rss_bytes;
+            r.train_edges_per_second = r.ok && m.train_seconds > 0 ? m.edges / m.train_seconds : 0;
+            if (r.ok && base_train == 0)
+                base_train = m.train_seconds;
+            r.train_scaling = r.ok && m.train_seconds > 0 ? base_train / m.train_seconds : 0;
+            std::cerr << mode << " " << r.model << " size=" << r.size << " dim=" << r.dim << " threads=" << threads
+                      << (r.ok ? "" : " FAILED") << " train=" << r.train_seconds << "s\n";
+            results->push_back(r);
+        }
+    }
+}   // anonymous namespace
+
+std::vector<std::string> ScalingModels() {
+    std::vector<std::string> names;
+    for (const ScalingModel& model : kModels)
+        names.push_back(model.name);
+    return names;
+}
+
+void RunScaling(const ScalingConfig& config, std::vector<ScalingResult>* results) {
+    int threads = GetThreadCount();
+    std::vector<const ScalingModel*> models;
+    for (const std::string& name : config.models) {
+        const ScalingModel* model = FindModel(name);
+        if (model == nullptr)
+            std::cerr << "Unknown model " << name << "\n";
+        else
+            models.push_back(model);
+    }
+    for (int size : config.sizes)
+        for (const ScalingModel* model : models)
+            for (int i = 0; i < (model->has_dim ? (int)config.dims.size() : 1); ++i)
+                RunSeries("strong", *model, config.dims[i], config, size, results);
+    if (config.weak_size > 0)
+        for (const ScalingModel* model : models)
+            for (int i = 0; i < (model->has_dim ? (int)config.dims.size() : 1); ++i)
+                RunSeries("weak", *model, config.dims[i], config, 0, results);
+    SetThreadCount(threads);
+}
+
+void WriteScalingCsv(const std::vector<ScalingResult>& results, std::ostream& out) {
+    out << "mode,model,size,edges,dim,threads,load_seconds,sample_seconds,remove_seconds,train_seconds,"
+           "evaluate_seconds,average_precision,peak_rss_bytes,train_edges_per_second,train_scaling,ok\n";
+    for (const ScalingResult& r : results)
+        out << r.mode << "," << r.model << "," << r.size << "," << r.edges << "," << r.dim << "," << r.threads << ","
+            << r.load_seconds << "," << r.sample_seconds << "," << r.remove_seconds << "," << r.train_seconds << ","
+            << r.evaluate_seconds << "," << r.average_precision << "," << r.peak_rss_bytes << ","
+            << r.train_edges_per_second << "," << r.train_scaling << "," << (r.ok ? 1 : 0) << "\n";
+}
+
+void WriteScalingJson(const std::vector<ScalingResult>& results, std::ostream& out) {
+    out << "{\n  \"real_size\": " << sizeof(real) << ",\n  \"points\": [\n";
+    for (int i = 0; i < (int)results.size(); ++i) {
+        const ScalingResult& r = results[i];
+        out << "    {\"mode\": \"" << r.mode << "\", \"model\": \"" << r.model << "\", \"size\": " << r.size
+            << ", \"edges\": " << r.edges << ", \"dim\": " << r.dim << ", \"threads\": " << r.threads
+            << ", \"load_seconds\": " << r.load_seconds << ", \"sample_seconds\": " << r.sample_seconds
+            << ", \"remove_seconds\": " << r.remove_seconds << ", \"train_seconds\": " << r.train_seconds
+            << ", \"evaluate_seconds\": " << r.evaluate_seconds << ", \"average_precision\": " << r.average_precision
+            << ", \"peak_rss_bytes\": " << r.peak_rss_bytes << ", \"train_edges_per_second\": "
+            << r.train_edges_per_second << ", \"train_scaling\": " << r.train_scaling
+            << ", \"ok\": " << (r.ok ? "true" : "false") << "}" << (i + 1 < (int)results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
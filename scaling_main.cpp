@@ -0,0 +1,58 @@
+#include "benchmark.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace {
+    std::vector<int> ParseList(const std::string& text) {
+        std::vector<int> list;
+        std::istringstream is(text);
+        std::string item;
+        while (std::getline(is, item, ','))
+            list.push_back(std::stoi(item));
+        return list;
+    }
+
+    std::vector<std::string> ParseNames(const std::string& text) {
+        std::vector<std::string> list;
+        std::istringstream is(text);
+        std::string item;
+        while (std::getline(is, item, ','))
+            list.push_back(item);
+        return list;
+    }
+}   // anonymous namespace
+
+// Usage: scaling [report.csv|report.json] [models] [sizes] [dims] [threads] [weak nodes per thread]
+// Lists are comma separated, and "all" selects every model. The report format follows the file
+// extension; without a file the CSV goes to stdout.
+int main(int argc, char* argv[]) {
+    ScalingConfig config;
+    config.models = argc > 2 && std::string(argv[2]) != "all" ? ParseNames(argv[2]) : ScalingModels();
+    config.sizes = ParseList(argc > 3 ? argv[3] : "10000,100000");
+    config.dims = ParseList(argc > 4 ? argv[4] : "16,64");
+    if (argc > 5) {
+        config.threads = ParseList(argv[5]);
+    } else {
+        for (int t = 1; t < (int)std::thread::hardware_concurrency(); t *= 2)
+            config.threads.push_back(t);
+        config.threads.push_back(std::max(1, (int)std::thread::hardware_concurrency()));
+    }
+    config.weak_size = argc > 6 ? std::stoi(argv[6]) : 10000;
+    config.degree = 20;
+
+    std::vector<ScalingResult> results;
+    RunScaling(config, &results);
+    std::string file = argc > 1 ? argv[1] : "";
+    if (file.empty()) {
+        WriteScalingCsv(results, std::cout);
+        return 0;
+    }
+    std::ofstream fout(file);
+    if (file.size() > 5 && file.substr(file.size() - 5) == ".json")
+        WriteScalingJson(results, fout);
+    else
+        WriteScalingCsv(results, fout);
+}
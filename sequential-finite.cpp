@@ -8,15 +8,16 @@
 #include <iostream>
 
 namespace {
-    std::mt19937 gen;
+    thread_local ThreadGenerator gen;
 }   // anonymous namespace
 
 #define EPOCHS 10
 
 class SequentialFiniteEmbedding : public Model {
     int size_, dim_;
+    const VectorKernel* kernel_;
     const double neg_penalty_, regularizer_;
-    std::vector<std::vector<double>> embedding;
+    std::vector<std::vector<real>> embedding;
     std::vector<std::vector<double>> coeff;
     std::vector<double> sqr_norm;
     std::vector<bool> estimated;
@@ -25,10 +26,12 @@ class SequentialFiniteEmbedding : public Model {
 public:
     SequentialFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer);
     double Evaluate(int x, int y);
+    EmbeddingView GetSourceEmbedding(int x) { return embedding[x]; }
+    EmbeddingView GetTargetEmbedding(int x) { return embedding[x]; }
 };
 
 void SequentialFiniteEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
-    std::vector<const double*> feature;
+    std::vector<const real*> feature;
     std::vector<int> label;
     std::vector<double> penalty_coeff, margin, f_sqr_norm;
     for (int i : positive.edge[x])
@@ -37,7 +40,7 @@ void SequentialFiniteEmbedding::UpdateEmbedding(const Graph& positive, const Gra
         label.push_back(1);
         penalty_coeff.push_back(1 / regularizer_);
         margin.push_back(1);
-        f_sqr_norm.push_back(InnerProduct(embedding[i].data(), embedding[i].data(), dim_));
+        f_sqr_norm.push_back(kernel_->inner_product(embedding[i].data(), embedding[i].data(), dim_));
     }
     for (int i : negative.edge[x]) 
     if (estimated[i]) {
@@ -45,23 +48,24 @@ void SequentialFiniteEmbedding::UpdateEmbedding(const Graph& positive, const Gra
         label.push_back(-1);
         penalty_coeff.push_back(neg_penalty_ / regularizer_);
         margin.push_back(1);
-        f_sqr_norm.push_back(InnerProduct(embedding[i].data(), embedding[i].data(), dim_));
+        f_sqr_norm.push_back(kernel_->inner_product(embedding[i].data(), embedding[i].data(), dim_));
     }
     coeff[x].resize(label.size());
 
     for (int i = 0; i < EPOCHS; ++i)
-        LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &coeff[x], &embedding[x], dim_, false);
+        LinearSVM(feature, f_sqr_norm, label, penalty_coeff, margin, &coeff[x], embedding[x].data(), *kernel_, dim_, false);
 
     std::uniform_real_distribution<double> dist(-1 / sqrt(dim_), 1 / sqrt(dim_));
     for (int j = 0; j < dim_; ++j)
         embedding[x][j] += dist(gen);
-    sqr_norm[x] = InnerProduct(embedding[x].data(), embedding[x].data(), dim_);
+    sqr_norm[x] = kernel_->inner_product(embedding[x].data(), embedding[x].data(), dim_);
     estimated[x] = true;
 }
 
 SequentialFiniteEmbedding::SequentialFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) :
     size_(graph.size),
     dim_(dimension),
+    kernel_(&GetVectorKernel(dimension)),
     neg_penalty_(neg_penalty),
     regularizer_(regularizer) {
     embedding.resize(size_);
@@ -81,7 +85,7 @@ SequentialFiniteEmbedding::SequentialFiniteEmbedding(const Graph& graph, const G
 }
 
 double SequentialFiniteEmbedding::Evaluate(int x, int y) {
-    return InnerProduct(embedding[x].data(), embedding[y].data(), dim_);
+    return kernel_->inner_product(embedding[x].data(), embedding[y].data(), dim_);
 }
 
 Model* GetSequentialFiniteEmbedding(const Graph& graph, const Graph& negative, int dimension, double neg_penalty, double regularizer) {
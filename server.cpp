@@ -0,0 +1,388 @@
+#include "server.h"
+#include "utility.h"
+
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define READ_CHUNK 65536
+// Longest request line; a connection that sends more without a newline is dropped
+#define MAX_LINE (1 << 20)
+
+namespace {
+    bool SendAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // Moves every complete line of buffer into lines, leaving a partial last line in place
+    void SplitLines(std::string* buffer, std::vector<std::string>* lines) {
+        size_t begin = 0, end;
+        while ((end = buffer->find('\n', begin)) != std::string::npos) {
+            size_t last = end;
+            if (last > begin && (*buffer)[last - 1] == '\r')
+                --last;
+            lines->push_back(buffer->substr(begin, last - begin));
+            begin = end + 1;
+        }
+        buffer->erase(0, begin);
+    }
+
+    void SetNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    std::string Format(double value) {
+        std::ostringstream os;
+        os << std::setprecision(12) << value;
+        return os.str();
+    }
+}   // anonymous namespace
+
+ScoringServer::ScoringServer(Model* model, int size, int threads)
+    : model_(model), size_(size), threads_(std::max(1, threads)), port_(0), listen_fd_(-1), exclude_(size),
+      stopping_(false), requests_(0), start_time_(std::chrono::steady_clock::now()) {
+    wake_[0] = wake_[1] = -1;
+    for (int b = 0; b < kBuckets; ++b)
+        latency_[b] = 0;
+}
+
+ScoringServer::~ScoringServer() {
+    Stop();
+}
+
+bool ScoringServer::Start(int port) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) return false;
+    int yes = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t len = sizeof(addr);
+    if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 128) != 0 ||
+        getsockname(listen_fd_, (sockaddr*)&addr, &len) != 0 || pipe(wake_) != 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    SetNonBlocking(listen_fd_);
+    SetNonBlocking(wake_[0]);
+    SetNonBlocking(wake_[1]);
+    port_ = ntohs(addr.sin_port);
+    stopping_ = false;
+    start_time_ = std::chrono::steady_clock::now();
+    for (int i = 0; i < threads_; ++i)
+        workers_.push_back(std::thread(&ScoringServer::WorkerLoop, this));
+    poller_ = std::thread(&ScoringServer::PollLoop, this);
+    return true;
+}
+
+void ScoringServer::Stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (listen_fd_ < 0) return;
+        stopping_ = true;
+    }
+    Wake();
+    ready_.notify_all();
+    poller_.join();
+    for (std::thread& worker : workers_)
+        worker.join();
+    workers_.clear();
+    close(listen_fd_);
+    close(wake_[0]);
+    close(wake_[1]);
+    listen_fd_ = wake_[0] = wake_[1] = -1;
+    pending_ = std::queue<Batch>();
+    finished_.clear();
+}
+
+void ScoringServer::Wake() {
+    char byte = 0;
+    // A full pipe already has a wakeup pending, so a failed write can be ignored
+    if (write(wake_[1], &byte, 1) < 0) return;
+}
+
+void ScoringServer::PollLoop() {
+    struct Connection {
+        std::string input, output;
+        // busy while a worker answers its batch; closing once the output is its last
+        bool busy, closing;
+        Connection() : busy(false), closing(false) {}
+    };
+    std::map<int, Connection> connection;
+    std::vector<pollfd> poll_fd;
+    std::vector<char> chunk(READ_CHUNK);
+    auto drop = [&](int fd) {
+        close(fd);
+        connection.erase(fd);
+    };
+    while (true) {
+        // Busy connections are not polled, so nothing more is read from them and they cannot be closed
+        // under a worker. The others wait for room to send their output, or else for requests.
+        poll_fd.clear();
+        poll_fd.push_back({listen_fd_, POLLIN, 0});
+        poll_fd.push_back({wake_[0], POLLIN, 0});
+        for (auto& entry : connection)
+            if (!entry.second.busy)
+                poll_fd.push_back({entry.first, (short)(entry.second.output.empty() ? POLLIN : POLLOUT), 0});
+        if (poll(poll_fd.data(), poll_fd.size(), -1) < 0 && errno != EINTR) break;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (stopping_) break;
+            for (auto& done : finished_) {
+                Connection& c = connection[done.first];
+                c.busy = false;
+                c.output += done.second;
+            }
+            finished_.clear();
+        }
+        char drain[256];
+        while (read(wake_[0], drain, sizeof(drain)) > 0) {}
+        if (poll_fd[0].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+                SetNonBlocking(fd);
+                connection[fd];
+            }
+        }
+
+        for (size_t i = 2; i < poll_fd.size(); ++i) {
+            if (poll_fd[i].revents == 0) continue;
+            int fd = poll_fd[i].fd;
+            Connection& c = connection[fd];
+            if (poll_fd[i].events == POLLOUT) {
+                ssize_t n = send(fd, c.output.data(), c.output.size(), MSG_NOSIGNAL);
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+                if (n <= 0) {
+                    drop(fd);
+                    continue;
+                }
+                c.output.erase(0, n);
+                if (c.output.empty() && c.closing)
+                    drop(fd);
+                continue;
+            }
+            ssize_t n = recv(fd, chunk.data(), chunk.size(), 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+            if (n <= 0) {
+                drop(fd);
+                continue;
+            }
+            c.input.append(chunk.data(), n);
+            Batch batch;
+            batch.connection = fd;
+            SplitLines(&c.input, &batch.request);
+            if (c.input.size() > MAX_LINE) {
+                c.output = "ERR line too long\n";
+                c.closing = true;
+                continue;
+            }
+            // Everything that arrived in one read is handled as one batch
+            if (batch.request.empty()) continue;
+            c.busy = true;
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                pending_.push(std::move(batch));
+            }
+            ready_.notify_one();
+        }
+    }
+    for (auto& entry : connection)
+        close(entry.first);
+}
+
+void ScoringServer::WorkerLoop() {
+    // Batches are the unit of parallelism, so each one is scored on the worker's own thread
+    SetThreadShare(1);
+    std::vector<std::string> response;
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            ready_.wait(guard, [this] { return stopping_ || !pending_.empty(); });
+            if (stopping_) return;
+            batch = std::move(pending_.front());
+            pending_.pop();
+        }
+        Handle(batch.request, &response);
+        std::string output;
+        for (const std::string& line : response) {
+            output += line;
+            output += '\n';
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            finished_.push_back(std::make_pair(batch.connection, std::move(output)));
+        }
+        Wake();
+    }
+}
+
+void ScoringServer::Handle(const std::vector<std::string>& request, std::vector<std::string>* response) {
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(model_lock_, std::defer_lock);
+    if (!model_->IsThreadSafe())
+        guard.lock();
+    response->assign(request.size(), std::string());
+    std::vector<int> topk_line, topk_query, topk_k;
+    int max_k = 0;
+    auto valid = [this](int x) { return x >= 0 && x < size_; };
+    for (int i = 0; i < (int)request.size(); ++i) {
+        std::istringstream is(request[i]);
+        std::string command;
+        is >> command;
+        std::string& out = response->at(i);
+        if (command == "SCORE") {
+            int x, y;
+            if (!(is >> x >> y) || !valid(x) || !valid(y))
+                out = "ERR SCORE expects two node ids";
+            else
+                out = "OK " + Format(model_->Evaluate(x, y));
+        } else if (command == "BATCH") {
+            std::vector<int> node;
+            int x;
+            while (is >> x)
+                node.push_back(x);
+            bool ok = is.eof() && node.size() % 2 == 0 && std::all_of(node.begin(), node.end(), valid);
+            if (!ok) {
+                out = "ERR BATCH expects pairs of node ids";
+                continue;
+            }
+            out = "OK";
+            for (int j = 0; j < (int)node.size(); j += 2)
+                out += " " + Format(model_->Evaluate(node[j], node[j + 1]));
+        } else if (command == "TOPK") {
+            int k, x;
+            if (!(is >> k >> x) || k <= 0 || !valid(x)) {
+                out = "ERR TOPK expects k and a node id";
+                continue;
+            }
+            topk_line.push_back(i);
+            topk_query.push_back(x);
+            topk_k.push_back(k);
+            max_k = std::max(max_k, k);
+        } else if (command == "STATS") {
+            out = "OK " + Stats();
+        } else {
+            out = "ERR unknown command";
+        }
+    }
+    if (!topk_query.empty()) {
+        std::vector<std::vector<std::pair<int, double>>> result;
+        RecommendTopK(model_, exclude_, topk_query, max_k, &result);
+        for (int q = 0; q < (int)topk_query.size(); ++q) {
+            std::string& out = response->at(topk_line[q]);
+            out = "OK";
+            for (int r = 0; r < (int)result[q].size() && r < topk_k[q]; ++r)
+                out += " " + std::to_string(result[q][r].first) + " " + Format(result[q][r].second);
+        }
+    }
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+    Record(micros, request.size());
+}
+
+void ScoringServer::Record(double micros, int count) {
+    int b = 0;
+    while (b + 1 < kBuckets && micros >= (double)(1LL << b))
+        ++b;
+    latency_[b] += count;
+    requests_ += count;
+}
+
+std::string ScoringServer::Stats() {
+    std::vector<long long> histogram(kBuckets);
+    long long total = 0;
+    for (int b = 0; b < kBuckets; ++b)
+        total += histogram[b] = latency_[b];
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+    // Percentiles are reported as the upper bound of their bucket
+    auto percentile = [&](double p) {
+        long long seen = 0;
+        for (int b = 0; b < kBuckets; ++b) {
+            seen += histogram[b];
+            if (seen > 0 && seen >= p * total)
+                return 1LL << b;
+        }
+        return 0LL;
+    };
+    int last = kBuckets - 1;
+    while (last > 0 && histogram[last] == 0)
+        --last;
+    std::ostringstream os;
+    os << "requests=" << (long long)requests_ << " qps=" << Format(elapsed > 0 ? requests_ / elapsed : 0)
+       << " p50_us=" << percentile(0.5) << " p99_us=" << percentile(0.99) << " histogram=";
+    for (int b = 0; b <= last; ++b)
+        os << (b > 0 ? "," : "") << histogram[b];
+    return os.str();
+}
+
+bool ScoringClient::Connect(int port) {
+    Close();
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) return false;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd_, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void ScoringClient::Close() {
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    buffer_.clear();
+}
+
+bool ScoringClient::Request(const std::vector<std::string>& request, std::vector<std::string>* response) {
+    std::string output;
+    for (const std::string& line : request) {
+        output += line;
+        output += '\n';
+    }
+    if (fd_ < 0 || !SendAll(fd_, output)) return false;
+    response->clear();
+    std::vector<char> chunk(READ_CHUNK);
+    while (true) {
+        SplitLines(&buffer_, response);
+        if (response->size() >= request.size()) return true;
+        ssize_t n = recv(fd_, chunk.data(), chunk.size(), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer_.append(chunk.data(), n);
+    }
+}
+
+std::string ScoringClient::Request(const std::string& request) {
+    std::vector<std::string> response;
+    if (!Request(std::vector<std::string>(1, request), &response)) return std::string();
+    return response[0];
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <queue>
+#include <chrono>
+#include "base.h"
+
+// Line protocol, one response line per request line:
+//   SCORE x y             -> OK s
+//   BATCH x1 y1 x2 y2 ... -> OK s1 s2 ...
+//   TOPK k x              -> OK y1 s1 y2 s2 ...   (best first, skipping x)
+//   STATS                 -> OK requests=.. qps=.. p50_us=.. p99_us=.. histogram=..
+// Malformed requests get "ERR <reason>". Requests that arrive together on a connection are answered
+// together, and their TOPK queries are ranked in one RecommendTopK batch. One thread polls every
+// connection and queues such batches; each of the threads workers answers one batch at a time,
+// single-threaded, so idle connections hold no worker. A connection is read again once its previous
+// batch has been answered and sent. A line longer than 1 MiB closes the connection.
+class ScoringServer {
+  public:
+    // The model must outlive the server
+    ScoringServer(Model* model, int size, int threads);
+    ~ScoringServer();
+
+    // Listens on 127.0.0.1:port; port 0 picks a free port, see port()
+    bool Start(int port);
+    void Stop();
+    int port() const { return port_; }
+
+    // Answers a group of request lines without going through a socket
+    void Handle(const std::vector<std::string>& request, std::vector<std::string>* response);
+    std::string Stats();
+
+  private:
+    // Request lines read together from the connection with this socket
+    struct Batch {
+        int connection;
+        std::vector<std::string> request;
+    };
+
+    void PollLoop();
+    void WorkerLoop();
+    void Wake();
+    void Record(double micros, int count);
+
+    Model* model_;
+    int size_, threads_, port_, listen_fd_;
+    // Pipe that wakes the poll thread when a batch is answered or the server stops
+    int wake_[2];
+    Graph exclude_;
+
+    std::vector<std::thread> workers_;
+    std::thread poller_;
+    std::mutex lock_;
+    std::condition_variable ready_;
+    std::queue<Batch> pending_;
+    // Answered batches: the connection and its response lines, for the poll thread to send
+    std::vector<std::pair<int, std::string>> finished_;
+    bool stopping_;
+
+    // Latency histogram: bucket b counts requests that took [2^(b-1), 2^b) microseconds
+    static const int kBuckets = 32;
+    std::atomic<long long> latency_[kBuckets];
+    std::atomic<long long> requests_;
+    std::chrono::steady_clock::time_point start_time_;
+    // Serializes scoring for models that are not thread-safe
+    std::mutex model_lock_;
+};
+
+// Blocking client for one connection to a ScoringServer
+class ScoringClient {
+  public:
+    ScoringClient() : fd_(-1) {}
+    ~ScoringClient() { Close(); }
+    bool Connect(int port);
+    void Close();
+    // Sends the lines in one write and reads one response line for each
+    bool Request(const std::vector<std::string>& request, std::vector<std::string>* response);
+    std::string Request(const std::string& request);
+
+  private:
+    int fd_;
+    std::string buffer_;
+};
@@ -0,0 +1,32 @@
+#include "base.h"
+#include "server.h"
+
+#include <memory>
+#include <iostream>
+#include <thread>
+
+// Usage: server <snapshot file> [port] [threads]
+// Serves a snapshot written by SaveSnapshot until the process is killed
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <snapshot file> [port] [threads]\n";
+        return 1;
+    }
+    int port = argc > 2 ? std::stoi(argv[2]) : 7070;
+    int threads = argc > 3 ? std::stoi(argv[3]) : std::thread::hardware_concurrency();
+
+    int size;
+    std::unique_ptr<Model> model(GetSnapshot(argv[1], &size));
+    if (!model) {
+        std::cout << "Cannot load snapshot " << argv[1] << "\n";
+        return 1;
+    }
+    ScoringServer server(model.get(), size, threads);
+    if (!server.Start(port)) {
+        std::cout << "Cannot listen on port " << port << "\n";
+        return 1;
+    }
+    std::cout << "Serving " << size << " nodes on 127.0.0.1:" << server.port() << "\n";
+    while (true)
+        std::this_thread::sleep_for(std::chrono::hours(1));
+}
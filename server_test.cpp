@@ -0,0 +1,228 @@
+#include "base.h"
+#include "server.h"
+#include "unit_test.h"
+#include <cassert>
+#include <memory>
+#include <sstream>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+
+void SnapshotTest(Model* model, int size, const std::string& file_name) {
+    assert(SaveSnapshot(model, size, file_name));
+    int loaded_size;
+    std::unique_ptr<Model> loaded(GetSnapshot(file_name, &loaded_size));
+    assert(loaded && loaded_size == size);
+    for (int x = 0; x < size; ++x)
+        for (int y = 0; y < size; ++y)
+            assert(fabs(loaded->Evaluate(x, y) - model->Evaluate(x, y)) < 1e-9);
+    int missing;
+    assert(GetSnapshot(file_name + ".missing", &missing) == nullptr);
+}
+
+// A model trained on relabeled nodes is saved by original id; read back in file order, it answers for
+// the relabeled ids through the inverse permutation
+void ReorderedSnapshotTest(const Graph& graph, const std::string& file_name) {
+    std::vector<int> perm, inverse;
+    ComputeNodeOrder(graph, ORDER_RCM, &perm);
+    InvertPermutation(perm, &inverse);
+    bool moved = false;
+    for (int x = 0; x < graph.size; ++x)
+        moved |= perm[x] != x;
+    assert(moved);
+    Graph train = graph, negative(graph.size);
+    PermuteGraph(perm, &train);
+    SampleNegativeGraphUniform(train, &negative);
+    RemoveRedundant(train, &negative);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(train, negative, 4, 0.2, 1));
+    std::unique_ptr<Model> original(GetPermutedModel(model.get(), perm));
+    assert(SaveSnapshot(original.get(), graph.size, file_name));
+
+    int size;
+    std::unique_ptr<Model> loaded(GetSnapshot(file_name, &size));
+    assert(loaded && size == graph.size);
+    std::unique_ptr<Model> relabeled(GetPermutedModel(loaded.get(), inverse));
+    for (int x = 0; x < size; ++x)
+        for (int y = 0; y < size; ++y) {
+            double expected = model->Evaluate(perm[x], perm[y]);
+            assert(fabs(loaded->Evaluate(x, y) - expected) < 1e-9);
+            assert(fabs(relabeled->Evaluate(perm[x], perm[y]) - expected) < 1e-9);
+        }
+}
+
+void ScoringServerTest(const std::string& file_name) {
+    int size;
+    std::unique_ptr<Model> model(GetSnapshot(file_name, &size));
+    ScoringServer server(model.get(), size, 2);
+    assert(server.Start(0));
+    ScoringClient client;
+    assert(client.Connect(server.port()));
+
+    double score;
+    std::string status;
+    std::istringstream(client.Request("SCORE 0 3")) >> status >> score;
+    assert(status == "OK" && fabs(score - model->Evaluate(0, 3)) < 1e-9);
+
+    std::istringstream batch(client.Request("BATCH 1 2 5 6"));
+    double s1, s2;
+    batch >> status >> s1 >> s2;
+    assert(status == "OK" && fabs(s1 - model->Evaluate(1, 2)) < 1e-9 && fabs(s2 - model->Evaluate(5, 6)) < 1e-9);
+
+    // Pipelined requests come back in order, with the TOPK queries ranked together
+    std::vector<std::string> response;
+    assert(client.Request({"TOPK 2 1", "SCORE 0 99", "TOPK 3 4", "HELLO"}, &response));
+    assert(response.size() == 4);
+    assert(response[1].substr(0, 3) == "ERR" && response[3].substr(0, 3) == "ERR");
+    std::vector<std::vector<std::pair<int, double>>> exact;
+    RecommendTopK(model.get(), Graph(size), {1, 4}, 3, &exact);
+    for (int q = 0; q < 2; ++q) {
+        std::istringstream is(response[q * 2]);
+        is >> status;
+        assert(status == "OK");
+        int count = 0, y;
+        while (is >> y >> score) {
+            assert(y == exact[q][count].first && fabs(score - exact[q][count].second) < 1e-9);
+            ++count;
+        }
+        assert(count == (q == 0 ? 2 : 3));
+    }
+
+    // A second connection sees the same counters
+    ScoringClient other;
+    assert(other.Connect(server.port()));
+    std::string stats = other.Request("STATS");
+    assert(stats.find("requests=6") != std::string::npos && stats.find("p99_us=") != std::string::npos);
+
+    // Connections that stay open between requests hold no worker, so more of them than workers all get
+    // answered, in any order
+    ScoringClient idle[5];
+    for (ScoringClient& c : idle)
+        assert(c.Connect(server.port()));
+    for (int round = 0; round < 2; ++round)
+        for (int i = 4; i >= 0; --i) {
+            std::istringstream(idle[i].Request("SCORE 1 " + std::to_string(i))) >> status >> score;
+            assert(status == "OK" && fabs(score - model->Evaluate(1, i)) < 1e-9);
+        }
+    std::istringstream(client.Request("SCORE 0 3")) >> status >> score;
+    assert(status == "OK" && fabs(score - model->Evaluate(0, 3)) < 1e-9);
+
+    // A line that never ends is cut off instead of buffered; other connections carry on
+    ScoringClient flood;
+    assert(flood.Connect(server.port()));
+    std::string reply = flood.Request(std::string(3 << 20, '1'));
+    assert(reply.empty() || reply == "ERR line too long");
+    std::istringstream(other.Request("SCORE 0 3")) >> status >> score;
+    assert(status == "OK" && fabs(score - model->Evaluate(0, 3)) < 1e-9);
+    server.Stop();
+}
+
+void EmbeddingFileTest() {
+    // Rows longer than the old 2500-character line buffer, and keys containing spaces
+    const int dim = 300;
+    std::vector<std::string> names = {"alice smith", "bob", "carol"};
+    std::ofstream node_out("embedding_test_node.txt");
+    for (const std::string& name : names)
+        node_out << name << "\n";
+    node_out.close();
+    std::ofstream text_out("embedding_test_vec.txt");
+    text_out.precision(9);
+    std::ofstream line_out("embedding_test_vec.bin", std::ios::binary);
+    text_out << "3 " << dim << "\n";
+    // line-package keys cannot contain spaces, so its file only has the last two nodes
+    line_out << "2 " << dim << "\n";
+    for (int x = 2; x >= 0; --x) {
+        text_out << names[x];
+        if (x > 0)
+            line_out << names[x] << " ";
+        for (int i = 0; i < dim; ++i) {
+            float v = (float)((x + 1) * 0.001 * (i - 150));
+            text_out << " " << v;
+            if (x > 0)
+                line_out.write((const char*)&v, sizeof(float));
+        }
+        text_out << "\n";
+        if (x > 0)
+            line_out << "\n";
+    }
+    text_out.close();
+    line_out.close();
+
+    std::unique_ptr<Model> text(GetPredefined("embedding_test_node.txt", "embedding_test_vec.txt"));
+    assert(GetPredefined("embedding_test_node.txt", "embedding_test_vec.missing") == nullptr);
+    assert(text->GetEmbedding(0).size() == dim && fabs(text->GetEmbedding(0)[dim - 1] - 0.149) < 1e-6);
+    for (bool line_binary : {false, true}) {
+        assert(ConvertEmbedding("embedding_test_node.txt", line_binary ? "embedding_test_vec.bin" : "embedding_test_vec.txt",
+                                line_binary, "embedding_test.snap"));
+        int size;
+        std::vector<std::string> loaded_names;
+        std::unique_ptr<Model> snapshot(GetSnapshot("embedding_test.snap", &size, &loaded_names));
+        assert(snapshot && size == 3 && loaded_names == names);
+        for (int x = line_binary ? 1 : 0; x < 3; ++x)
+            for (int y = line_binary ? 1 : 0; y < 3; ++y)
+                assert(fabs(snapshot->Evaluate(x, y) - text->Evaluate(x, y)) < 1e-6);
+        if (line_binary)
+            assert(snapshot->Evaluate(0, 0) == 0);
+    }
+
+    // A name offset that runs backwards would read outside the name bytes
+    std::ifstream snap_in("embedding_test.snap", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(snap_in)), std::istreambuf_iterator<char>());
+    snap_in.close();
+    long long id_offset, bad = 1LL << 40;
+    memcpy(&id_offset, bytes.data() + 24, sizeof(long long));
+    memcpy(&bytes[id_offset + sizeof(long long)], &bad, sizeof(long long));
+    std::ofstream("embedding_test.bad", std::ios::binary) << bytes;
+    int size;
+    std::vector<std::string> loaded_names;
+    assert(GetSnapshot("embedding_test.bad", &size, &loaded_names) == nullptr);
+
+    // Matrix offsets before the end of the header, including negative ones, are rejected
+    snap_in.open("embedding_test.snap", std::ios::binary);
+    bytes.assign((std::istreambuf_iterator<char>(snap_in)), std::istreambuf_iterator<char>());
+    for (long long matrix_offset : {-64LL, 0LL}) {
+        memcpy(&bytes[32], &matrix_offset, sizeof(long long));
+        std::ofstream("embedding_test.bad", std::ios::binary) << bytes;
+        assert(GetSnapshot("embedding_test.bad", &size) == nullptr);
+    }
+
+    remove("embedding_test_node.txt");
+    remove("embedding_test_vec.txt");
+    remove("embedding_test_vec.bin");
+    remove("embedding_test.snap");
+    remove("embedding_test.bad");
+}
+
+void ServerTest() {
+    Graph graph(7);
+    graph.AddEdge(0, 1);
+    graph.AddEdge(0, 2);
+    graph.AddEdge(1, 3);
+    graph.AddEdge(2, 3);
+    graph.AddEdge(3, 4);
+    graph.AddEdge(4, 5);
+    graph.AddEdge(4, 6);
+    graph.AddEdge(5, 6);
+    Graph negative(7);
+    SampleNegativeGraphUniform(graph, &negative);
+    RemoveRedundant(graph, &negative);
+    std::unique_ptr<Model> model(GetFiniteEmbedding(graph, negative, 4, 0.2, 1));
+
+    std::string file_name = "snapshot_test.bin";
+    // Directed models keep separate source and target rows
+    DGraph d_graph(4);
+    d_graph.AddEdge(0, 1);
+    d_graph.AddEdge(1, 2);
+    d_graph.AddEdge(2, 3);
+    DGraph d_negative(4);
+    SampleNegativeDGraphUniform(d_graph, &d_negative);
+    RemoveRedundant(d_graph, &d_negative);
+    std::unique_ptr<Model> directed(GetDirectedFiniteEmbedding(d_graph, d_negative, 3, 0.2, 1));
+    SnapshotTest(directed.get(), 4, file_name);
+
+    SnapshotTest(model.get(), 7, file_name);
+    ScoringServerTest(file_name);
+    ReorderedSnapshotTest(graph, file_name);
+    remove(file_name.c_str());
+    EmbeddingFileTest();
+}
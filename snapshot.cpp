@@ -0,0 +1,177 @@
+#include "base.h"
+#include "utility.h"
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <climits>
+
+#define SNAPSHOT_ALIGN 64
+
+namespace {
+    const char kMagic[8] = {'E', 'M', 'B', 'S', 'N', 'A', 'P', '1'};
+
+    // Each node owns one row of row_dim values: the target vector, followed by the source vector
+    // when the two sides differ (the [in | out] layout of the directed models). Values are float or
+    // double as given by real_size.
+    struct Header {
+        char magic[8];
+        int real_size, size, dim, shared;
+        // Byte offsets from the start of the file; id_offset is 0 when no node id table is stored.
+        // The id table holds size + 1 long long offsets into the name bytes that follow it.
+        long long id_offset, matrix_offset;
+    };
+
+    long long Align(long long offset, int align) {
+        return (offset + align - 1) / align * align;
+    }
+
+    void Pad(std::ofstream& fout, long long to) {
+        std::vector<char> zero(to - (long long)fout.tellp(), 0);
+        fout.write(zero.data(), zero.size());
+    }
+
+    // Row-major matrix read from an embedding file, used by the converters
+    class DenseMatrix : public Model {
+        int dim_;
+        const std::vector<real>& matrix_;
+      public:
+        DenseMatrix(const std::vector<real>& matrix, int dim) : dim_(dim), matrix_(matrix) {}
+        EmbeddingView GetEmbedding(int x) { return EmbeddingView(matrix_.data() + (size_t)x * dim_, dim_); }
+        EmbeddingView GetSourceEmbedding(int x) { return GetEmbedding(x); }
+        EmbeddingView GetTargetEmbedding(int x) { return GetEmbedding(x); }
+    };
+}   // anonymous namespace
+
+class Snapshot : public Model {
+    MappedFile file_;
+    int size_, dim_, row_dim_;
+    bool shared_;
+    const real* matrix_;
+    // Rows converted to real when the file stores the other floating-point width
+    std::vector<real> converted_;
+    const VectorKernel* kernel_;
+  public:
+    Snapshot() : size_(0), dim_(0), row_dim_(0), shared_(true), matrix_(nullptr), kernel_(nullptr) {}
+    bool Open(const std::string& file_name, std::vector<std::string>* node_name) {
+        Header header;
+        if (!file_.Open(file_name) || file_.size() < sizeof(Header)) return false;
+        memcpy(&header, file_.data(), sizeof(Header));
+        if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) return false;
+        if (header.real_size != sizeof(float) && header.real_size != sizeof(double)) return false;
+        if (header.size < 0 || header.dim < 0 || header.dim > INT_MAX / 2) return false;
+        // Offsets are range checked before any arithmetic, so a corrupt header cannot wrap the bounds below
+        if (header.matrix_offset < (long long)sizeof(Header) || header.matrix_offset % SNAPSHOT_ALIGN != 0 ||
+            (unsigned long long)header.matrix_offset > file_.size()) return false;
+        if (header.id_offset != 0 && (header.id_offset < (long long)sizeof(Header) ||
+            (unsigned long long)header.id_offset > file_.size())) return false;
+        size_ = header.size;
+        dim_ = header.dim;
+        shared_ = header.shared != 0;
+        row_dim_ = shared_ ? dim_ : 2 * dim_;
+        size_t values = (size_t)size_ * row_dim_;
+        if (values > (file_.size() - header.matrix_offset) / header.real_size) return false;
+        const char* matrix = file_.data() + header.matrix_offset;
+        if (header.real_size == sizeof(real)) {
+            matrix_ = (const real*)matrix;
+        } else {
+            converted_.resize(values);
+            if (header.real_size == sizeof(float))
+                std::copy((const float*)matrix, (const float*)matrix + values, converted_.begin());
+            else
+                std::copy((const double*)matrix, (const double*)matrix + values, converted_.begin());
+            matrix_ = converted_.data();
+        }
+        kernel_ = &GetVectorKernel(dim_);
+
+        if (node_name != nullptr) {
+            node_name->clear();
+            if (header.id_offset == 0) return true;
+            if ((size_t)size_ + 1 > (file_.size() - header.id_offset) / sizeof(long long)) return false;
+            const long long* offset = (const long long*)(file_.data() + header.id_offset);
+            const char* name = (const char*)(offset + size_ + 1);
+            // The offsets must start at 0 and never decrease, so every name lies inside the table
+            if (offset[0] != 0) return false;
+            for (int x = 0; x < size_; ++x)
+                if (offset[x + 1] < offset[x]) return false;
+            if ((unsigned long long)offset[size_] > file_.size() - (size_t)(name - file_.data())) return false;
+            node_name->reserve(size_);
+            for (int x = 0; x < size_; ++x)
+                node_name->push_back(std::string(name + offset[x], name + offset[x + 1]));
+        }
+        return true;
+    }
+    int size() const { return size_; }
+    const real* Row(int x) { return matrix_ + (size_t)x * row_dim_; }
+    double Evaluate(int x, int y) {
+        return kernel_->inner_product(GetSourceEmbedding(x).data(), Row(y), dim_);
+    }
+    EmbeddingView GetEmbedding(int x) { return EmbeddingView(Row(x), row_dim_); }
+    EmbeddingView GetSourceEmbedding(int x) { return EmbeddingView(Row(x) + (shared_ ? 0 : dim_), dim_); }
+    EmbeddingView GetTargetEmbedding(int x) { return EmbeddingView(Row(x), dim_); }
+};
+
+bool SaveSnapshot(Model* model, int size, const std::vector<std::string>& node_name, const std::string& file_name) {
+    if (size == 0 || model->GetTargetEmbedding(0).size() == 0) return false;
+    if (!node_name.empty() && (int)node_name.size() != size) return false;
+    std::ofstream fout(file_name, std::ios::binary);
+    if (!fout) return false;
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.real_size = sizeof(real);
+    header.size = size;
+    header.dim = model->GetTargetEmbedding(0).size();
+    header.shared = model->GetSourceEmbedding(0).data() == model->GetTargetEmbedding(0).data();
+    header.matrix_offset = Align(sizeof(Header), SNAPSHOT_ALIGN);
+    long long matrix_bytes = (long long)size * header.dim * (header.shared ? 1 : 2) * sizeof(real);
+    header.id_offset = node_name.empty() ? 0 : Align(header.matrix_offset + matrix_bytes, sizeof(long long));
+    fout.write((const char*)&header, sizeof(Header));
+    Pad(fout, header.matrix_offset);
+    for (int x = 0; x < size; ++x) {
+        EmbeddingView target = model->GetTargetEmbedding(x);
+        fout.write((const char*)target.data(), target.size() * sizeof(real));
+        if (!header.shared) {
+            EmbeddingView source = model->GetSourceEmbedding(x);
+            fout.write((const char*)source.data(), source.size() * sizeof(real));
+        }
+    }
+    if (!node_name.empty()) {
+        Pad(fout, header.id_offset);
+        std::vector<long long> offset(size + 1, 0);
+        for (int x = 0; x < size; ++x)
+            offset[x + 1] = offset[x] + node_name[x].size();
+        fout.write((const char*)offset.data(), offset.size() * sizeof(long long));
+        for (const std::string& name : node_name)
+            fout.write(name.data(), name.size());
+    }
+    return (bool)fout;
+}
+
+bool SaveSnapshot(Model* model, int size, const std::string& file_name) {
+    return SaveSnapshot(model, size, std::vector<std::string>(), file_name);
+}
+
+bool ConvertEmbedding(const std::string& node_file, const std::string& embedding_file, bool line_binary,
+                      const std::string& output_file) {
+    std::vector<std::string> node_name;
+    std::vector<real> matrix;
+    int dim;
+    if (!ReadEmbedding(node_file, embedding_file, line_binary, &node_name, &dim, &matrix)) return false;
+    DenseMatrix model(matrix, dim);
+    return SaveSnapshot(&model, node_name.size(), node_name, output_file);
+}
+
+Model* GetSnapshot(const std::string& file_name, int* size, std::vector<std::string>* node_name) {
+    Snapshot* model = new Snapshot();
+    if (!model->Open(file_name, node_name)) {
+        delete model;
+        return nullptr;
+    }
+    *size = model->size();
+    return model;
+}
+
+Model* GetSnapshot(const std::string& file_name, int* size) {
+    return GetSnapshot(file_name, size, nullptr);
+}
@@ -20,54 +20,55 @@ class SparseEmbedding : public Model {
     std::vector<std::vector<double>> coeff;
     std::vector<double> feature_buffer;
 
+    void MakeProblem(const Graph& positive, const Graph& negative, int x, std::vector<double>* buffer,
+                     std::vector<std::vector<real>>* feature, LinearSVMProblem* problem);
     void UpdateEmbedding(const Graph& positive, const Graph& negative, int x);
 public:
-    SparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer);
+    SparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer, TrainingMonitor* monitor);
     double Evaluate(int x, int y);
+    bool IsThreadSafe() { return false; }
 };
 
-void SparseEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
-    std::vector<int> label, instance;
-    std::vector<double> penalty_coeff, margin;
-    for (int i : positive.edge[x]) {
+// Neighbor i's feature is its embedding restricted to the support of x's, gathered into feature through
+// buffer, a zeroed scratch vector of size_ entries
+void SparseEmbedding::MakeProblem(const Graph& positive, const Graph& negative, int x, std::vector<double>* buffer,
+    std::vector<std::vector<real>>* feature, LinearSVMProblem* problem) {
+    std::vector<int> instance;
+    for (int i : positive.edge[x])
         instance.push_back(i);
-        label.push_back(1);
-        penalty_coeff.push_back(1 / regularizer_);
-        margin.push_back(1);
-    }
-    for (int i : negative.edge[x]) {
+    for (int i : negative.edge[x])
         instance.push_back(i);
-        label.push_back(-1);
-        penalty_coeff.push_back(neg_penalty_ / regularizer_);
-        margin.push_back(0);
-    }
-
-    std::vector<std::vector<double>> feature;
-    std::vector<double> sqr_norm;
-    for (int i : instance) {
-        int index = 0;
-        std::vector<double> vec(embedding[x].size());
+    feature->resize(instance.size());
+    for (int k = 0; k < (int)instance.size(); ++k) {
+        int i = instance[k], index = 0;
+        std::vector<real>& vec = (*feature)[k];
+        vec.assign(embedding[x].size(), 0);
         for (const auto& p : embedding[i])
-            feature_buffer[p.index] = p.value;
+            (*buffer)[p.index] = p.value;
         for (const auto& p : embedding[x])
-            vec[index ++] = feature_buffer[p.index];
+            vec[index ++] = (*buffer)[p.index];
         for (const auto& p : embedding[i])
-            feature_buffer[p.index] = 0;
-        sqr_norm.push_back(InnerProduct(vec.data(), vec.data(), vec.size()));
-        feature.push_back(std::move(vec));
+            (*buffer)[p.index] = 0;
+        bool pos = k < (int)positive.edge[x].size();
+        problem->Add(vec.data(), InnerProduct(vec.data(), vec.data(), vec.size()), pos ? 1 : -1,
+                     (pos ? 1 : neg_penalty_) / regularizer_, pos ? 1 : 0);
     }
-    std::vector<const double*> feature_ptr;
-    for (int i = 0; i < (int)instance.size(); ++i)
-        feature_ptr.push_back(feature[i].data());
+}
 
-    std::vector<double> val(embedding[x].size(), 0);
-    LinearSVM(feature_ptr, sqr_norm, label, penalty_coeff, margin, &coeff[x], &val, val.size(), false);
+void SparseEmbedding::UpdateEmbedding(const Graph& positive, const Graph& negative, int x) {
+    std::vector<std::vector<real>> feature;
+    LinearSVMProblem problem;
+    MakeProblem(positive, negative, x, &feature_buffer, &feature, &problem);
+
+    std::vector<real> val(embedding[x].size(), 0);
+    LinearSVM(problem, &coeff[x], val.data(), GetVectorKernel(val.size()), val.size(), false);
 
     for (int i = 0; i < (int)embedding[x].size(); ++i)
         embedding[x][i].value = val[i];
 }
 
-SparseEmbedding::SparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer) :
+SparseEmbedding::SparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer,
+    TrainingMonitor* monitor) :
     size_(graph.size),
     neg_penalty_(neg_penalty),
     regularizer_(regularizer) {
@@ -87,10 +88,38 @@ SparseEmbedding::SparseEmbedding(const Graph& graph, const Graph& negative, doub
     std::vector<int> order(size_);
     for (int j = 0; j < size_; ++j)
         order[j] = j;
-    for (int i = 0; i < EPOCHS; ++i) {
+    std::vector<std::vector<SparseFeature>> best;
+    std::vector<std::vector<double>> best_coeff;
+    for (int i = 0; monitor == nullptr ? i < EPOCHS : monitor->Continue(i, EPOCHS); ++i) {
+        if (monitor != nullptr)
+            monitor->BeginEpoch();
         RandomPermutation(&order);
         for (int j : order)
             UpdateEmbedding(graph, negative, j);
+        if (monitor != nullptr)
+            monitor->EndEpoch(this, i, size_, size_, [&](int x, NodeObjective* objective) {
+                // feature_buffer belongs to the training thread
+                thread_local std::vector<double> buffer;
+                buffer.resize(size_, 0);
+                std::vector<std::vector<real>> feature;
+                LinearSVMProblem problem;
+                MakeProblem(graph, negative, x, &buffer, &feature, &problem);
+                std::vector<real> val(embedding[x].size());
+                for (int k = 0; k < (int)val.size(); ++k)
+                    val[k] = embedding[x][k].value;
+                int active;
+                LinearSVMObjective(problem, coeff[x], val.data(), GetVectorKernel(val.size()), val.size(),
+                                   &objective->primal, &objective->dual, &active);
+                objective->active = active;
+            });
+        if (monitor != nullptr && monitor->IsBest()) {
+            best = embedding;
+            best_coeff = coeff;
+        }
+    }
+    if (monitor != nullptr && monitor->RestoreBest()) {
+        embedding.swap(best);
+        coeff.swap(best_coeff);
     }
 }
 
@@ -105,6 +134,11 @@ double SparseEmbedding::Evaluate(int x, int y) {
     return val;
 }
 
+Model* GetSparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer,
+                          TrainingMonitor* monitor) {
+    return new SparseEmbedding(graph, negative, neg_penalty, regularizer, monitor);
+}
+
 Model* GetSparseEmbedding(const Graph& graph, const Graph& negative, double neg_penalty, double regularizer) {
-    return new SparseEmbedding(graph, negative, neg_penalty, regularizer);
+    return GetSparseEmbedding(graph, negative, neg_penalty, regularizer, nullptr);
 }
\ No newline at end of file
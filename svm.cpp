@@ -8,42 +8,94 @@
 #define KERNEL_EPOCHS 4
 #define INFTY 1e10
 
-// Dual Coordinate Descent
-void LinearSVM(const std::vector<const double*>& feature, const std::vector<double>& feature_sqr_norm, const std::vector<int>& label,
-    const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
-    std::vector<double>* w, int dim, bool l2) {
-    int feature_size = feature.size();
-    std::fill(w->begin(), w->end(), 0);
+namespace {
+    // Dual Coordinate Descent; get_feature(i) returns a pointer that stays valid until the next call
+    template <typename FeatureSource>
+    double DualCoordinateDescent(int feature_size, FeatureSource get_feature, const std::vector<double>& feature_sqr_norm,
+        const std::vector<int>& label, const std::vector<double>& penalty_coeff, const std::vector<double>& margin,
+        std::vector<double>* coeff, real* w, const VectorKernel& kernel, int dim, bool l2) {
+        std::fill(w, w + dim, 0);
 
-    if (feature_size == 0) return;
-    for (int i = 0; i < feature_size; ++i)
-        if (fabs(coeff->at(i)) > 1e-4)
-        for (int j = 0; j < dim; ++j)
-            w->at(j) += feature[i][j] * coeff->at(i);
+        if (feature_size == 0) return 0;
+        for (int i = 0; i < feature_size; ++i)
+            if (fabs(coeff->at(i)) > 1e-4)
+                kernel.axpy(coeff->at(i), get_feature(i), w, dim);
 
-    std::vector<int> order(feature_size);
-    for (int i = 0; i < feature_size; ++i)
-        order[i] = i;
-    for (int epoch = 0; epoch < LINEAR_EPOCHS; ++epoch) {
-        RandomPermutation(&order);
-        for (int i : order) {
-            double G = label[i] * InnerProduct(w->data(), feature[i], dim) - margin[i];
-            double U = (l2 ? INFTY : penalty_coeff[i]);
-            double PG = G;
-            if (coeff->at(i) == 0)
-                PG = std::min(PG, (double)0);
-            if (coeff->at(i) == U * label[i])
-                PG = std::max(PG, (double)0);
-            if (PG != 0) {
-                double old_coeff = coeff->at(i);
-                double Q = feature_sqr_norm[i] + (l2 ? 1 / penalty_coeff[i] : 0) / 2;
-                double new_alpha = std::min(std::max(coeff->at(i) * label[i] - G / Q, (double)0), U);
-                coeff->at(i) = new_alpha * label[i];
-                for (int j = 0; j < dim; ++j)
-                    w->at(j) += (coeff->at(i) - old_coeff) * feature[i][j];
+        std::vector<int> order(feature_size);
+        for (int i = 0; i < feature_size; ++i)
+            order[i] = i;
+        double violation = 0;
+        for (int epoch = 0; epoch < LINEAR_EPOCHS; ++epoch) {
+            RandomPermutation(&order);
+            violation = 0;
+            for (int i : order) {
+                const real* feature = get_feature(i);
+                double G = label[i] * kernel.inner_product(w, feature, dim) - margin[i];
+                double U = (l2 ? INFTY : penalty_coeff[i]);
+                double PG = G;
+                if (coeff->at(i) == 0)
+                    PG = std::min(PG, (double)0);
+                if (coeff->at(i) == U * label[i])
+                    PG = std::max(PG, (double)0);
+                violation = std::max(violation, fabs(PG));
+                if (PG != 0) {
+                    double old_coeff = coeff->at(i);
+                    double Q = feature_sqr_norm[i] + (l2 ? 1 / penalty_coeff[i] : 0) / 2;
+                    double new_alpha = std::min(std::max(coeff->at(i) * label[i] - G / Q, (double)0), U);
+                    coeff->at(i) = new_alpha * label[i];
+                    kernel.axpy(coeff->at(i) - old_coeff, feature, w, dim);
+                }
             }
         }
+        return violation;
+    }
+}   // anonymous namespace
+
+double LinearSVM(const std::vector<const real*>& feature, const std::vector<double>& feature_sqr_norm, const std::vector<int>& label,
+    const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
+    real* w, int dim, bool l2) {
+    return LinearSVM(feature, feature_sqr_norm, label, penalty_coeff, margin, coeff, w, GetVectorKernel(dim), dim, l2);
+}
+
+double LinearSVM(const std::vector<const real*>& feature, const std::vector<double>& feature_sqr_norm, const std::vector<int>& label,
+    const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
+    real* w, const VectorKernel& kernel, int dim, bool l2) {
+    return DualCoordinateDescent(feature.size(), [&feature](int i) { return feature[i]; }, feature_sqr_norm, label,
+        penalty_coeff, margin, coeff, w, kernel, dim, l2);
+}
+
+double LinearSVM(const LinearSVMProblem& problem, std::vector<double>* coeff, real* w, const VectorKernel& kernel, int dim, bool l2) {
+    return LinearSVM(problem.feature, problem.feature_sqr_norm, problem.label, problem.penalty_coeff, problem.margin,
+        coeff, w, kernel, dim, l2);
+}
+
+void LinearSVMObjective(const LinearSVMProblem& problem, const std::vector<double>& coeff, const real* w,
+    const VectorKernel& kernel, int dim, double* primal, double* dual, int* nonzero) {
+    // v = sum_i coeff_i feature_i is the w the dual coefficients stand for
+    std::vector<real> v(dim, 0);
+    double loss = 0, linear = 0;
+    *nonzero = 0;
+    for (int i = 0; i < (int)problem.feature.size(); ++i) {
+        loss += problem.penalty_coeff[i] * std::max(0.0, problem.margin[i] - problem.label[i] * kernel.inner_product(w, problem.feature[i], dim));
+        if (coeff[i] != 0) {
+            linear += coeff[i] * problem.label[i] * problem.margin[i];
+            kernel.axpy(coeff[i], problem.feature[i], v.data(), dim);
+            ++*nonzero;
+        }
     }
+    *primal = kernel.inner_product(w, w, dim) / 2 + loss;
+    *dual = linear - kernel.inner_product(v.data(), v.data(), dim) / 2;
+}
+
+double ImplicitLinearSVM(int feature_size, const std::function<void(int, real*)>& make_feature, const std::vector<double>& feature_sqr_norm,
+    const std::vector<int>& label, const std::vector<double>& penalty_coeff, const std::vector<double>& margin,
+    std::vector<double>* coeff, real* w, const VectorKernel& kernel, int dim, bool l2) {
+    std::vector<real> buffer(dim);
+    auto get_feature = [&](int i) -> const real* {
+        make_feature(i, buffer.data());
+        return buffer.data();
+    };
+    return DualCoordinateDescent(feature_size, get_feature, feature_sqr_norm, label, penalty_coeff, margin, coeff, w, kernel, dim, l2);
 }
 
 // Sequential Minimal Optimization
@@ -80,4 +132,25 @@ void KernelSVM(const std::vector<std::vector<double>>& kernel, const std::vector
             }
         }
     }
-}
\ No newline at end of file
+}
+
+void KernelSVMObjective(const std::vector<std::vector<double>>& kernel, const std::vector<int>& label,
+    const std::vector<double>& penalty_coeff, const std::vector<double>& margin,
+    const std::vector<double>& coeff, double* primal, double* dual, int* nonzero) {
+    double sqr_norm = 0, loss = 0, linear = 0;
+    *nonzero = 0;
+    for (int i = 0; i < (int)coeff.size(); ++i) {
+        // <w, feature_i> with w = sum_j coeff_j feature_j
+        double product = 0;
+        for (int j = 0; j < (int)coeff.size(); ++j)
+            product += coeff[j] * kernel[i][j];
+        sqr_norm += coeff[i] * product;
+        loss += penalty_coeff[i] * std::max(0.0, margin[i] - label[i] * product);
+        if (coeff[i] != 0) {
+            linear += coeff[i] * label[i] * margin[i];
+            ++*nonzero;
+        }
+    }
+    *primal = sqr_norm / 2 + loss;
+    *dual = linear - sqr_norm / 2;
+}
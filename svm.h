@@ -1,10 +1,45 @@
 #pragma once
 
 #include <vector>
+#include <functional>
+#include "utility.h"
+
+// Inputs of one LinearSVM call: the subproblem of a single node in the embedding models
+struct LinearSVMProblem {
+    std::vector<const real*> feature;
+    std::vector<double> feature_sqr_norm, penalty_coeff, margin;
+    std::vector<int> label;
+    void Add(const real* f, double sqr_norm, int l, double penalty, double m) {
+        feature.push_back(f);
+        feature_sqr_norm.push_back(sqr_norm);
+        label.push_back(l);
+        penalty_coeff.push_back(penalty);
+        margin.push_back(m);
+    }
+};
 
 // In the following two functions, coeff serves both as starting point as well as return value
-void LinearSVM(const std::vector<const double*>& feature, const std::vector<double>& feature_norm, const std::vector<int>& label,
-               const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
-               std::vector<double>* w, int dim, bool l2);
+// w points to dim values and may be a slice of a larger row
+// The linear solvers return the largest projected gradient of their last pass, which measures how far
+// the subproblem still is from optimal
+double LinearSVM(const std::vector<const real*>& feature, const std::vector<double>& feature_norm, const std::vector<int>& label,
+                 const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
+                 real* w, int dim, bool l2);
+double LinearSVM(const std::vector<const real*>& feature, const std::vector<double>& feature_norm, const std::vector<int>& label,
+                 const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, 
+                 real* w, const VectorKernel& kernel, int dim, bool l2);
+// Same solver without stored features: make_feature(i, out) writes feature i into out on demand
+double ImplicitLinearSVM(int feature_size, const std::function<void(int, real*)>& make_feature, const std::vector<double>& feature_sqr_norm,
+                         const std::vector<int>& label, const std::vector<double>& penalty_coeff, const std::vector<double>& margin,
+                         std::vector<double>* coeff, real* w, const VectorKernel& kernel, int dim, bool l2);
 void KernelSVM(const std::vector<std::vector<double>>& kernel, const std::vector<int>& label, 
-               const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, bool l2);
\ No newline at end of file
+               const std::vector<double>& penalty_coeff, const std::vector<double>& margin, std::vector<double>* coeff, bool l2);
+double LinearSVM(const LinearSVMProblem& problem, std::vector<double>* coeff, real* w, const VectorKernel& kernel, int dim, bool l2);
+// Hinge-loss primal objective at w and dual objective at coeff, with nonzero counting the nonzero
+// coefficients. Any w bounds any feasible coeff from above, so primal - dual bounds the distance of
+// both from the optimum.
+void LinearSVMObjective(const LinearSVMProblem& problem, const std::vector<double>& coeff, const real* w,
+                        const VectorKernel& kernel, int dim, double* primal, double* dual, int* nonzero);
+void KernelSVMObjective(const std::vector<std::vector<double>>& kernel, const std::vector<int>& label,
+                        const std::vector<double>& penalty_coeff, const std::vector<double>& margin,
+                        const std::vector<double>& coeff, double* primal, double* dual, int* nonzero);
@@ -1,11 +1,12 @@
 #include "unit_test.h"
 #include "svm.h"
+#include "utility.h"
 #include <vector>
 #include <cassert>
 #include <iostream>
 
-std::vector<double> MakeFeature(double a, double b, double c) {
-    std::vector<double> vec;
+std::vector<real> MakeFeature(double a, double b, double c) {
+    std::vector<real> vec;
     vec.push_back(a);
     vec.push_back(b);
     vec.push_back(c);
@@ -22,7 +23,7 @@ std::vector<double> MakeVector(double a, double b, double c, double d) {
 }
 
 void LinearSVMTest() {
-    std::vector<std::vector<double>> feature_vec;
+    std::vector<std::vector<real>> feature_vec;
     std::vector<int> label;
     std::vector<double> sqr_norm;
     feature_vec.push_back(MakeFeature(1, 1, 1)); label.push_back(1); sqr_norm.push_back(3);
@@ -30,17 +31,20 @@ void LinearSVMTest() {
     feature_vec.push_back(MakeFeature(-1, -1, -1)); label.push_back(-1); sqr_norm.push_back(3);
     feature_vec.push_back(MakeFeature(-2, -2, -3)); label.push_back(-1); sqr_norm.push_back(17);
 
-    std::vector<const double*> feature_ptr;
+    std::vector<const real*> feature_ptr;
     for (int i = 0; i < (int)label.size(); ++i)
         feature_ptr.push_back(feature_vec[i].data());
-    std::vector<double> coeff(4, 0), margin(4, 1), penalty_coeff(4, 1000), w(4, 0);
-    LinearSVM(feature_ptr, sqr_norm, label, penalty_coeff, margin, &coeff, &w, 3, false);
+    std::vector<double> coeff(4, 0), margin(4, 1), penalty_coeff(4, 1000);
+    std::vector<real> w(4, 0);
+    LinearSVM(feature_ptr, sqr_norm, label, penalty_coeff, margin, &coeff, w.data(), 3, false);
     assert(fabs(w[0] - 0.3333) < 1e-3);
     assert(fabs(w[1] - 0.3333) < 1e-3);
     assert(fabs(w[2] - 0.3333) < 1e-3);
     assert(fabs(coeff[0] - coeff[2] - 0.3333) < 1e-3);
     assert(fabs(coeff[1]) < 1e-3);
     assert(fabs(coeff[3]) < 1e-3);
+    // Started from its own solution the solver has nothing left to fix
+    assert(LinearSVM(feature_ptr, sqr_norm, label, penalty_coeff, margin, &coeff, w.data(), 3, false) < 1e-2);
 }
 
 void KernelSVMTest() {
@@ -6,5 +6,6 @@ int main() {
     UtilityTest();
     EmbeddingTest();
     EvaluateTest();
+    ServerTest();
     system("pause");
 }
@@ -3,4 +3,5 @@
 void SVMTest();
 void UtilityTest();
 void EmbeddingTest();
-void EvaluateTest();
\ No newline at end of file
+void EvaluateTest();
+void ServerTest();
\ No newline at end of file
@@ -2,11 +2,185 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <cmath>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define WORKLIST_BUCKETS 64
+#define WORKLIST_MIN_EXPONENT -40
 
 namespace {
-    std::mt19937 gen(910109);
+    int thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+    // Threads a ParallelFor worker may use for nested loops; 0 outside the workers
+    thread_local int thread_share = 0;
+    // ThreadGenerators alive on this thread, and the seed of the last SeedThread call; plain pointers
+    // so that they outlive every generator at thread exit
+    thread_local ThreadGenerator* thread_generators = nullptr;
+    thread_local bool thread_seeded = false;
+    thread_local unsigned thread_seed = 0;
+    thread_local ThreadGenerator gen(910109);
+    NodeSchedule node_schedule = SCHEDULE_RANDOM;
+
+    double GenericInnerProduct(const real* x, const real* y, int dim) {
+        return InnerProduct(x, y, dim);
+    }
+
+    void GenericAxpy(double a, const real* x, real* y, int dim) {
+        for (int i = 0; i < dim; ++i)
+            y[i] += (real)(a * x[i]);
+    }
+
+    // DIM is a multiple of 4; four partial sums break the dependency chain of the reduction
+    template <int DIM>
+    double FixedInnerProduct(const real* x, const real* y, int) {
+        double val[4] = {0, 0, 0, 0};
+        for (int i = 0; i < DIM; i += 4)
+            for (int k = 0; k < 4; ++k)
+                val[k] += (double)x[i + k] * y[i + k];
+        return (val[0] + val[1]) + (val[2] + val[3]);
+    }
+
+    template <int DIM>
+    void FixedAxpy(double a, const real* x, real* y, int) {
+        const real ra = (real)a;
+        for (int i = 0; i < DIM; ++i)
+            y[i] += ra * x[i];
+    }
+
+    template <int DIM>
+    VectorKernel MakeFixedKernel() {
+        VectorKernel kernel = {DIM, &FixedInnerProduct<DIM>, &FixedAxpy<DIM>};
+        return kernel;
+    }
+
+    const VectorKernel fixed_kernel[] = {
+        MakeFixedKernel<16>(), MakeFixedKernel<32>(), MakeFixedKernel<64>(), MakeFixedKernel<100>(),
+        MakeFixedKernel<128>(), MakeFixedKernel<200>(), MakeFixedKernel<256>(),
+    };
 }   // anonymous namespace
 
+const VectorKernel& GetVectorKernel(int dim) {
+    for (const VectorKernel& kernel : fixed_kernel)
+        if (kernel.dim == dim)
+            return kernel;
+    // Generic kernels ignore the dim field; they are shared by every other dimension
+    static const VectorKernel generic_kernel = {0, &GenericInnerProduct, &GenericAxpy};
+    return generic_kernel;
+}
+
+int GetThreadCount() {
+    return thread_share > 0 ? thread_share : thread_count;
+}
+
+void SetThreadCount(int count) {
+    thread_count = std::max(1, count);
+}
+
+void SetThreadShare(int count) {
+    thread_share = std::max(0, count);
+}
+
+void ParallelFor(int n, const std::function<void(int)>& body) {
+    int available = GetThreadCount();
+    int workers = std::min(available, n);
+    if (workers <= 1) {
+        for (int i = 0; i < n; ++i)
+            body(i);
+        return;
+    }
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < workers; ++t)
+        threads.push_back(std::thread([&, t]() {
+            thread_share = available / workers + (t < available % workers ? 1 : 0);
+            for (int i = next++; i < n; i = next++)
+                body(i);
+        }));
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+NodeSchedule GetNodeSchedule() {
+    return node_schedule;
+}
+
+void SetNodeSchedule(NodeSchedule schedule) {
+    node_schedule = schedule;
+}
+
+NodeWorklist::NodeWorklist(int size) : priority_(size, 0), bucket_(size, -1), buckets_(WORKLIST_BUCKETS), top_(-1) {}
+
+// Bucket 0 holds priorities below 2^WORKLIST_MIN_EXPONENT and the last bucket infinite ones
+int NodeWorklist::Bucket(double priority) {
+    if (!(priority > 0)) return -1;
+    if (std::isinf(priority)) return WORKLIST_BUCKETS - 1;
+    int exponent;
+    frexp(priority, &exponent);
+    return std::min(std::max(exponent - WORKLIST_MIN_EXPONENT, 0), WORKLIST_BUCKETS - 2);
+}
+
+void NodeWorklist::Set(int x, double priority) {
+    priority_[x] = priority;
+    int bucket = Bucket(priority);
+    if (bucket == bucket_[x]) return;
+    bucket_[x] = bucket;
+    if (bucket < 0) return;
+    buckets_[bucket].push_back(x);
+    top_ = std::max(top_, bucket);
+}
+
+int NodeWorklist::Pop(double min_priority) {
+    int lowest = std::max(Bucket(min_priority), 0);
+    while (top_ >= lowest) {
+        if (buckets_[top_].empty()) {
+            --top_;
+            continue;
+        }
+        int x = buckets_[top_].back();
+        buckets_[top_].pop_back();
+        if (bucket_[x] != top_) continue;
+        bucket_[x] = -1;
+        priority_[x] = 0;
+        return x;
+    }
+    return -1;
+}
+
+ThreadGenerator::ThreadGenerator(unsigned seed) : std::mt19937(seed), base_seed_(seed), next_(thread_generators) {
+    thread_generators = this;
+    if (thread_seeded)
+        Reseed(thread_seed);
+}
+
+ThreadGenerator::~ThreadGenerator() {
+    for (ThreadGenerator** it = &thread_generators; *it != nullptr; it = &(*it)->next_)
+        if (*it == this) {
+            *it = next_;
+            break;
+        }
+}
+
+void ThreadGenerator::Reseed(unsigned seed) {
+    std::seed_seq seq{base_seed_, seed};
+    this->seed(seq);
+}
+
+void SeedThread(unsigned seed) {
+    thread_seeded = true;
+    thread_seed = seed;
+    for (ThreadGenerator* it = thread_generators; it != nullptr; it = it->next_)
+        it->Reseed(seed);
+}
+
 void RandomPermutation(std::vector<int>* vec) {
     std::uniform_int_distribution<int> dist(0, vec->size() - 1);
     for (int i = 0; i < (int)vec->size(); ++i) {
@@ -49,7 +223,7 @@ double EvaluateAveragePrecision(const std::vector<double>& positive, const std::
         combine.push_back(std::make_pair(-p, 1));
     for (double p : negative)
         combine.push_back(std::make_pair(-p, -1));
-    sort(combine.begin(), combine.end());
+    ParallelSort(&combine, std::less<std::pair<double, int>>());
     int span_pos = 0, span_neg = 0, tot_pos = 0, tot_neg = 0;
     double current_p = -1e6, eps = 1e-4, ave_p = 0;
     for (const auto& pair : combine) {
@@ -71,6 +245,102 @@ double EvaluateAveragePrecision(const std::vector<double>& positive, const std::
     return ave_p;
 }
 
+double EvaluateAveragePrecisionHistogram(const std::vector<double>& positive, const std::vector<double>& negative,
+                                         int bins, double* error_bound) {
+    *error_bound = 0;
+    if (positive.empty()) return 0;
+    double low = positive[0], high = positive[0];
+    for (const std::vector<double>* scores : {&positive, &negative})
+        for (double p : *scores) {
+            low = std::min(low, p);
+            high = std::max(high, p);
+        }
+    double width = std::max(high - low, 1e-12) / bins;
+
+    // Per-thread histograms over contiguous chunks, reduced afterwards
+    int parts = GetThreadCount();
+    std::vector<std::vector<long long>> pos_count(parts, std::vector<long long>(bins, 0)), neg_count = pos_count;
+    ParallelFor(parts, [&](int t) {
+        for (int k = 0; k < 2; ++k) {
+            const std::vector<double>& scores = (k == 0 ? positive : negative);
+            std::vector<long long>& count = (k == 0 ? pos_count[t] : neg_count[t]);
+            size_t end = scores.size() * (t + 1) / parts;
+            for (size_t i = scores.size() * t / parts; i < end; ++i)
+                count[std::min(bins - 1, (int)((scores[i] - low) / width))]++;
+        }
+    });
+
+    long long tot_pos = 0, tot_neg = 0, mixed_pos = 0;
+    double ave_p = 0;
+    for (int b = bins - 1; b >= 0; --b) {
+        long long span_pos = 0, span_neg = 0;
+        for (int t = 0; t < parts; ++t) {
+            span_pos += pos_count[t][b];
+            span_neg += neg_count[t][b];
+        }
+        tot_pos += span_pos;
+        tot_neg += span_neg;
+        if (span_pos > 0)
+            ave_p += (double)span_pos / (double)positive.size() * tot_pos / (double)(tot_pos + tot_neg);
+        if (tot_neg > 0 && span_pos + span_neg > 1)
+            mixed_pos += span_pos;
+    }
+    *error_bound = (double)mixed_pos / (double)positive.size();
+    return ave_p;
+}
+
+bool MappedFile::Open(const std::string& file_name) {
+    Close();
+#ifdef _WIN32
+    std::ifstream fin(file_name, std::ios::binary);
+    if (!fin) return false;
+    buffer_.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+#else
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    handle_ = addr;
+    data_ = (const char*)addr;
+    size_ = st.st_size;
+    return true;
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef _WIN32
+    if (handle_ != nullptr)
+        munmap(handle_, size_);
+#endif
+    handle_ = nullptr;
+    buffer_.clear();
+    data_ = nullptr;
+    size_ = 0;
+}
+
+long long PeakResidentBytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
 Prop_Sampler::Prop_Sampler(const std::vector<double>& x) {
     double sum = 0;
     for (double item : x) {
@@ -1,6 +1,19 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <random>
+
+// Storage type of embedding rows. Building with FLOAT_EMBEDDING halves the memory and bandwidth of
+// every row; inner products, norms and dual coefficients are still accumulated in double.
+#ifdef FLOAT_EMBEDDING
+typedef float real;
+#else
+typedef double real;
+#endif
 
 inline double sqr(double x) {
     return x * x;
@@ -10,6 +23,37 @@ inline double sigmoid(double x) {
     return 1 / (1 + exp(-x));
 }
 
+// log(1 + e^x) without overflow
+inline double softplus(double x) {
+    return (x > 0 ? x : 0) + log1p(exp(-fabs(x)));
+}
+
+// Read-only view of a whole file, memory-mapped where the platform allows it
+class MappedFile {
+    const char* data_;
+    size_t size_;
+    std::vector<char> buffer_;
+    void* handle_;
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+  public:
+    MappedFile() : data_(nullptr), size_(0), handle_(nullptr) {}
+    ~MappedFile() { Close(); }
+    bool Open(const std::string& file_name);
+    void Close();
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    void Swap(MappedFile* other) {
+        std::swap(data_, other->data_);
+        std::swap(size_, other->size_);
+        buffer_.swap(other->buffer_);
+        std::swap(handle_, other->handle_);
+    }
+};
+
+// High-water mark of this process's resident memory in bytes; 0 where the platform does not report it
+long long PeakResidentBytes();
+
 class Prop_Sampler {
     std::vector<double> ps;
   public:
@@ -17,13 +61,109 @@ class Prop_Sampler {
     int GetSample();
 };
 
+// The per-file, per-thread random generator. SeedThread reseeds every ThreadGenerator of the calling
+// thread, including those first used later, from its own seed and the thread's seed, so that work handed
+// to a pooled thread does not depend on what that thread ran before.
+class ThreadGenerator : public std::mt19937 {
+    unsigned base_seed_;
+    ThreadGenerator* next_;
+  public:
+    explicit ThreadGenerator(unsigned seed = std::mt19937::default_seed);
+    ~ThreadGenerator();
+    void Reseed(unsigned thread_seed);
+    friend void SeedThread(unsigned seed);
+};
+void SeedThread(unsigned seed);
+
 void RandomPermutation(std::vector<int>* vec);
-inline double InnerProduct(const double* x, const double* y, int dim) {
+
+// Node order of the block coordinate descent trainers: a fresh random permutation every epoch, or the
+// most violated subproblems first (Gauss-Southwell). Process-wide, SCHEDULE_RANDOM by default.
+enum NodeSchedule {SCHEDULE_RANDOM, SCHEDULE_GREEDY};
+NodeSchedule GetNodeSchedule();
+void SetNodeSchedule(NodeSchedule schedule);
+
+// Max-priority worklist of nodes, bucketed by the binary exponent of the priority, so that Pop returns a
+// node within a factor of two of the largest priority. Nodes with priority 0 are not queued.
+class NodeWorklist {
+    std::vector<double> priority_;
+    std::vector<int> bucket_;                   // -1 when not queued
+    std::vector<std::vector<int>> buckets_;     // may hold stale entries, skipped by Pop
+    int top_;
+
+    static int Bucket(double priority);
+  public:
+    explicit NodeWorklist(int size);
+    double priority(int x) const { return priority_[x]; }
+    void Set(int x, double priority);
+    void Add(int x, double delta) { Set(x, priority_[x] + delta); }
+    // Removes a node of the highest bucket and returns it, or -1 once every node left is below the bucket
+    // of min_priority; the popped node's priority becomes 0
+    int Pop(double min_priority);
+};
+
+inline double InnerProduct(const real* x, const real* y, int dim) {
+    double val = 0;
+    for (int i = 0; i < dim; ++i)
+        val += (double)x[i] * y[i];
+    return val;
+}
+
+inline double SquaredDistance(const real* x, const real* y, int dim) {
     double val = 0;
     for (int i = 0; i < dim; ++i)
-        val += x[i] * y[i];
+        val += ((double)x[i] - y[i]) * ((double)x[i] - y[i]);
     return val;
 }
 
+// Inner product and axpy (y += a * x) for one embedding dimension. GetVectorKernel returns
+// fully unrolled versions for the common dimensions and a generic loop otherwise, so callers
+// pick the routine once (usually at model construction) and reuse it for every row.
+struct VectorKernel {
+    int dim;
+    double (*inner_product)(const real* x, const real* y, int dim);
+    void (*axpy)(double a, const real* x, real* y, int dim);
+};
+
+const VectorKernel& GetVectorKernel(int dim);
+
+// Worker thread count used by the parallel routines; defaults to the hardware concurrency. Inside a
+// ParallelFor worker it is that worker's share of the threads, so nested loops do not oversubscribe.
+int GetThreadCount();
+void SetThreadCount(int count);
+// Caps GetThreadCount() on the calling thread, for long-lived threads of their own such as server
+// workers that must not each fan out over every core; 0 lifts the cap
+void SetThreadShare(int count);
+// Runs body(i) for every i in [0, n), handing indices out to the worker threads one at a time
+void ParallelFor(int n, const std::function<void(int)>& body);
+
+// Sorts chunks on separate threads, then merges them pairwise
+template <typename T, typename Compare>
+void ParallelSort(std::vector<T>* vec, Compare comp) {
+    long long n = vec->size();
+    int parts = (int)std::min<long long>(GetThreadCount(), n / 4096 + 1);
+    std::vector<long long> bound(parts + 1);
+    for (int i = 0; i <= parts; ++i)
+        bound[i] = n * i / parts;
+    ParallelFor(parts, [&](int i) {
+        std::sort(vec->begin() + bound[i], vec->begin() + bound[i + 1], comp);
+    });
+    for (int width = 1; width < parts; width *= 2) {
+        std::vector<int> start;
+        for (int i = 0; i + width < parts; i += 2 * width)
+            start.push_back(i);
+        ParallelFor(start.size(), [&](int k) {
+            int i = start[k];
+            std::inplace_merge(vec->begin() + bound[i], vec->begin() + bound[i + width],
+                vec->begin() + bound[std::min(i + 2 * width, parts)], comp);
+        });
+    }
+}
+
 double EvaluateF1(const std::vector<double>& positive, const std::vector<double>& negative);
 double EvaluateAveragePrecision(const std::vector<double>& positive, const std::vector<double>& negative);
+// Treats each of the equal-width score bins as one tie group. The result differs from the exact AP by
+// at most *error_bound, the fraction of positives that share a bin with another score once some
+// negative has been ranked.
+double EvaluateAveragePrecisionHistogram(const std::vector<double>& positive, const std::vector<double>& negative,
+                                         int bins, double* error_bound);
@@ -1,6 +1,9 @@
 #include "utility.h"
+#include "base.h"
 #include "unit_test.h"
 #include <cassert>
+#include <cstdlib>
+#include <thread>
 
 void F1Test() {
     std::vector<double> pos, neg;
@@ -16,7 +19,162 @@ void AveragePrecisionTest() {
     assert(fabs(EvaluateAveragePrecision(pos, neg) - 0.83) < 0.01);
 }
 
+void VectorKernelTest() {
+    for (int dim : {7, 64, 100}) {
+        std::vector<real> x(dim), y(dim);
+        for (int i = 0; i < dim; ++i) {
+            x[i] = (real)(0.5 * i - 3);
+            y[i] = (real)(1 - 0.25 * i);
+        }
+        const VectorKernel& kernel = GetVectorKernel(dim);
+        assert(fabs(kernel.inner_product(x.data(), y.data(), dim) - InnerProduct(x.data(), y.data(), dim)) < 1e-6);
+        kernel.axpy(2, x.data(), y.data(), dim);
+        assert(fabs(y[dim - 1] - (1 - 0.25 * (dim - 1) + (dim - 1) - 6)) < 1e-6);
+    }
+}
+
+void NodeOrderTest() {
+    Graph graph(6);
+    graph.AddEdge(0, 3);
+    graph.AddEdge(3, 5);
+    graph.AddEdge(5, 1);
+    graph.AddEdge(1, 4);
+    graph.AddEdge(4, 2);
+    Label label(6);
+    label.SetLabel(3, 0);
+    std::vector<int> perm;
+    ComputeNodeOrder(graph, ORDER_RCM, &perm);
+    Graph permuted = graph;
+    PermuteGraph(perm, &permuted);
+    PermuteLabel(perm, &label);
+    // The path becomes consecutive ids, so every edge joins neighbors in the new order
+    for (int x = 0; x < 6; ++x)
+        for (int y : permuted.edge[x])
+            assert(abs(x - y) == 1);
+    assert(label.labeled[perm[3]] && label.label_instance[0][0] == perm[3]);
+}
+
+void ParallelAveragePrecisionTest() {
+    std::vector<double> pos, neg;
+    for (int i = 0; i < 20000; ++i) {
+        pos.push_back((i * 7919 % 10007) / 10007.0 + 0.3);
+        neg.push_back((i * 104729 % 10009) / 10009.0);
+    }
+    std::vector<int> vec(50000);
+    for (int i = 0; i < (int)vec.size(); ++i)
+        vec[i] = (i * 7919) % 50021;
+    ParallelSort(&vec, std::less<int>());
+    assert(std::is_sorted(vec.begin(), vec.end()));
+
+    double exact = EvaluateAveragePrecision(pos, neg), bound;
+    double approx = EvaluateAveragePrecisionHistogram(pos, neg, 4096, &bound);
+    assert(bound < 1);
+    assert(fabs(exact - approx) <= bound + 1e-9);
+    approx = EvaluateAveragePrecisionHistogram(pos, neg, 65536, &bound);
+    assert(fabs(exact - approx) < 0.01);
+}
+
+void SyntheticGraphTest() {
+    int threads = GetThreadCount();
+    for (SyntheticModel model : {SYNTHETIC_RMAT, SYNTHETIC_SBM, SYNTHETIC_BA}) {
+        SyntheticGraphConfig config;
+        config.model = model;
+        config.size = 3000;
+        config.edges = 24000;
+        config.communities = 4;
+        config.seed = 7;
+        // The same seed gives the same graph whatever the thread count
+        CSRGraph one, many;
+        Label label;
+        SetThreadCount(1);
+        GenerateGraph(config, &one, nullptr);
+        SetThreadCount(4);
+        GenerateGraph(config, &many, &label);
+        assert(one.offset == many.offset && one.neighbor == many.neighbor);
+        assert(many.neighbor.size() > 30000 && label.card == 4);
+
+        std::vector<int> community(config.size, -1);
+        for (int l = 0; l < label.card; ++l)
+            for (int x : label.label_instance[l])
+                community[x] = l;
+        long long intra = 0, max_degree = 0;
+        for (int x = 0; x < config.size; ++x) {
+            assert(community[x] >= 0);
+            max_degree = std::max<long long>(max_degree, many.Neighbors(x).size());
+            for (int y : many.Neighbors(x)) {
+                assert(y != x);
+                intra += community[x] == community[y];
+            }
+        }
+        // Planted communities are denser than chance (1 / 4), and R-MAT / BA degrees are skewed
+        assert(intra > 0.3 * many.neighbor.size());
+        if (model == SYNTHETIC_SBM)
+            assert(intra > 0.7 * many.neighbor.size());
+        else
+            assert(max_degree > 5 * (long long)many.neighbor.size() / config.size);
+
+        Graph graph;
+        GenerateGraph(config, &graph, nullptr);
+        for (int x = 0; x < config.size; ++x)
+            assert(std::equal(graph.edge[x].begin(), graph.edge[x].end(), many.Neighbors(x).begin()) &&
+                   graph.edge[x].size() == many.Neighbors(x).size());
+        DGraph d_graph;
+        GenerateGraph(config, &d_graph, nullptr);
+        size_t arcs = 0;
+        for (int x = 0; x < config.size; ++x)
+            arcs += d_graph.out_edge[x].size();
+        assert(arcs * 2 >= many.neighbor.size() && arcs <= (size_t)config.edges);
+    }
+    SetThreadCount(threads);
+}
+
+void NodeWorklistTest() {
+    NodeWorklist worklist(5);
+    worklist.Set(0, 0.5);
+    worklist.Set(1, 8);
+    worklist.Set(2, 1e-6);
+    worklist.Set(3, INFINITY);
+    assert(worklist.Pop(0.01) == 3 && worklist.priority(3) == 0);
+    assert(worklist.Pop(0.01) == 1);
+    // Raising a queued node moves it up; nodes below the threshold stay queued
+    worklist.Add(4, 0.25);
+    worklist.Add(4, 4);
+    assert(worklist.Pop(0.01) == 4);
+    assert(worklist.Pop(0.01) == 0);
+    assert(worklist.Pop(0.01) == -1);
+    assert(worklist.Pop(0) == 2 && worklist.Pop(0) == -1);
+    worklist.Set(1, 3);
+    worklist.Set(1, 0);
+    assert(worklist.Pop(0) == -1);
+}
+
+void SeedThreadTest() {
+    std::vector<int> first(20), second(20);
+    for (int i = 0; i < 20; ++i)
+        first[i] = second[i] = i;
+    SeedThread(3);
+    RandomPermutation(&first);
+    SeedThread(3);
+    RandomPermutation(&second);
+    assert(first == second);
+    // Generators first used after the call start from the thread's seed too
+    int drawn[2];
+    for (int k = 0; k < 2; ++k)
+        std::thread([&drawn, k]() {
+            SeedThread(3);
+            thread_local ThreadGenerator late(11);
+            drawn[k] = late();
+        }).join();
+    assert(drawn[0] == drawn[1] && std::mt19937(11)() != (unsigned)drawn[0]);
+}
+
 void UtilityTest() {
     F1Test();
     AveragePrecisionTest();
+    VectorKernelTest();
+    NodeOrderTest();
+    ParallelAveragePrecisionTest();
+    SyntheticGraphTest();
+    NodeWorklistTest();
+    SeedThreadTest();
 }
\ No newline at end of file